@@ -3,9 +3,14 @@
 #include "pipe/graph-io.h"
 #include "pipe/graph-print.h"
 #include "pipe/global.h"
+#include "pipe/prefetch.h"
 #include "core/log.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 // replace given display node instance by export module.
 // returns 0 on success.
@@ -66,6 +71,172 @@ disconnect_display_modules(
       dt_module_remove(graph, m); // disconnect and reset/ignore
 }
 
+// set the string parameter of the given module, returns 0 on success.
+static int
+set_param_string(
+    dt_graph_t *graph,
+    int         modid,
+    dt_token_t  parm,
+    const char *value)
+{
+  const int parid = dt_module_get_param(graph->module[modid].so, parm);
+  if(parid < 0) return 1;
+  const dt_ui_param_t *p = graph->module[modid].so->param[parid];
+  snprintf((char *)(graph->module[modid].param + p->offset), p->cnt, "%s", value);
+  return 0;
+}
+
+// have the source modules decode this file in the background
+static void
+prefetch_sources(
+    dt_graph_t *graph,
+    const char *filename)
+{
+  for(int m=0;m<graph->num_modules;m++)
+    if(graph->module[m].name == dt_token("rawinput") ||
+       graph->module[m].name == dt_token("jpginput"))
+      dt_prefetch(graph->module[m].name, filename);
+}
+
+static int
+is_regular_file(const struct dirent *d)
+{
+  return d->d_type == DT_REG || d->d_type == DT_LNK || d->d_type == DT_UNKNOWN;
+}
+
+// sidecars and other files next to the images which the sources can't open
+static int
+is_sidecar(const char *filename)
+{
+  static const char *ext[] = {
+    "xmp", "cfg", "txt", "pp3", "dop", "json", "xml", "md", "db", "sqlite", "lua",
+  };
+  const char *dot = strrchr(filename, '.');
+  if(!dot) return 0;
+  for(int k=0;k<sizeof(ext)/sizeof(ext[0]);k++)
+    if(!strcasecmp(dot+1, ext[k])) return 1;
+  return 0;
+}
+
+// read list of input files from a directory or a text file with one name per
+// line. returns the number of files, the list needs to be freed.
+static int
+read_batch_list(
+    const char *path,
+    char     ***files)
+{
+  struct stat st;
+  int cnt = 0;
+  *files = 0;
+  if(stat(path, &st)) return 0;
+  if(S_ISDIR(st.st_mode))
+  {
+    struct dirent **ent;
+    const int num = scandir(path, &ent, is_regular_file, alphasort);
+    if(num <= 0) return 0;
+    *files = malloc(sizeof(char*)*num);
+    for(int i=0;i<num;i++)
+    {
+      struct stat fst;
+      char *f = 0;
+      // symlinks and unknown types are followed to see whether they are files:
+      if(ent[i]->d_name[0] != '.' && !is_sidecar(ent[i]->d_name) &&
+         asprintf(&f, "%s/%s", path, ent[i]->d_name) != -1)
+      {
+        if(ent[i]->d_type == DT_REG || (!stat(f, &fst) && S_ISREG(fst.st_mode)))
+          (*files)[cnt++] = f;
+        else free(f);
+      }
+      free(ent[i]);
+    }
+    free(ent);
+    return cnt;
+  }
+  FILE *f = fopen(path, "rb");
+  if(!f) return 0;
+  char line[PATH_MAX];
+  int max = 0;
+  while(fgets(line, sizeof(line), f))
+  {
+    line[strcspn(line, "\r\n")] = 0;
+    if(!line[0]) continue;
+    if(cnt == max)
+    {
+      max = max ? 2*max : 256;
+      *files = realloc(*files, sizeof(char*)*max);
+    }
+    (*files)[cnt++] = strdup(line);
+  }
+  fclose(f);
+  return cnt;
+}
+
+// run the graph once per input file. only the filename parameter on the
+// input modules changes, so nodes, images and pipelines are kept as long as
+// the dimensions match. the next image is decoded while the device is still
+// busy with the last one, and the ones after that are prefetched on worker
+// threads meanwhile.
+static int
+run_batch(
+    dt_graph_t *graph,
+    dt_token_t  inst,
+    const char *batch)
+{
+  char **files = 0;
+  const int cnt = read_batch_list(batch, &files);
+  if(!cnt)
+  {
+    dt_log(s_log_err, "no input files in '%s'!", batch);
+    return 1;
+  }
+  int mod_export = dt_module_get(graph, dt_token("export8"), inst);
+  if(mod_export < 0) mod_export = dt_module_get(graph, dt_token("export"), inst);
+
+  int err = 0, done = 0, skipped = 0;
+  for(int i=0;i<cnt && !err;i++)
+  {
+    // keep every prefetch worker busy with one of the next files:
+    for(int j=i ? i+DT_PREFETCH_WORKERS : 1;j<=i+DT_PREFETCH_WORKERS && j<cnt;j++)
+      prefetch_sources(graph, files[j]);
+    for(int m=0;m<graph->num_modules;m++)
+      if(graph->module[m].name == dt_token("rawinput") ||
+         graph->module[m].name == dt_token("jpginput"))
+        set_param_string(graph, m, dt_token("filename"), files[i]);
+
+    dt_log(s_log_cli, "[%d/%d] %s", i+1, cnt, files[i]);
+    // the first time around set everything up, later only look at the rois:
+    const dt_graph_run_t run = !done ? s_graph_run_all & ~s_graph_run_wait_done :
+        graph->runflags | s_graph_run_roi_out | s_graph_run_upload_source | s_graph_run_download_sink;
+    if(dt_graph_run(graph, run) != VK_SUCCESS)
+    { // nothing has been submitted for this one. keep the output name of the
+      // previous image, it may still be in flight:
+      dt_log(s_log_err, "running the graph for '%s' failed, skipping it!", files[i]);
+      skipped++;
+      continue;
+    }
+    done++;
+    // the previous image is written with the output name still set to it:
+    if(dt_graph_wait_frames(graph, 1) != VK_SUCCESS) err = 1;
+
+    // now we can name the output after the current input, without extension:
+    const char *base = strrchr(files[i], '/');
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s", base ? base+1 : files[i]);
+    char *dot = strrchr(name, '.');
+    if(dot) *dot = 0;
+    set_param_string(graph, mod_export, dt_token("filename"), name);
+  }
+  if(dt_graph_wait(graph) != VK_SUCCESS) err = 1;
+  if(skipped)
+  {
+    dt_log(s_log_err, "%d of %d input files could not be processed!", skipped, cnt);
+    err = 1;
+  }
+  for(int i=0;i<cnt;i++) free(files[i]);
+  free(files);
+  return err;
+}
+
 int main(int argc, char *argv[])
 {
   // init global things, log and pipeline:
@@ -78,6 +249,9 @@ int main(int argc, char *argv[])
   dt_token_t output = dt_token("main");
   const char *filename = "output";
   int ldr = 1;
+  const char *perf_report = 0;
+  const char *batch = 0;
+  int perf_runs = 1;
   for(int i=0;i<argc;i++)
   {
     if(!strcmp(argv[i], "-g") && i < argc-1)
@@ -86,11 +260,18 @@ int main(int argc, char *argv[])
       dump_graph = 1;
     else if(!strcmp(argv[i], "--dump-nodes"))
       dump_graph = 2;
+    else if(!strcmp(argv[i], "--batch") && i < argc-1)
+      batch = argv[++i];
+    else if(!strcmp(argv[i], "--perf-report") && i < argc-1)
+      perf_report = argv[++i];
+    else if(!strcmp(argv[i], "--perf-runs") && i < argc-1)
+      perf_runs = atol(argv[++i]);
     // TODO: parse more output: filename, format related things etc
   }
   if(!graphcfg)
   {
-    dt_log(s_log_cli, "usage: vkdt-cli -g <graph.cfg> [-d verbosity] [--dump-modules|--dump-nodes]");
+    dt_log(s_log_cli, "usage: vkdt-cli -g <graph.cfg> [-d verbosity] [--dump-modules|--dump-nodes]\n"
+        "    [--batch <directory|list.txt>] [--perf-report <out.json>] [--perf-runs <n>]");
     exit(1);
   }
   if(qvk_init()) exit(1);
@@ -114,7 +295,19 @@ int main(int argc, char *argv[])
   // make sure all remaining display nodes are removed:
   disconnect_display_modules(&graph);
 
-  dt_graph_run(&graph, s_graph_run_all);
+  if(batch)
+  {
+    if(run_batch(&graph, output, batch)) exit(4);
+  }
+  else dt_graph_run(&graph, s_graph_run_all);
+
+  if(perf_report)
+  { // run the whole graph again to get some statistics, but don't export again:
+    for(int r=1;r<perf_runs;r++)
+      dt_graph_run(&graph, s_graph_run_upload_source | s_graph_run_wait_done);
+    if(dt_perf_write_json(&graph.perf, perf_report))
+      exit(3);
+  }
 
   if(dump_graph == 1)
     dt_graph_print_modules(&graph);
@@ -122,6 +315,7 @@ int main(int argc, char *argv[])
     dt_graph_print_nodes(&graph);
 
   dt_graph_cleanup(&graph);
+  dt_pipe_global_cleanup(); // needs the device to free cached pipelines
   qvk_cleanup();
   exit(0);
 }
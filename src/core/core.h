@@ -1,6 +1,9 @@
 #pragma once
 // some random helpers
 
+#include <stdint.h>
+#include <stddef.h>
+
 #define MIN(a,b) \
 ({ __typeof__ (a) _a = (a); \
    __typeof__ (b) _b = (b); \
@@ -10,3 +13,18 @@
    __typeof__ (b) _b = (b); \
    _a > _b ? _a : _b; })
 #define CLAMP(a,m,M) (MIN(MAX((a), (m)), (M)))
+
+// 64-bit fnv-1a hash. pass DT_HASH_INIT to start or the result of a
+// previous call to continue hashing more data.
+#define DT_HASH_INIT 14695981039346656037ul
+static inline uint64_t
+dt_hash(uint64_t hash, const void *data, size_t len)
+{
+  const uint8_t *b = (const uint8_t *)data;
+  for(size_t i=0;i<len;i++)
+  {
+    hash ^= b[i];
+    hash *= 1099511628211ul;
+  }
+  return hash;
+}
@@ -177,12 +177,6 @@ int main(int argc, char *argv[])
     }
     while (SDL_PollEvent(&event));
 
-    // TODO: rename? only calls imgui:
-    dt_gui_render_frame();
-
-    dt_gui_render();
-    dt_gui_present();
-
     // intel says:
     // ==
     // The pipeline is flushed when switching between 3D graphics rendering and
@@ -191,17 +185,24 @@ int main(int argc, char *argv[])
     // ==
     // which is unfortunate for us :/
 
-    // VkResult fence = vkGetFenceStatus(qvk.device, vkdt.graph_dev.command_fence);
-    // if(fence == VK_SUCCESS)
-    {
-    // TODO: if params changed:
+    // the graph only re-records its command buffer on structural changes,
+    // and only submits it if anything changed at all. it returns right after
+    // submission, so the gui is laid out on the cpu while the device works:
     VkResult err = dt_graph_run(&vkdt.graph_dev,
         vkdt.graph_dev.runflags
-       |s_graph_run_download_sink
-       |s_graph_run_record_cmd_buf
-       |s_graph_run_wait_done); // if we don't wait we can't resubmit because the fence would be used twice.
+       |s_graph_run_download_sink);
     if(err != VK_SUCCESS) break;
-    }
+
+    // TODO: rename? only calls imgui:
+    dt_gui_render_frame();
+
+    // the display image is sampled by our render pass, so the frame which
+    // writes it has to be done before we draw. it's the only one in flight,
+    // as we wait for it here every time.
+    if(dt_graph_wait(&vkdt.graph_dev) != VK_SUCCESS) break;
+    dt_gui_render();
+    dt_gui_present();
+
     clock_t end  = clock();
     dt_log(s_log_perf, "total frame time %2.3f s", (end - beg)/(double)CLOCKS_PER_SEC);
     beg = end;
@@ -211,6 +212,7 @@ int main(int argc, char *argv[])
 
 error:
   dt_graph_cleanup(&vkdt.graph_dev);
+  dt_pipe_global_cleanup();
   dt_gui_cleanup();
   exit(0);
 }
@@ -491,10 +491,12 @@ extern "C" void dt_gui_render_frame_imgui()
           char str[10] = {0};
           memcpy(str,
               &vkdt.graph_dev.module[modid].so->param[parid]->name, 8);
-          ImGui::SliderFloat(str, val,
+          if(ImGui::SliderFloat(str, val,
               vkdt.widget[i].min,
               vkdt.widget[i].max,
-              "%2.5f");
+              "%2.5f"))
+            // only the param block changed, no need to rebuild the graph:
+            dt_graph_module_params_changed(&vkdt.graph_dev, modid);
           break;
         }
         case dt_token("quad"):
@@ -7,13 +7,104 @@
 #include <stdio.h>
 #include <assert.h>
 
+// size class of a free block, rounded down
+static inline void
+mapping_insert(uint64_t size, int *fl, int *sl)
+{
+  if(size < DT_VKALLOC_SL_CNT)
+  {
+    *fl = 0;
+    *sl = size;
+    return;
+  }
+  const int f = 63 - __builtin_clzl(size);
+  *sl = (size >> (f - DT_VKALLOC_SL_LOG2)) ^ DT_VKALLOC_SL_CNT;
+  *fl = f - DT_VKALLOC_SL_LOG2 + 1;
+}
+
+// size class to start looking in, rounded up so every block there fits
+static inline void
+mapping_search(uint64_t size, int *fl, int *sl)
+{
+  if(size >= DT_VKALLOC_SL_CNT)
+    size += (1ul << (63 - __builtin_clzl(size) - DT_VKALLOC_SL_LOG2)) - 1;
+  mapping_insert(size, fl, sl);
+}
+
+// first non-empty list in the given class or above, two bitmap lookups
+static inline dt_vkmem_t*
+find_suitable(dt_vkalloc_t *a, int fl, int sl)
+{
+  if(fl >= DT_VKALLOC_FL_CNT) return 0;
+  uint32_t sl_map = a->sl_bitmap[fl] & (~0u << sl);
+  if(!sl_map)
+  {
+    const uint64_t fl_map = fl + 1 < 64 ? a->fl_bitmap & (~0ul << (fl + 1)) : 0;
+    if(!fl_map) return 0;
+    fl = __builtin_ctzl(fl_map);
+    sl_map = a->sl_bitmap[fl];
+  }
+  return a->free[fl][__builtin_ctz(sl_map)];
+}
+
+static inline void
+insert_free(dt_vkalloc_t *a, dt_vkmem_t *mem)
+{
+  int fl, sl;
+  mapping_insert(mem->size, &fl, &sl);
+  mem->free = 1;
+  mem->prev = mem->next = 0;
+  a->free[fl][sl] = DLIST_PREPEND(a->free[fl][sl], mem);
+  a->fl_bitmap     |= 1ul << fl;
+  a->sl_bitmap[fl] |= 1u  << sl;
+}
+
+static inline void
+remove_free(dt_vkalloc_t *a, dt_vkmem_t *mem)
+{
+  int fl, sl;
+  mapping_insert(mem->size, &fl, &sl);
+  if(a->free[fl][sl] == mem) a->free[fl][sl] = mem->next;
+  DLIST_RM_ELEMENT(mem);
+  mem->free = 0;
+  if(!a->free[fl][sl])
+  {
+    a->sl_bitmap[fl] &= ~(1u << sl);
+    if(!a->sl_bitmap[fl]) a->fl_bitmap &= ~(1ul << fl);
+  }
+}
+
+// grab an unused block descriptor, grow the pool if we run out
+static inline dt_vkmem_t*
+get_unused(dt_vkalloc_t *a)
+{
+  if(!a->unused)
+  {
+    const uint64_t c = a->pool_size / DT_VKALLOC_CHUNK;
+    a->chunk = realloc(a->chunk, sizeof(dt_vkmem_t*)*(c+1));
+    a->chunk[c] = calloc(DT_VKALLOC_CHUNK, sizeof(dt_vkmem_t));
+    for(int i=DT_VKALLOC_CHUNK-1;i>=0;i--)
+      a->unused = DLIST_PREPEND(a->unused, a->chunk[c]+i);
+    a->pool_size += DT_VKALLOC_CHUNK;
+  }
+  dt_vkmem_t *mem = a->unused;
+  a->unused = mem->next;
+  DLIST_RM_ELEMENT(mem);
+  return mem;
+}
+
+static inline void
+put_unused(dt_vkalloc_t *a, dt_vkmem_t *mem)
+{
+  memset(mem, 0, sizeof(*mem));
+  a->unused = DLIST_PREPEND(a->unused, mem);
+}
+
 void
 dt_vkalloc_init(dt_vkalloc_t *a)
 {
   memset(a, 0, sizeof(*a));
   a->heap_size = 1ul<<40; // doesn't matter, we'll never allocate this for real
-  a->pool_size = 100;
-  a->vkmem_pool = malloc(sizeof(dt_vkmem_t)*a->pool_size);
   dt_vkalloc_nuke(a);
 }
 
@@ -21,7 +112,9 @@ void
 dt_vkalloc_cleanup(dt_vkalloc_t *a)
 {
   // free whole thing
-  free(a->vkmem_pool);
+  for(int c=0;c<a->pool_size/DT_VKALLOC_CHUNK;c++)
+    free(a->chunk[c]);
+  free(a->chunk);
   // don't free a, it's owned externally
   memset(a, 0, sizeof(*a));
 }
@@ -29,75 +122,79 @@ dt_vkalloc_cleanup(dt_vkalloc_t *a)
 void
 dt_vkalloc_nuke(dt_vkalloc_t *a)
 {
-  memset(a->vkmem_pool, 0, sizeof(dt_vkmem_t)*a->pool_size); 
-  a->free = a->used = a->unused = 0;
-  a->free = DLIST_PREPEND(a->free, a->vkmem_pool);
-  a->free->offset = 0;
-  a->free->offset_orig = 0;
-  a->free->size = a->heap_size;
-  for(int i=1;i<a->pool_size;i++)
-    a->unused = DLIST_PREPEND(a->unused, a->vkmem_pool+i);
+  a->used = a->unused = 0;
+  memset(a->free, 0, sizeof(a->free));
+  memset(a->sl_bitmap, 0, sizeof(a->sl_bitmap));
+  a->fl_bitmap = 0;
+  // keep the chunks we already have:
+  for(int c=a->pool_size/DT_VKALLOC_CHUNK-1;c>=0;c--)
+    for(int i=DT_VKALLOC_CHUNK-1;i>=0;i--)
+      put_unused(a, a->chunk[c]+i);
+  dt_vkmem_t *mem = get_unused(a);
+  mem->offset = mem->offset_orig = 0;
+  mem->size = a->heap_size;
+  insert_free(a, mem);
   a->peak_rss = a->rss = a->vmsize = 0ul;
-  assert(!dt_vkalloc_check(a));
 }
 
 dt_vkmem_t*
 dt_vkalloc(dt_vkalloc_t *a, uint64_t size, uint64_t alignment)
 {
-  assert(!dt_vkalloc_check(a));
-  // linear scan through free list O(n)
-  dt_vkmem_t *l = a->free;
-  while(l)
+  assert(size < 1ul<<48);
+  if(!alignment) alignment = 1;
+  // try the first block of the exact size class, then the next class where
+  // all blocks fit. the block may be misaligned, in which case we look again
+  // for a block that fits the padding in the worst case:
+  int fl, sl;
+  mapping_insert(size, &fl, &sl);
+  dt_vkmem_t *l = a->free[fl][sl]; // blocks in our own class may fit, too
+  uint64_t offset = l ? ((l->offset + (alignment-1)) & ~(alignment-1)) : 0;
+  if(!l || offset + size > l->offset + l->size)
   {
-    dt_vkmem_t *mem = 0;
-    if(l->size == size && !(l->offset & (alignment-1)))
-    { // replace entry
-      mem = l;
-      if(l == a->free) a->free = l->next;
-      DLIST_RM_ELEMENT(mem);
-    }
-    else if((l->size > size && !(l->offset_orig & (alignment-1))) ||
-        l->size > size + alignment)
-    { // grab new mem entry from unused list
-      assert(a->unused && "vkalloc: no more free slots!");
-      if(!a->unused) return 0;
-      mem = a->unused;
-      assert(!dt_vkalloc_check(a));
-      a->unused = DLIST_REMOVE(a->unused, mem); // remove first is O(1)
-      // split, push to used and modify free entry.
-      // we'll just forget about the bits in between our base pointer
-      // and the requested alignment. we rely on nuking the memory pool
-      // very often anyways. plus, what's a few kilobytes among friends.
-      size_t end = l->offset_orig + l->size;
-      mem->offset_orig = l->offset_orig;
-      mem->offset = ((l->offset_orig + (alignment-1)) & ~(alignment-1));
-      assert(size < 1ul<<48);
-      mem->size = size;
-      l->offset = l->offset_orig = mem->offset + mem->size;
-      assert(end >= l->offset_orig);
-      l->size = end - l->offset_orig;
-    }
+    mapping_search(size, &fl, &sl);
+    l = find_suitable(a, fl, sl);
+    offset = l ? ((l->offset + (alignment-1)) & ~(alignment-1)) : 0;
+  }
+  if(!l || offset + size > l->offset + l->size)
+  {
+    mapping_search(size + alignment - 1, &fl, &sl);
+    l = find_suitable(a, fl, sl);
+    if(!l) return 0; // out of heap, the caller has to deal with it
+    offset = (l->offset + (alignment-1)) & ~(alignment-1);
+  }
+  remove_free(a, l);
 
-    if(mem)
-    {
-      a->rss += mem->size;
-      a->peak_rss = MAX(a->peak_rss, a->rss);
-      a->vmsize = MAX(a->vmsize, mem->offset + mem->size);
-      a->used = DLIST_PREPEND(a->used, mem);
-      mem->ref = 1;
-      assert(!dt_vkalloc_check(a));
-      return mem;
-    }
-    l = l->next;
+  // split off the rest and put it back on the free lists. we'll just forget
+  // about the bits in between our base pointer and the requested alignment,
+  // they come back when the block is freed.
+  const uint64_t end = l->offset + l->size;
+  if(end > offset + size)
+  {
+    dt_vkmem_t *rest = get_unused(a);
+    rest->offset = rest->offset_orig = offset + size;
+    rest->size = end - rest->offset;
+    rest->phys_prev = l;
+    rest->phys_next = l->phys_next;
+    if(l->phys_next) l->phys_next->phys_prev = rest;
+    l->phys_next = rest;
+    insert_free(a, rest);
   }
-  assert(0 && "out of memory slots!");
-  return 0;
+  dt_vkmem_t *mem = l;
+  mem->offset_orig = l->offset;
+  mem->offset = offset;
+  mem->size = size;
+
+  a->rss += mem->size;
+  a->peak_rss = MAX(a->peak_rss, a->rss);
+  a->vmsize = MAX(a->vmsize, mem->offset + mem->size);
+  a->used = DLIST_PREPEND(a->used, mem);
+  mem->ref = 1;
+  return mem;
 }
 
 void
 dt_vkfree(dt_vkalloc_t *a, dt_vkmem_t *mem)
 {
-  assert(!dt_vkalloc_check(a));
   assert(mem->ref > 0);
   if(mem->ref)
   {
@@ -105,90 +202,73 @@ dt_vkfree(dt_vkalloc_t *a, dt_vkmem_t *mem)
     if(mem->ref) return; // don't free if still referenced
   }
   else return; // no ref count: already freed
-  // remove from used list, put back to free list.
+  // remove from used list, the block covers the alignment padding again:
   a->rss -= mem->size;
-  a->used = DLIST_REMOVE(a->used, mem);
-  dt_vkmem_t *l = a->free;
-  do
+  if(a->used == mem) a->used = mem->next;
+  DLIST_RM_ELEMENT(mem);
+  mem->size += mem->offset - mem->offset_orig;
+  mem->offset = mem->offset_orig;
+
+  // merge with free neighbours:
+  dt_vkmem_t *t = mem->phys_prev;
+  if(t && t->free)
   {
-    // keep sorted
-    if(!l || l->offset >= mem->offset + mem->size)
-    {
-      dt_vkmem_t *t = DLIST_PREPEND(l, mem);
-      if(l == a->free) a->free = t; // keep consistent
-      // merge blocks:
-      t = mem->prev;
-      if(t)
-      { // merge with before
-        if(t->offset + t->size == mem->offset_orig)
-        {
-          t->size += mem->size + mem->offset - mem->offset_orig;
-          if(a->free == mem) a->free = mem->next;
-          DLIST_RM_ELEMENT(mem);
-          a->unused = DLIST_PREPEND(a->unused, mem);
-          mem = t;
-        }
-      }
-      t = mem->next;
-      if(t)
-      { // merge with after
-        if(t->offset_orig == mem->offset + mem->size)
-        {
-          t->offset = t->offset_orig = mem->offset_orig;
-          t->size += mem->size + mem->offset - mem->offset_orig;
-          if(a->free == mem) a->free = mem->next;
-          DLIST_RM_ELEMENT(mem);
-          a->unused = DLIST_PREPEND(a->unused, mem);
-          mem = t;
-        }
-      }
-      assert(!dt_vkalloc_check(a));
-      return; // done
-    }
+    remove_free(a, t);
+    t->size += mem->size;
+    t->phys_next = mem->phys_next;
+    if(mem->phys_next) mem->phys_next->phys_prev = t;
+    put_unused(a, mem);
+    mem = t;
   }
-  while(l && (l = l->next));
-  assert(0 && "vkalloc: inconsistent free list!");
+  t = mem->phys_next;
+  if(t && t->free)
+  {
+    remove_free(a, t);
+    mem->size += t->size;
+    mem->phys_next = t->phys_next;
+    if(t->phys_next) t->phys_next->phys_prev = mem;
+    put_unused(a, t);
+  }
+  insert_free(a, mem);
 }
 
-// perform an (expensive) internal consistency check in O(n^2)
+// perform an internal consistency check in O(n)
 int
 dt_vkalloc_check(dt_vkalloc_t *a)
 {
   // check list integrity:
-  dt_vkmem_t *l = a->free;
-  if(l)
+  for(int i=0;i<2;i++)
   {
-    if(l->prev) return 9;
-    while(l)
-    {
+    dt_vkmem_t *l = i ? a->unused : a->used;
+    if(l && l->prev) return 9;
+    for(;l;l=l->next)
       if(l->next && l->next->prev != l) return 10;
-      l = l->next;
-    }
-  }
-  l = a->used;
-  if(l)
-  {
-    if(l->prev) return 11;
-    while(l)
-    {
-      if(l->next && l->next->prev != l) return 12;
-      l = l->next;
-    }
   }
-  l = a->unused;
-  if(l)
+
+  // every free block is in the list of its size class, and the bitmaps agree:
+  uint64_t num_free = 0;
+  for(int fl=0;fl<DT_VKALLOC_FL_CNT;fl++)
   {
-    if(l->prev) return 13;
-    while(l)
+    if(!!(a->fl_bitmap & (1ul<<fl)) != !!a->sl_bitmap[fl]) return 11;
+    for(int sl=0;sl<DT_VKALLOC_SL_CNT;sl++)
     {
-      if(l->next && l->next->prev != l) return 14;
-      l = l->next;
+      dt_vkmem_t *l = a->free[fl][sl];
+      if(!!(a->sl_bitmap[fl] & (1u<<sl)) != !!l) return 12;
+      if(l && l->prev) return 13;
+      for(;l;l=l->next)
+      {
+        int f, s;
+        mapping_insert(l->size, &f, &s);
+        if(f != fl || s != sl) return 14;
+        if(!l->free) return 15;
+        if(l->next && l->next->prev != l) return 10;
+        num_free++;
+      }
     }
   }
 
   // count number of elements in linked lists
   uint64_t num_used = DLIST_LENGTH(a->used);
-  uint64_t num_free = DLIST_LENGTH(a->free);
   uint64_t num_unused = DLIST_LENGTH(a->unused);
   if(num_used + num_free + num_unused != a->pool_size)
   {
@@ -196,75 +276,36 @@ dt_vkalloc_check(dt_vkalloc_t *a)
     return 1;
   }
 
-  // make sure free list refs sorted blocks of memory
-  // also make sure they don't overlap
-  l = a->free;
-  uint64_t pos = 0, next_pos = 0;
-  while(l)
+  // walk the blocks in memory order, starting at the one at offset zero.
+  // they have to cover the heap without gaps or overlap, and no two free
+  // blocks may be neighbours:
+  dt_vkmem_t *l = a->used;
+  if(!l) for(int fl=0;fl<DT_VKALLOC_FL_CNT && !l;fl++)
+    for(int sl=0;sl<DT_VKALLOC_SL_CNT && !l;sl++)
+      l = a->free[fl][sl];
+  if(!l) return 2;
+  while(l->phys_prev) l = l->phys_prev;
+  uint64_t pos = 0, num_phys = 0, rss = 0, vmsize = 0;
+  for(;l;l=l->phys_next)
   {
-    if(l->offset_orig < pos) return 2;
-    if(l->offset_orig + l->size < next_pos) return 3;
-    pos = l->offset;
-    next_pos = l->offset + l->size;
-    l = l->next;
-  }
-
-  // make sure every pointer in pool is ref'd exactly once
-  uint8_t *mark = alloca(a->pool_size*sizeof(uint8_t));
-  memset(mark, 0, sizeof(uint8_t)*a->pool_size);
-  for(int i=0;i<3;i++)
-  {
-    l = a->used;
-    if(i == 1) l = a->free;
-    if(i == 2) l = a->unused;
-    while(l)
+    if(l->offset_orig != pos) return 3;
+    if(l->offset < l->offset_orig) return 4;
+    if(l->phys_next && l->phys_next->phys_prev != l) return 5;
+    if(l->free && l->phys_next && l->phys_next->free) return 6;
+    if(!l->free)
     {
-      int m = l - a->vkmem_pool;
-      if(mark[m]) return 4; // already marked
-      mark[m] = 1;
-      l = l->next;
-    }
-  }
-  for(int i=0;i<a->pool_size;i++)
-    if(!mark[i]) return 5; // we lost one entry!
-
-  // make sure no memory block is ref'd twice O(n^2)
-  for(int i=0;i<2;i++)
-  {
-    l = a->used;
-    if(i == 1) l = a->free;
-    while(l)
-    {
-      for(int i=0;i<2;i++)
-      {
-        dt_vkmem_t *l2 = a->used;
-        if(i == 1) l2 = a->free;
-        while(l2)
-        {
-          int good = 0;
-          if(l == l2) good = 1;
-          if(l->offset >= l2->offset + l2->size) good = 1;
-          if(l->offset +  l->size <= l2->offset) good = 1;
-          if(!good) return 6; // overlap detected!
-          l2 = l2->next;
-        }
-      }
-      l = l->next;
+      vmsize = MAX(vmsize, l->offset+l->size);
+      rss += l->size;
     }
+    pos = l->offset + l->size;
+    num_phys++;
   }
+  if(pos != a->heap_size) return 3;
+  if(num_phys != num_used + num_free) return 5;
 
   // see whether rss and vmsize are lying to us:
-  l = a->used;
-  uint64_t rss = 0, vmsize = 0;
-  while(l)
-  {
-    vmsize = MAX(vmsize, l->offset+l->size);
-    rss += l->size;
-    l = l->next;
-  }
   if(vmsize > a->vmsize) return 7;
   if(rss != a->rss) return 8;
 
   return 0; // yay, we made it!
 }
-
@@ -1,30 +1,44 @@
 #pragma once
 #include <stdint.h>
 
-// simple vulkan buffer memory allocator
-// for the node graph. single thread use, not optimised in any sense.
-// employs a free list and an allocation list, both allocation and free
-// are O(n). we hope to afford it because we'll use n~=10 buffers max.
+// vulkan buffer memory allocator for the node graph. single thread use.
+// this is a two level segregated fit allocator (tlsf): free blocks are kept
+// in lists by size class, found via two levels of bitmaps, and coalesced with
+// their physical neighbours on free. allocation and free are O(1).
+// the blocks only describe offsets into a virtual heap, the graph allocates
+// vmsize bytes of real memory once it knows how much it needs.
+
+#define DT_VKALLOC_SL_LOG2 4                       // log2 of number of second level classes
+#define DT_VKALLOC_SL_CNT  (1<<DT_VKALLOC_SL_LOG2)
+#define DT_VKALLOC_FL_CNT  48                      // first level classes, enough for 48-bit sizes
+#define DT_VKALLOC_CHUNK   256                     // number of dt_vkmem_t allocated at once
 
 typedef struct dt_vkmem_t
 {
   uint64_t offset;          // to be uploaded as uniform/push const
   uint64_t offset_orig;     // unaligned offset
-  uint64_t ref  : 16;       // reference count
+  uint64_t ref  : 15;       // reference count
+  uint64_t free : 1;        // in one of the free lists
   uint64_t size : 48;       // only for us, the gpu will know what they asked for
-  struct dt_vkmem_t *prev;  // for alloced/free lists
+  struct dt_vkmem_t *prev;  // for used/free lists
   struct dt_vkmem_t *next;
+  struct dt_vkmem_t *phys_prev; // neighbouring blocks in memory
+  struct dt_vkmem_t *phys_next;
 }
 dt_vkmem_t;
 
 typedef struct dt_vkalloc_t
 {
   dt_vkmem_t *used;
-  dt_vkmem_t *free;
+  // segregated free lists and bitmaps of non-empty lists
+  dt_vkmem_t *free[DT_VKALLOC_FL_CNT][DT_VKALLOC_SL_CNT];
+  uint64_t    fl_bitmap;
+  uint32_t    sl_bitmap[DT_VKALLOC_FL_CNT];
 
-  // fixed size pool of dt_vkmem_t to not fragment our real heap with this nonsense:
+  // pool of dt_vkmem_t to not fragment our real heap with this nonsense.
+  // grows in chunks, so pointers to blocks stay valid:
   uint64_t pool_size;
-  dt_vkmem_t *vkmem_pool; // fixed size pool allocation
+  dt_vkmem_t **chunk;     // pool_size/DT_VKALLOC_CHUNK arrays of blocks
   dt_vkmem_t *unused;     // linked list into the above which are neither used nor free
 
   uint64_t heap_size;
@@ -46,5 +60,5 @@ void dt_vkfree(dt_vkalloc_t *a, dt_vkmem_t *mem);
 // free all the mallocs!
 void dt_vkalloc_nuke(dt_vkalloc_t *a);
 
-// perform an (expensive) internal consistency check in O(n^2)
+// perform an internal consistency check in O(n)
 int dt_vkalloc_check(dt_vkalloc_t *a);
@@ -4,6 +4,7 @@
 #include "alloc.h"
 
 #include <stdint.h>
+#include <math.h>
 #include <vulkan/vulkan.h>
 
 // info about a region of interest.
@@ -17,6 +18,31 @@ typedef struct dt_roi_t
 }
 dt_roi_t;
 
+// rows [y, y+ht) of the given roi, as a roi of their own. y is moved to
+// input scale, where the offset lives.
+static inline dt_roi_t
+dt_roi_band(const dt_roi_t *roi, uint32_t y, uint32_t ht)
+{
+  dt_roi_t band = *roi;
+  band.y  = roi->y + roundf(y * roi->scale);
+  band.ht = ht;
+  return band;
+}
+
+// largest band height up to rows which covers a whole number of pixels on
+// input scale, if there is one not much smaller. bands of this height start
+// exactly where the rows of the whole roi would sample the input.
+static inline uint32_t
+dt_roi_band_rows(const dt_roi_t *roi, uint32_t rows)
+{
+  for(uint32_t r=rows;r>rows/2;r--)
+  {
+    const float yi = r * roi->scale;
+    if(fabsf(yi - roundf(yi)) < 1e-3f) return r;
+  }
+  return rows;
+}
+
 typedef enum dt_connector_flags_t
 {
   s_conn_none   = 0,
@@ -41,6 +67,7 @@ typedef struct dt_connector_t
   dt_token_t type;   // read write source sink
   dt_token_t chan;   // rgb yuv..
   dt_token_t format; // f32 ui16
+  dt_token_t narrow; // outputs only: narrowest storage format the data tolerates (un8 f11) or 0
 
   dt_connector_flags_t flags;
 
@@ -60,17 +87,18 @@ typedef struct dt_connector_t
 
   // buffer associated with this in case it connects nodes:
   uint64_t offset, size;
-  uint64_t offset_staging, size_staging;
   // mem object for allocator:
   // while this may seem duplicate with offset/size, it may be freed already
   // and the offset and size are still valid for successive runs through the
   // pipeline once it has been setup.
   dt_vkmem_t *mem;
-  dt_vkmem_t *mem_staging;
+  int         plan;        // outputs only: index of our live range in the graph's plan
 
   VkImage     image;
   VkImageView image_view;
-  VkBuffer    staging;    // for sources and sinks
+  // outputs only: state of the image at the end of the recorded commands
+  VkImageLayout layout;
+  VkAccessFlags access;
 
   VkFramebuffer framebuffer; // for draw kernels
 }
@@ -124,6 +152,8 @@ dt_connector_bytes_per_pixel(const dt_connector_t *c)
     case dt_token("f16") :
       return 2;
     case dt_token("ui8") :
+    case dt_token("un8") :
+    case dt_token("f11") : // packed, only rgb(a)
       return 1;
   }
   return 0;
@@ -181,6 +211,19 @@ dt_connector_vkformat(const dt_connector_t *c)
       case 3: // return VK_FORMAT_R8G8B8_UINT;
       case 4: return VK_FORMAT_R8G8B8A8_UINT;
     }
+    case dt_token("un8") : switch(len)
+    {
+      case 1: return VK_FORMAT_R8_UNORM;
+      case 2: return VK_FORMAT_R8G8_UNORM;
+      case 3: // return VK_FORMAT_R8G8B8_UNORM;
+      case 4: return VK_FORMAT_R8G8B8A8_UNORM;
+    }
+    case dt_token("f11") : switch(len)
+    {
+      case 3:
+      case 4: return VK_FORMAT_B10G11R11_UFLOAT_PACK32; // no alpha, unsigned
+      default: return VK_FORMAT_UNDEFINED;
+    }
   }
   return VK_FORMAT_UNDEFINED;
 }
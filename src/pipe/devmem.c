@@ -0,0 +1,160 @@
+#include "devmem.h"
+#include "core/core.h"
+#include "core/log.h"
+#include "qvk/qvk.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void
+dt_devmem_init(dt_devmem_pool_t *p)
+{
+  memset(p, 0, sizeof(*p));
+  pthread_mutex_init(&p->mutex, 0);
+}
+
+static void
+block_free(dt_devmem_pool_t *p, dt_devmem_block_t *b)
+{
+  if(b->mapped) vkUnmapMemory(qvk.device, b->mem);
+  vkFreeMemory(qvk.device, b->mem, 0);
+  dt_vkalloc_cleanup(&b->heap);
+  p->allocated -= b->size;
+  memset(b, 0, sizeof(*b));
+}
+
+void
+dt_devmem_cleanup(dt_devmem_pool_t *p)
+{
+  for(int b=0;b<p->num_blocks;b++)
+    if(p->block[b].mem) block_free(p, p->block+b);
+  free(p->block);
+  pthread_mutex_destroy(&p->mutex);
+  memset(p, 0, sizeof(*p));
+}
+
+// allocate a new block which fits at least size bytes, returns its index or -1
+static int
+block_alloc(dt_devmem_pool_t *p, uint64_t size, uint32_t type)
+{
+  int b = 0;
+  for(;b<p->num_blocks;b++) if(!p->block[b].mem) break;
+  if(b == p->max_blocks)
+  {
+    p->max_blocks = MAX(8, 2*p->max_blocks);
+    p->block = realloc(p->block, sizeof(dt_devmem_block_t)*p->max_blocks);
+  }
+  dt_devmem_block_t *blk = p->block + b;
+  memset(blk, 0, sizeof(*blk));
+  // small heaps (host visible device memory, say) may not take a full block:
+  VkMemoryAllocateInfo mem_alloc_info = {
+    .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize  = MAX(size, DT_DEVMEM_BLOCK_SIZE),
+    .memoryTypeIndex = type,
+  };
+  if(vkAllocateMemory(qvk.device, &mem_alloc_info, 0, &blk->mem) != VK_SUCCESS)
+  {
+    mem_alloc_info.allocationSize = size;
+    if(size >= DT_DEVMEM_BLOCK_SIZE ||
+       vkAllocateMemory(qvk.device, &mem_alloc_info, 0, &blk->mem) != VK_SUCCESS)
+    {
+      blk->mem = 0;
+      return -1;
+    }
+  }
+  blk->type = type;
+  blk->size = mem_alloc_info.allocationSize;
+  if(qvk.mem_properties.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+  {
+    if(vkMapMemory(qvk.device, blk->mem, 0, VK_WHOLE_SIZE, 0, (void**)&blk->mapped) != VK_SUCCESS)
+    {
+      vkFreeMemory(qvk.device, blk->mem, 0);
+      blk->mem = 0;
+      return -1;
+    }
+  }
+  dt_vkalloc_init(&blk->heap);
+  blk->heap.heap_size = blk->size;
+  dt_vkalloc_nuke(&blk->heap);
+  p->allocated += blk->size;
+  if(b == p->num_blocks) p->num_blocks++;
+  dt_log(s_log_pipe, "[devmem] new block of %g MB of memory type %u, %g MB allocated in total",
+      blk->size/(1024.0*1024.0), type, p->allocated/(1024.0*1024.0));
+  return b;
+}
+
+static void
+range_free(dt_devmem_pool_t *p, dt_devmem_t *m)
+{
+  if(!m->mem) return;
+  dt_devmem_block_t *blk = p->block + m->block;
+  dt_vkfree(&blk->heap, m->range);
+  p->used -= m->size;
+  if(!blk->heap.rss && blk->size > DT_DEVMEM_BLOCK_SIZE) block_free(p, blk);
+  memset(m, 0, sizeof(*m));
+}
+
+VkResult
+dt_devmem_alloc(dt_devmem_pool_t *p, dt_devmem_t *m, uint64_t size, uint32_t type)
+{
+  size = (size + DT_DEVMEM_ALIGN-1) & ~(DT_DEVMEM_ALIGN-1);
+  pthread_mutex_lock(&p->mutex);
+  if(m->mem && p->block[m->block].type == type && m->size >= size)
+  {
+    pthread_mutex_unlock(&p->mutex);
+    return VK_SUCCESS;
+  }
+  // our old range coalesces with its free neighbours, so if there is room
+  // behind it we'll likely grow in place:
+  range_free(p, m);
+  int b = 0;
+  dt_vkmem_t *range = 0;
+  for(;b<p->num_blocks;b++)
+  {
+    dt_devmem_block_t *blk = p->block + b;
+    if(!blk->mem || blk->type != type || blk->size - blk->heap.rss < size) continue;
+    if((range = dt_vkalloc(&blk->heap, size, DT_DEVMEM_ALIGN))) break;
+  }
+  if(!range)
+  {
+    b = block_alloc(p, size, type);
+    if(b >= 0) range = dt_vkalloc(&p->block[b].heap, size, DT_DEVMEM_ALIGN);
+  }
+  if(!range)
+  {
+    pthread_mutex_unlock(&p->mutex);
+    dt_log(s_log_err|s_log_pipe, "[devmem] could not allocate %g MB of memory type %u!",
+        size/(1024.0*1024.0), type);
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  dt_devmem_block_t *blk = p->block + b;
+  m->mem    = blk->mem;
+  m->offset = range->offset;
+  m->size   = size;
+  m->mapped = blk->mapped ? blk->mapped + range->offset : 0;
+  m->block  = b;
+  m->range  = range;
+  p->used  += size;
+  pthread_mutex_unlock(&p->mutex);
+  return VK_SUCCESS;
+}
+
+void
+dt_devmem_free(dt_devmem_pool_t *p, dt_devmem_t *m)
+{
+  pthread_mutex_lock(&p->mutex);
+  range_free(p, m);
+  pthread_mutex_unlock(&p->mutex);
+}
+
+uint64_t
+dt_devmem_available(dt_devmem_pool_t *p, uint32_t type)
+{
+  uint64_t avail = 0;
+  pthread_mutex_lock(&p->mutex);
+  for(int b=0;b<p->num_blocks;b++)
+    if(p->block[b].mem && p->block[b].type == type)
+      avail += p->block[b].size - p->block[b].heap.rss;
+  pthread_mutex_unlock(&p->mutex);
+  return avail;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "alloc.h"
+
+#include <stdint.h>
+#include <pthread.h>
+#include <vulkan/vulkan.h>
+
+// process wide device memory manager. all graphs get their heaps, uniform
+// buffers and staging memory as ranges of a few large vkAllocateMemory
+// blocks, one set of blocks per memory type. a range freed by one graph can
+// be handed to the next one, and growing a heap only allocates new device
+// memory if no block has a large enough free range. ranges are placed inside
+// the blocks with the same tlsf allocator the graphs use for their images.
+// thread safe, graphs may run on different threads.
+
+#define DT_DEVMEM_BLOCK_SIZE (256ul<<20) // minimum size of one vkAllocateMemory
+#define DT_DEVMEM_ALIGN      (1ul<<16)   // of all ranges, covers image alignment and buffer/image granularity
+
+typedef struct dt_devmem_block_t
+{
+  VkDeviceMemory mem;    // 0 if this slot is unused
+  uint32_t       type;   // memory type index
+  uint64_t       size;
+  uint8_t       *mapped; // host visible blocks stay mapped, 0 otherwise
+  dt_vkalloc_t   heap;   // ranges handed out from this block
+}
+dt_devmem_block_t;
+
+// a range of device memory as owned by a graph
+typedef struct dt_devmem_t
+{
+  VkDeviceMemory mem;    // the block's memory, 0 if nothing is allocated
+  uint64_t       offset; // of the range inside the block, bind with this
+  uint64_t       size;
+  uint8_t       *mapped; // host pointer to offset if host visible, 0 otherwise
+  int            block;
+  dt_vkmem_t    *range;
+}
+dt_devmem_t;
+
+typedef struct dt_devmem_pool_t
+{
+  pthread_mutex_t    mutex;
+  dt_devmem_block_t *block;
+  int                num_blocks, max_blocks;
+  uint64_t           allocated; // sum of the sizes of all blocks
+  uint64_t           used;      // sum of the sizes of all ranges
+}
+dt_devmem_pool_t;
+
+void dt_devmem_init(dt_devmem_pool_t *p);
+
+// frees all blocks, the ranges of all graphs have to be freed before.
+void dt_devmem_cleanup(dt_devmem_pool_t *p);
+
+// make m a range of at least size bytes of the given memory type. keeps the
+// range if it is large enough, the contents are not preserved otherwise.
+VkResult dt_devmem_alloc(dt_devmem_pool_t *p, dt_devmem_t *m, uint64_t size, uint32_t type);
+
+// return the range to its block. blocks larger than the default size are
+// freed once empty, the others are kept around for reuse.
+void dt_devmem_free(dt_devmem_pool_t *p, dt_devmem_t *m);
+
+// bytes of memory of this type which are allocated but not handed out.
+// these are counted as used by the driver's budget.
+uint64_t dt_devmem_available(dt_devmem_pool_t *p, uint32_t type);
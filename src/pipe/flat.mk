@@ -1,15 +1,20 @@
 PIPE_O=\
 pipe/alloc.o\
 pipe/connector.o\
+pipe/devmem.o\
 pipe/global.o\
 pipe/graph.o\
 pipe/graph-io.o\
 pipe/masks.o\
-pipe/module.o
+pipe/module.o\
+pipe/perf.o\
+pipe/plan.o\
+pipe/prefetch.o
 PIPE_H=\
 pipe/alloc.h\
 pipe/connector.h\
 pipe/connector.inc\
+pipe/devmem.h\
 pipe/dlist.h\
 pipe/global.h\
 pipe/graph.h\
@@ -22,7 +27,10 @@ pipe/masks.h\
 pipe/module.h\
 pipe/node.h\
 pipe/params.h\
+pipe/perf.h\
+pipe/plan.h\
 pipe/pipe.h\
+pipe/prefetch.h\
 pipe/token.h
-PIPE_CFLAGS=
-PIPE_LDFLAGS=-ldl
+PIPE_CFLAGS=-I../ext/pthread-pool
+PIPE_LDFLAGS=-ldl -L../built/ext/pthread-pool -lpthreadpool -lpthread -lm
@@ -2,7 +2,10 @@
 #include "io.h"
 #include "module.h"
 #include "graph.h"
+#include "prefetch.h"
+#include "core/core.h"
 #include "core/log.h"
+#include "qvk/qvk.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -10,6 +13,9 @@
 #include <unistd.h>
 #include <dlfcn.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
 dt_pipe_global_t dt_pipe;
 
@@ -20,12 +26,15 @@ static inline int
 read_connector_ascii(
     dt_connector_t *conn,
     char *line)
-{ // read tkn:tkn:tkn:tkn
+{ // read tkn:tkn:tkn:tkn[:tkn]
   memset(conn, 0, sizeof(*conn));
+  const char *end = line + strlen(line);
   conn->name = dt_read_token(line, &line);
   conn->type = dt_read_token(line, &line);
   conn->chan = dt_read_token(line, &line);
   conn->format = dt_read_token(line, &line);
+  // optional narrower format for the storage of outputs:
+  if(line < end) conn->narrow = dt_read_token(line, &line);
   return 0;
 }
 
@@ -95,7 +104,11 @@ dt_module_so_load(
     mod->init           = dlsym(mod->dlhandle, "init");
     mod->cleanup        = dlsym(mod->dlhandle, "cleanup");
     mod->write_sink     = dlsym(mod->dlhandle, "write_sink");
+    mod->write_rows     = dlsym(mod->dlhandle, "write_rows");
+    mod->halo           = dlsym(mod->dlhandle, "halo");
     mod->read_source    = dlsym(mod->dlhandle, "read_source");
+    mod->source_ptr     = dlsym(mod->dlhandle, "source_ptr");
+    mod->prefetch       = dlsym(mod->dlhandle, "prefetch");
     mod->commit_params  = dlsym(mod->dlhandle, "commit_params");
   }
 
@@ -168,9 +181,259 @@ dt_module_so_unload(dt_module_so_t *mod)
     dlclose(mod->dlhandle);
 }
 
+// path to the serialised pipeline cache, following the xdg base directory spec
+static int
+pipeline_cache_filename(char *filename, size_t size)
+{
+  const char *xdg  = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  char dir[1024];
+  if(xdg && xdg[0]) snprintf(dir, sizeof(dir), "%s/vkdt", xdg);
+  else if(home)     snprintf(dir, sizeof(dir), "%s/.cache/vkdt", home);
+  else return 1;
+  if(mkdir(dir, 0755) && errno != EEXIST) return 1;
+  snprintf(filename, size, "%s/pipeline.cache", dir);
+  return 0;
+}
+
+// create the vulkan pipeline cache, seeded with whatever we wrote to disk last
+// time if it was written by the same driver and device.
+static void
+pipeline_cache_init()
+{
+  char filename[1280];
+  void *data = 0;
+  size_t len = 0;
+  if(!pipeline_cache_filename(filename, sizeof(filename)))
+  {
+    FILE *f = fopen(filename, "rb");
+    if(f)
+    {
+      fseek(f, 0, SEEK_END);
+      len = ftell(f);
+      fseek(f, 0, SEEK_SET);
+      data = malloc(len);
+      if(fread(data, 1, len, f) != len) len = 0;
+      fclose(f);
+    }
+  }
+  // validate header: length, version, vendor id, device id, cache uuid
+  VkPhysicalDeviceProperties prop;
+  vkGetPhysicalDeviceProperties(qvk.physical_device, &prop);
+  const uint32_t *hdr = data;
+  if(len < 16 + VK_UUID_SIZE ||
+     hdr[2] != prop.vendorID || hdr[3] != prop.deviceID ||
+     memcmp(hdr + 4, prop.pipelineCacheUUID, VK_UUID_SIZE))
+    len = 0; // stale or foreign, start from scratch
+  VkPipelineCacheCreateInfo info = {
+    .sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    .initialDataSize = len,
+    .pInitialData    = len ? data : 0,
+  };
+  QVK(vkCreatePipelineCache(qvk.device, &info, 0, &dt_pipe.pipeline_cache));
+  dt_log(s_log_pipe, "[pipeline cache] %s %zu bytes", len ? "loaded" : "starting empty,", len);
+  free(data);
+}
+
+static void
+pipeline_cache_write()
+{
+  char filename[1280];
+  size_t len = 0;
+  if(pipeline_cache_filename(filename, sizeof(filename))) return;
+  if(vkGetPipelineCacheData(qvk.device, dt_pipe.pipeline_cache, &len, 0) != VK_SUCCESS || !len) return;
+  void *data = malloc(len);
+  if(vkGetPipelineCacheData(qvk.device, dt_pipe.pipeline_cache, &len, data) == VK_SUCCESS)
+  {
+    FILE *f = fopen(filename, "wb");
+    if(f)
+    {
+      fwrite(data, 1, len, f);
+      fclose(f);
+    }
+    else dt_log(s_log_pipe|s_log_err, "[pipeline cache] could not write %s", filename);
+  }
+  free(data);
+}
+
+VkDescriptorSetLayout
+dt_pipe_uniform_dset_layout()
+{
+  pthread_mutex_lock(&dt_pipe.kernel_mutex);
+  if(!dt_pipe.uniform_dset_layout)
+  {
+    VkDescriptorSetLayoutBinding bindings = {
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    };
+    VkDescriptorSetLayoutCreateInfo dset_layout_info = {
+      .sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = 1,
+      .pBindings    = &bindings,
+    };
+    QVK(vkCreateDescriptorSetLayout(qvk.device, &dset_layout_info, 0, &dt_pipe.uniform_dset_layout));
+  }
+  pthread_mutex_unlock(&dt_pipe.kernel_mutex);
+  return dt_pipe.uniform_dset_layout;
+}
+
+static VkResult
+kernel_create(dt_pipe_kernel_t *k, const VkDescriptorSetLayoutBinding *bindings,
+    uint32_t num_bindings, int need_pipeline)
+{
+  VkDescriptorSetLayoutCreateInfo dset_layout_info = {
+    .sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = num_bindings,
+    .pBindings    = bindings,
+  };
+  QVKR(vkCreateDescriptorSetLayout(qvk.device, &dset_layout_info, 0, &k->dset_layout));
+  if(!need_pipeline) return VK_SUCCESS;
+
+  // create the pipeline layout
+  VkDescriptorSetLayout dset_layout[] = {
+    dt_pipe.uniform_dset_layout,
+    k->dset_layout,
+  };
+  VkPushConstantRange pcrange = {
+    .stageFlags = VK_SHADER_STAGE_ALL,
+    .offset     = 0,
+    .size       = k->push_constant_size,
+  };
+  VkPipelineLayoutCreateInfo layout_info = {
+    .sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount         = LENGTH(dset_layout),
+    .pSetLayouts            = dset_layout,
+    .pushConstantRangeCount = k->push_constant_size ? 1 : 0,
+    .pPushConstantRanges    = k->push_constant_size ? &pcrange : 0,
+  };
+  QVKR(vkCreatePipelineLayout(qvk.device, &layout_info, 0, &k->pipeline_layout));
+
+  VkShaderModule shader_module;
+  QVKR(dt_graph_create_shader_module(k->name, k->kernel, &shader_module));
+
+  VkPipelineShaderStageCreateInfo stage_info = {
+    .sType               = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+    .stage               = VK_SHADER_STAGE_COMPUTE_BIT,
+    .pSpecializationInfo = 0,
+    .pName               = "main", // arbitrary entry point symbols are supported by glslangValidator, but need extra compilation, too. i think it's easier to structure code via includes then.
+    .module              = shader_module,
+  };
+#ifdef QVK_ENABLE_VALIDATION
+  char name[64];
+  snprintf(name, sizeof(name), "%"PRItkn"_%"PRItkn, dt_token_str(k->name), dt_token_str(k->kernel));
+  ATTACH_LABEL_VARIABLE_NAME(shader_module, SHADER_MODULE, name);
+#endif
+
+  VkComputePipelineCreateInfo pipeline_info = {
+    .sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage  = stage_info,
+    .layout = k->pipeline_layout
+  };
+  VkResult res = vkCreateComputePipelines(qvk.device, dt_pipe.pipeline_cache, 1, &pipeline_info, 0, &k->pipeline);
+  // we don't need the module any more
+  vkDestroyShaderModule(qvk.device, shader_module, 0);
+  return res;
+}
+
+// everything the cached objects of a kernel depend on
+static inline uint64_t
+kernel_key(dt_token_t name, dt_token_t kernel, uint64_t layout, uint32_t push_constant_size)
+{
+  uint64_t hash = dt_hash(DT_HASH_INIT, &name, sizeof(name));
+  hash = dt_hash(hash, &kernel, sizeof(kernel));
+  hash = dt_hash(hash, &layout, sizeof(layout));
+  return dt_hash(hash, &push_constant_size, sizeof(push_constant_size));
+}
+
+// insert kernel k into the hash table, growing it to stay at most half full
+static void
+kernel_hash_insert(uint32_t k)
+{
+  if(2*dt_pipe.num_kernels + 2 > dt_pipe.kernel_hash_size)
+  { // rehash all kernels before k
+    dt_pipe.kernel_hash_size = MAX(64, 2*dt_pipe.kernel_hash_size);
+    dt_pipe.kernel_hash = realloc(dt_pipe.kernel_hash, sizeof(int)*dt_pipe.kernel_hash_size);
+    memset(dt_pipe.kernel_hash, 0xff, sizeof(int)*dt_pipe.kernel_hash_size); // all -1
+    for(uint32_t i=0;i<k;i++) kernel_hash_insert(i);
+  }
+  const uint32_t mask = dt_pipe.kernel_hash_size - 1;
+  const dt_pipe_kernel_t *kn = dt_pipe.kernel + k;
+  uint32_t h = kernel_key(kn->name, kn->kernel, kn->layout, kn->push_constant_size) & mask;
+  while(dt_pipe.kernel_hash[h] >= 0) h = (h + 1) & mask;
+  dt_pipe.kernel_hash[h] = k;
+}
+
+VkResult
+dt_pipe_kernel_get(
+    dt_token_t                          name,
+    dt_token_t                          kernel,
+    const VkDescriptorSetLayoutBinding *bindings,
+    uint32_t                            num_bindings,
+    uint32_t                            push_constant_size,
+    int                                 need_pipeline,
+    dt_pipe_kernel_t                   *out)
+{
+  uint64_t layout = DT_HASH_INIT;
+  for(int i=0;i<num_bindings;i++)
+  {
+    layout = dt_hash(layout, &bindings[i].descriptorType,  sizeof(bindings[i].descriptorType));
+    layout = dt_hash(layout, &bindings[i].descriptorCount, sizeof(bindings[i].descriptorCount));
+    layout = dt_hash(layout, &bindings[i].stageFlags,      sizeof(bindings[i].stageFlags));
+  }
+  layout = dt_hash(layout, &num_bindings, sizeof(num_bindings));
+
+  dt_pipe_uniform_dset_layout(); // make sure this exists
+  pthread_mutex_lock(&dt_pipe.kernel_mutex);
+  if(dt_pipe.kernel_hash_size)
+  {
+    const uint32_t mask = dt_pipe.kernel_hash_size - 1;
+    for(uint32_t h=kernel_key(name, kernel, layout, push_constant_size)&mask;
+        dt_pipe.kernel_hash[h]>=0;h=(h+1)&mask)
+    {
+      dt_pipe_kernel_t *k = dt_pipe.kernel + dt_pipe.kernel_hash[h];
+      if(k->name == name && k->kernel == kernel && k->layout == layout &&
+         k->push_constant_size == push_constant_size &&
+        (k->pipeline || !need_pipeline))
+      {
+        *out = *k;
+        pthread_mutex_unlock(&dt_pipe.kernel_mutex);
+        return VK_SUCCESS;
+      }
+    }
+  }
+
+  if(!dt_pipe.pipeline_cache) pipeline_cache_init();
+  if(dt_pipe.num_kernels == dt_pipe.max_kernels)
+  {
+    dt_pipe.max_kernels = MAX(64, 2*dt_pipe.max_kernels);
+    dt_pipe.kernel = realloc(dt_pipe.kernel, sizeof(dt_pipe_kernel_t)*dt_pipe.max_kernels);
+  }
+  dt_pipe_kernel_t *k = dt_pipe.kernel + dt_pipe.num_kernels;
+  *k = (dt_pipe_kernel_t){
+    .name               = name,
+    .kernel             = kernel,
+    .layout             = layout,
+    .push_constant_size = push_constant_size,
+  };
+  VkResult res = kernel_create(k, bindings, num_bindings, need_pipeline);
+  if(res == VK_SUCCESS) kernel_hash_insert(dt_pipe.num_kernels++);
+  else
+  {
+    if(k->pipeline_layout) vkDestroyPipelineLayout(qvk.device, k->pipeline_layout, 0);
+    if(k->dset_layout) vkDestroyDescriptorSetLayout(qvk.device, k->dset_layout, 0);
+  }
+  *out = *k;
+  pthread_mutex_unlock(&dt_pipe.kernel_mutex);
+  return res;
+}
+
 int dt_pipe_global_init()
 {
   memset(&dt_pipe, 0, sizeof(dt_pipe));
+  pthread_mutex_init(&dt_pipe.kernel_mutex, 0);
+  dt_devmem_init(&dt_pipe.devmem);
   // TODO: setup search directory
   struct dirent *dp;
   DIR *fd = opendir("modules");
@@ -196,14 +459,59 @@ int dt_pipe_global_init()
   }
   dt_pipe.num_modules = i;
   closedir(fd);
+
+  // hash the class names for dt_module_add():
+  dt_pipe.module_hash_size = 64;
+  while(dt_pipe.module_hash_size < 2*dt_pipe.num_modules) dt_pipe.module_hash_size *= 2;
+  dt_pipe.module_hash = malloc(sizeof(int)*dt_pipe.module_hash_size);
+  memset(dt_pipe.module_hash, 0xff, sizeof(int)*dt_pipe.module_hash_size); // all -1
+  const uint32_t mask = dt_pipe.module_hash_size - 1;
+  for(int m=0;m<dt_pipe.num_modules;m++)
+  {
+    uint32_t h = dt_hash(DT_HASH_INIT, &dt_pipe.module[m].name, sizeof(dt_token_t)) & mask;
+    while(dt_pipe.module_hash[h] >= 0) h = (h + 1) & mask;
+    dt_pipe.module_hash[h] = m;
+  }
+  // not fatal, sources will just decode when they are opened:
+  if(dt_prefetch_init())
+    dt_log(s_log_pipe, "[global init] could not start prefetch threads");
+  return 0;
+}
+
+dt_module_so_t *dt_pipe_get_module(dt_token_t name)
+{
+  if(!dt_pipe.module_hash_size) return 0;
+  const uint32_t mask = dt_pipe.module_hash_size - 1;
+  for(uint32_t h=dt_hash(DT_HASH_INIT, &name, sizeof(name))&mask;dt_pipe.module_hash[h]>=0;h=(h+1)&mask)
+    if(dt_pipe.module[dt_pipe.module_hash[h]].name == name)
+      return dt_pipe.module + dt_pipe.module_hash[h];
   return 0;
 }
 
 void dt_pipe_global_cleanup()
 {
+  dt_prefetch_cleanup(); // runs module code, do this before unloading
+  for(int i=0;i<dt_pipe.num_kernels;i++)
+  {
+    vkDestroyPipeline           (qvk.device, dt_pipe.kernel[i].pipeline,        0);
+    vkDestroyPipelineLayout     (qvk.device, dt_pipe.kernel[i].pipeline_layout, 0);
+    vkDestroyDescriptorSetLayout(qvk.device, dt_pipe.kernel[i].dset_layout,     0);
+  }
+  free(dt_pipe.kernel);
+  free(dt_pipe.kernel_hash);
+  if(dt_pipe.uniform_dset_layout)
+    vkDestroyDescriptorSetLayout(qvk.device, dt_pipe.uniform_dset_layout, 0);
+  if(dt_pipe.pipeline_cache)
+  {
+    pipeline_cache_write();
+    vkDestroyPipelineCache(qvk.device, dt_pipe.pipeline_cache, 0);
+  }
+  pthread_mutex_destroy(&dt_pipe.kernel_mutex);
+  dt_devmem_cleanup(&dt_pipe.devmem);
   for(int i=0;i<dt_pipe.num_modules;i++)
     dt_module_so_unload(dt_pipe.module + i);
   free(dt_pipe.module);
+  free(dt_pipe.module_hash);
   memset(&dt_pipe, 0, sizeof(dt_pipe));
 }
 
@@ -3,6 +3,9 @@
 #include "token.h"
 #include "params.h"
 #include "connector.h"
+#include "devmem.h"
+
+#include <pthread.h>
 
 // static global structs to keep around for all instances of pipelines.
 // this queries the modules on startup, does the dlopen and expensive
@@ -15,7 +18,11 @@ typedef void (*dt_module_create_nodes_t)  (dt_graph_t *graph, dt_module_t *modul
 typedef void (*dt_module_modify_roi_out_t)(dt_graph_t *graph, dt_module_t *module);
 typedef void (*dt_module_modify_roi_in_t )(dt_graph_t *graph, dt_module_t *module);
 typedef void (*dt_module_write_sink_t) (dt_module_t *module, void *buf);
-typedef void (*dt_module_read_source_t)(dt_module_t *module, void *buf);
+typedef void (*dt_module_write_rows_t) (dt_module_t *module, void *buf, uint32_t y, uint32_t ht);
+typedef int  (*dt_module_read_source_t)(dt_module_t *module, void *buf);
+typedef const void *(*dt_module_source_ptr_t)(dt_module_t *module, size_t *pitch);
+typedef int  (*dt_module_prefetch_t)(const char *filename);
+typedef int  (*dt_module_halo_t)    (dt_module_t *module);
 typedef int  (*dt_module_init_t)    (dt_module_t *module);
 typedef void (*dt_module_cleanup_t )(dt_module_t *module);
 typedef void (*dt_module_commit_params_t)(dt_graph_t *graph, dt_node_t *node);
@@ -46,10 +53,30 @@ typedef struct dt_module_so_t
   // commit new parameters from module's gui params to binary float blob
   dt_module_commit_params_t commit_params;
 
-  // for source nodes, will be called before processing starts
+  // for source nodes, will be called before processing starts. returns
+  // non-zero if the image could not be read, the run fails then.
   dt_module_read_source_t read_source;
+  // optionally, sources can instead point to the roi of their decoded image
+  // in host memory, with rows pitch bytes apart. if the device can import
+  // it, it's copied from there without going through the staging memory.
+  dt_module_source_ptr_t  source_ptr;
+  // optionally, sources can decode a file into a cache shared by all
+  // instances, before it is opened. this runs on a worker thread, see
+  // prefetch.h.
+  dt_module_prefetch_t    prefetch;
   // for sink nodes, will be called once processing ended
   dt_module_write_sink_t  write_sink;
+  // optionally, sinks can start on the image while it is downloaded: called
+  // whenever the rows [y, y+ht) arrived in the buffer which is passed to
+  // write_sink() in the end. all rows above are there too, y == 0 starts a
+  // new image. not called for images which are processed in strips.
+  dt_module_write_rows_t  write_rows;
+
+  // rows of support around every output pixel, on the scale of the output,
+  // or -1 if the output depends on the whole image (pyramids, histograms).
+  // this tells how much overlap strips need when the graph is processed in
+  // strips (or that it can't be). modules without it are pointwise.
+  dt_module_halo_t        halo;
 
   dt_module_init_t init;
   dt_module_init_t cleanup;
@@ -63,11 +90,40 @@ typedef struct dt_module_so_t
 }
 dt_module_so_t;
 
+// vulkan objects to run one kernel. these only depend on the spir-v, the
+// descriptor set layout and the push constant size, so they are shared
+// between all nodes of all graphs that run the same kernel.
+typedef struct dt_pipe_kernel_t
+{
+  dt_token_t            name;               // node name (directory of the spir-v)
+  dt_token_t            kernel;             // kernel name (file name of the spir-v)
+  uint64_t              layout;             // hash of the descriptor set layout bindings
+  uint32_t              push_constant_size;
+  VkDescriptorSetLayout dset_layout;
+  VkPipelineLayout      pipeline_layout;    // these two are 0 for sinks and sources
+  VkPipeline            pipeline;
+}
+dt_pipe_kernel_t;
+
 typedef struct dt_pipe_global_t
 {
   char module_dir[2048];
   dt_module_so_t *module;
   uint32_t num_modules;
+  int     *module_hash;      // open addressing class name -> index, or -1
+  uint32_t module_hash_size; // power of two
+
+  // process-wide pipeline cache, lazily created once we have a device
+  pthread_mutex_t       kernel_mutex;
+  dt_pipe_kernel_t     *kernel;
+  uint32_t              num_kernels, max_kernels;
+  int                  *kernel_hash;         // open addressing key -> index, or -1
+  uint32_t              kernel_hash_size;    // power of two
+  VkPipelineCache       pipeline_cache;      // serialised to disk on cleanup
+  VkDescriptorSetLayout uniform_dset_layout; // shared by all kernels
+
+  // device memory of all graphs, freed on cleanup
+  dt_devmem_pool_t      devmem;
 }
 dt_pipe_global_t;
 
@@ -80,3 +136,22 @@ int dt_pipe_global_init();
 void dt_pipe_global_cleanup();
 
 int dt_module_get_param(dt_module_so_t *so, dt_token_t param);
+
+// returns the module class of the given name, or 0
+dt_module_so_t *dt_pipe_get_module(dt_token_t name);
+
+// fills out the cached vulkan objects for the given kernel with the given
+// descriptor set bindings, creating them on first use. pipeline and
+// pipeline layout will only be created if need_pipeline is set.
+// the objects are owned by the cache and destroyed in dt_pipe_global_cleanup.
+VkResult dt_pipe_kernel_get(
+    dt_token_t                          name,
+    dt_token_t                          kernel,
+    const VkDescriptorSetLayoutBinding *bindings,
+    uint32_t                            num_bindings,
+    uint32_t                            push_constant_size,
+    int                                 need_pipeline,
+    dt_pipe_kernel_t                   *out);
+
+// the descriptor set layout of the uniform buffer every kernel sees in set 0
+VkDescriptorSetLayout dt_pipe_uniform_dset_layout();
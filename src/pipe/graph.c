@@ -3,6 +3,7 @@
 #include "masks.h"
 #include "module.h"
 #include "modules/api.h"
+#include "core/core.h"
 #include "core/log.h"
 #include "qvk/qvk.h"
 #include "graph-print.h"
@@ -11,6 +12,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <math.h>
 
 void
 dt_graph_init(dt_graph_t *g)
@@ -23,8 +26,6 @@ dt_graph_init(dt_graph_t *g)
   g->max_nodes = 300;
   g->node = malloc(sizeof(dt_node_t)*g->max_nodes);
   dt_vkalloc_init(&g->heap);
-  dt_vkalloc_init(&g->heap_staging);
-  g->uniform_size = 4096;
   g->params_max = 4096;
   g->params_end = 0;
   g->params_pool = malloc(sizeof(uint8_t)*g->params_max);
@@ -36,41 +37,65 @@ dt_graph_init(dt_graph_t *g)
   };
   QVK(vkCreateCommandPool(qvk.device, &cmd_pool_create_info, NULL, &g->command_pool));
 
-  VkCommandBufferAllocateInfo cmd_buf_alloc_info = {
+  for(int f=0;f<DT_GRAPH_MAX_FRAMES;f++)
+  {
+    VkCommandBufferAllocateInfo cmd_buf_alloc_info = {
+      .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool        = g->command_pool,
+      .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1,
+    };
+    QVK(vkAllocateCommandBuffers(qvk.device, &cmd_buf_alloc_info, &g->frame[f].command_buffer));
+    VkFenceCreateInfo fence_info = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+      /* fence's initial state set to be signaled to make program not hang */
+      // .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+    };
+    QVK(vkCreateFence(qvk.device, &fence_info, NULL, &g->frame[f].fence));
+  }
+
+  // staging ring, fixed size no matter how large the images are:
+  VkBufferCreateInfo ring_info = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = DT_GRAPH_RING_SIZE,
+    .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+  };
+  QVK(vkCreateBuffer(qvk.device, &ring_info, 0, &g->ring_buffer));
+  VkMemoryRequirements mem_req;
+  vkGetBufferMemoryRequirements(qvk.device, g->ring_buffer, &mem_req);
+  QVK(dt_devmem_alloc(&dt_pipe.devmem, &g->vkmem_ring, mem_req.size,
+        qvk_get_memory_type(mem_req.memoryTypeBits,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)));
+  QVK(vkBindBufferMemory(qvk.device, g->ring_buffer, g->vkmem_ring.mem, g->vkmem_ring.offset));
+  g->ring_mapped = g->vkmem_ring.mapped;
+  VkCommandBufferAllocateInfo ring_cmd_info = {
     .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
     .commandPool        = g->command_pool,
     .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-    .commandBufferCount = 1,
-  };
-  QVK(vkAllocateCommandBuffers(qvk.device, &cmd_buf_alloc_info, &g->command_buffer));
-  VkFenceCreateInfo fence_info = {
-    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-    /* fence's initial state set to be signaled to make program not hang */
-    // .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+    .commandBufferCount = DT_GRAPH_RING_SLOTS,
   };
-  QVK(vkCreateFence(qvk.device, &fence_info, NULL, &g->command_fence));
+  QVK(vkAllocateCommandBuffers(qvk.device, &ring_cmd_info, g->ring_cmd));
+  for(int s=0;s<DT_GRAPH_RING_SLOTS;s++)
+  {
+    VkFenceCreateInfo fence_info = { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    QVK(vkCreateFence(qvk.device, &fence_info, NULL, g->ring_fence+s));
+  }
 
-  g->query_max = 200;
-  g->query_cnt = 0;
-  VkQueryPoolCreateInfo query_pool_info = {
-    .sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-    .queryType  = VK_QUERY_TYPE_TIMESTAMP,
-    .queryCount = g->query_max,
-  };
-  QVK(vkCreateQueryPool(qvk.device, &query_pool_info, NULL, &g->query_pool));
-  g->query_pool_results = malloc(sizeof(uint64_t)*g->query_max);
-  g->query_name   = malloc(sizeof(dt_token_t)*g->query_max);
-  g->query_kernel = malloc(sizeof(dt_token_t)*g->query_max);
+  dt_perf_init(&g->perf);
 }
 
 void
 dt_graph_cleanup(dt_graph_t *g)
 {
+  dt_graph_wait(g);
+  for(int s=0;s<DT_GRAPH_RING_SLOTS;s++)
+    if(g->ring_pending[s])
+      vkWaitForFences(qvk.device, 1, g->ring_fence+s, VK_TRUE, 1ul<<40);
   for(int i=0;i<g->num_modules;i++)
     if(g->module[i].so->cleanup)
       g->module[i].so->cleanup(g->module+i);
   dt_vkalloc_cleanup(&g->heap);
-  dt_vkalloc_cleanup(&g->heap_staging);
   // go through all modules and clean out VkImages
   for(int i=0;i<g->num_nodes;i++)
   {
@@ -82,27 +107,34 @@ dt_graph_cleanup(dt_graph_t *g)
         if(c->image)      vkDestroyImage(qvk.device, c->image, VK_NULL_HANDLE);
         if(c->image_view) vkDestroyImageView(qvk.device, c->image_view, VK_NULL_HANDLE);
       }
-      if(c->staging) vkDestroyBuffer(qvk.device, c->staging, VK_NULL_HANDLE);
     }
-    vkDestroyPipelineLayout     (qvk.device, g->node[i].pipeline_layout, 0);
-    vkDestroyPipeline           (qvk.device, g->node[i].pipeline,        0);
-    vkDestroyDescriptorSetLayout(qvk.device, g->node[i].dset_layout,     0);
+    // pipelines and descriptor set layouts are owned by the global cache
   }
   vkDestroyDescriptorPool(qvk.device, g->dset_pool, 0);
-  vkDestroyDescriptorSetLayout(qvk.device, g->uniform_dset_layout, 0);
   vkDestroyBuffer(qvk.device, g->uniform_buffer, 0);
-  vkFreeMemory(qvk.device, g->vkmem, 0);
-  vkFreeMemory(qvk.device, g->vkmem_staging, 0);
-  vkFreeMemory(qvk.device, g->vkmem_uniform, 0);
-  vkDestroyFence(qvk.device, g->command_fence, 0);
-  vkDestroyQueryPool(qvk.device, g->query_pool, 0);
+  dt_devmem_free(&dt_pipe.devmem, &g->vkmem);
+  vkDestroyBuffer(qvk.device, g->ring_buffer, 0);
+  dt_devmem_free(&dt_pipe.devmem, &g->vkmem_ring);
+  dt_devmem_free(&dt_pipe.devmem, &g->vkmem_uniform);
+  for(int f=0;f<DT_GRAPH_MAX_FRAMES;f++)
+    vkDestroyFence(qvk.device, g->frame[f].fence, 0);
+  for(int s=0;s<DT_GRAPH_RING_SLOTS;s++)
+    vkDestroyFence(qvk.device, g->ring_fence[s], 0);
+  if(g->query_pool) vkDestroyQueryPool(qvk.device, g->query_pool, 0);
   vkDestroyCommandPool(qvk.device, g->command_pool, 0);
   free(g->module);
+  free(g->module_hash);
   free(g->node);
+  free(g->edge_beg);
+  free(g->edge);
+  free(g->traverse_scratch);
   free(g->params_pool);
   free(g->query_pool_results);
-  free(g->query_name);
-  free(g->query_kernel);
+  free(g->query_node);
+  dt_perf_cleanup(&g->perf);
+  free(g->tile_buf);
+  free(g->sink_buf);
+  free(g->plan);
 }
 
 static inline void *
@@ -159,6 +191,44 @@ dt_graph_create_shader_module(
   return VK_SUCCESS;
 }
 
+// size of the uniform block a node sees: the roi of every connector padded to
+// vec4 alignment, followed by the (committed) params of the module.
+static inline uint32_t
+node_uniform_size(const dt_node_t *node)
+{
+  uint32_t size = node->num_connectors * ((sizeof(dt_roi_t)+15)/16) * 16;
+  if(node->module->committed_param_size)
+    size += ((node->module->committed_param_size + 15)/16) * 16;
+  else if(node->module->param_size)
+    size += ((node->module->param_size + 15)/16) * 16;
+  return size;
+}
+
+static inline uint32_t
+align_uniform(uint32_t offset)
+{
+  const uint32_t a = MAX(qvk.uniform_alignment, 16);
+  return ((offset + a - 1)/a) * a;
+}
+
+// returns non-zero if the given output connector of the node
+// is also the output of the module the node belongs to.
+static inline int
+is_module_output(
+    const dt_graph_t *graph,
+    dt_node_t        *node,
+    int               c)
+{
+  const int nid = node - graph->node;
+  for(int k=0;k<node->module->num_connectors;k++)
+  {
+    dt_connector_t *mc = node->module->connector+k;
+    if(dt_connector_output(mc) && mc->connected_ni == nid && mc->connected_nc == c)
+      return 1;
+  }
+  return 0;
+}
+
 // allocate output buffers, also create vulkan pipeline and load spir-v portion
 // of the compute shader.
 // TODO: need to disentangle allocation and vulkan code here, too
@@ -191,14 +261,6 @@ alloc_outputs(dt_graph_t *graph, dt_node_t *node)
     bindings[i].pImmutableSamplers = 0;
   }
 
-  // create a descriptor set layout
-  VkDescriptorSetLayoutCreateInfo dset_layout_info = {
-    .sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-    .bindingCount = node->num_connectors,
-    .pBindings    = bindings,
-  };
-  QVKR(vkCreateDescriptorSetLayout(qvk.device, &dset_layout_info, 0, &node->dset_layout));
-
   // TODO: if we need a rasterisation pass:
 #if 0
   // TODO: create shader stages:
@@ -240,59 +302,27 @@ alloc_outputs(dt_graph_t *graph, dt_node_t *node)
   // a sink or a source does not need a pipeline to be run.
   // note, however, that a sink does need a descriptor set, as we want to bind
   // it to imgui textures later on.
-  if(!(dt_node_sink(node) || dt_node_source(node)))
+  const int need_pipeline = !(dt_node_sink(node) || dt_node_source(node));
+  // descriptor set layout and pipeline are cached globally, so every kernel
+  // is only compiled once per process (and mostly comes from the disk cache):
+  dt_pipe_kernel_t kernel;
+  QVKR(dt_pipe_kernel_get(node->name, node->kernel, bindings, node->num_connectors,
+        node->push_constant_size, need_pipeline, &kernel));
+  node->dset_layout     = kernel.dset_layout;
+  node->pipeline_layout = kernel.pipeline_layout;
+  node->pipeline        = kernel.pipeline;
+
+  if(need_pipeline)
   {
-    // create the pipeline layout
-    VkDescriptorSetLayout dset_layout[] = {
-      graph->uniform_dset_layout,
-      node->dset_layout,
-    };
-    VkPushConstantRange pcrange = {
-      .stageFlags = VK_SHADER_STAGE_ALL,
-      .offset     = 0,
-      .size       = node->push_constant_size,
-    };
-    VkPipelineLayoutCreateInfo layout_info = {
-      .sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-      .setLayoutCount         = LENGTH(dset_layout),
-      .pSetLayouts            = dset_layout,
-      .pushConstantRangeCount = node->push_constant_size ? 1 : 0,
-      .pPushConstantRanges    = node->push_constant_size ? &pcrange : 0,
-    };
-    QVKR(vkCreatePipelineLayout(qvk.device, &layout_info, 0, &node->pipeline_layout));
-
-    // create the compute shader stage
-    char filename[1024] = {0};
-    snprintf(filename, sizeof(filename), "modules/%"PRItkn"/%"PRItkn".spv",
-        dt_token_str(node->name), dt_token_str(node->kernel));
-
-    VkShaderModule shader_module;
-    QVKR(dt_graph_create_shader_module(node->name, node->kernel, &shader_module));
-
-    // TODO: cache pipelines on module->so ?
-    VkPipelineShaderStageCreateInfo stage_info = {
-      .sType               = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-      .stage               = VK_SHADER_STAGE_COMPUTE_BIT,
-      .pSpecializationInfo = 0,//&info;
-      .pName               = "main", // arbitrary entry point symbols are supported by glslangValidator, but need extra compilation, too. i think it's easier to structure code via includes then.
-      .module              = shader_module,
-    };
-#ifdef QVK_ENABLE_VALIDATION
-    snprintf(filename, sizeof(filename), "%"PRItkn"_%"PRItkn, dt_token_str(node->name), dt_token_str(node->kernel));
-    ATTACH_LABEL_VARIABLE_NAME(shader_module, SHADER_MODULE, filename);
-#endif
-
-    // finally create the pipeline
-    VkComputePipelineCreateInfo pipeline_info = {
-      .sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-      .stage  = stage_info,
-      .layout = node->pipeline_layout
-    };
-    QVKR(vkCreateComputePipelines(qvk.device, VK_NULL_HANDLE, 1, &pipeline_info, 0, &node->pipeline));
-
-    // we don't need the module any more
-    vkDestroyShaderModule(qvk.device, stage_info.module, 0);
-  } // done with pipeline
+    // reserve our slice of the uniform buffer:
+    node->uniform_size   = node_uniform_size(node);
+    node->uniform_offset = align_uniform(graph->uniform_size);
+    graph->uniform_size  = node->uniform_offset + node->uniform_size;
+    graph->uniform_range = MAX(graph->uniform_range, node->uniform_size);
+    if(node->uniform_size > qvk.uniform_max_range)
+      dt_log(s_log_pipe|s_log_err, "uniforms of kernel %"PRItkn"_%"PRItkn" exceed max range!",
+          dt_token_str(node->name), dt_token_str(node->kernel));
+  }
 
   for(int i=0;i<node->num_connectors;i++)
   {
@@ -329,6 +359,8 @@ alloc_outputs(dt_graph_t *graph, dt_node_t *node)
       };
       if(c->image) vkDestroyImage(qvk.device, c->image, VK_NULL_HANDLE);
       QVKR(vkCreateImage(qvk.device, &images_create_info, NULL, &c->image));
+      c->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      c->access = 0;
       // ATTACH_LABEL_VARIABLE(c->image, IMAGE);
 
       VkMemoryRequirements mem_req;
@@ -339,7 +371,6 @@ alloc_outputs(dt_graph_t *graph, dt_node_t *node)
 
       assert(!(mem_req.alignment & (mem_req.alignment - 1)));
 
-      const size_t size = dt_connector_bufsize(c);
       c->mem = dt_vkalloc(&graph->heap, mem_req.size, mem_req.alignment);
       // dt_log(s_log_pipe, "allocating %.1f/%.1f MB for %"PRItkn" %"PRItkn" "
       //     "%"PRItkn" %"PRItkn,
@@ -349,34 +380,29 @@ alloc_outputs(dt_graph_t *graph, dt_node_t *node)
       // ATTACH_LABEL_VARIABLE_NAME(qvk.images[VKPT_IMG_##_name], IMAGE, #_name);
       c->offset = c->mem->offset;
       c->size   = c->mem->size;
+      // remember the live range, the memory planner may find a better place:
+      if(graph->plan_cnt == graph->plan_max)
+      {
+        graph->plan_max = MAX(64, 2*graph->plan_max);
+        graph->plan = realloc(graph->plan, sizeof(dt_plan_buf_t)*graph->plan_max);
+      }
+      c->plan = graph->plan_cnt++;
+      graph->plan[c->plan] = (dt_plan_buf_t){
+        .size      = mem_req.size,
+        .alignment = mem_req.alignment,
+        .beg       = graph->plan_step,
+        .end       = INT_MAX, // until freed
+      };
       // reference counting. we can't just do a ref++ here because we will
       // free directly after and wouldn't know which node later on still relies
       // on this buffer. hence we ran a reference counting pass before this, and
       // init the reference counter now accordingly:
       c->mem->ref = c->connected_mi;
-
-      if(c->type == dt_token("source"))
-      {
-        // allocate staging buffer for uploading to the just allocated image
-        VkBufferCreateInfo buffer_info = {
-          .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-          .size = size,
-          .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-          .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-        };
-        QVKR(vkCreateBuffer(qvk.device, &buffer_info, 0, &c->staging));
-
-        VkMemoryRequirements buf_mem_req;
-        vkGetBufferMemoryRequirements(qvk.device, c->staging, &buf_mem_req);
-        if(graph->memory_type_bits_staging != ~0 && buf_mem_req.memoryTypeBits != graph->memory_type_bits_staging)
-          dt_log(s_log_qvk|s_log_err, "staging memory type bits don't match!");
-        graph->memory_type_bits_staging = buf_mem_req.memoryTypeBits;
-        c->mem_staging    = dt_vkalloc(&graph->heap_staging, buf_mem_req.size, buf_mem_req.alignment);
-        c->offset_staging = c->mem_staging->offset;
-        c->size_staging   = c->mem_staging->size;
-        // TODO: better and more general caching:
-        c->mem->ref++; // add one more so we can run the pipeline starting from after upload easily
-      }
+      // the outputs of modules are kept around as cache. this way we can
+      // re-run only the part of the graph downstream of a change. one more
+      // reference pins these so the memory will not be reused by other
+      // buffers further down the graph:
+      if(is_module_output(graph, node, i)) c->mem->ref++;
     }
     else if(dt_connector_input(c))
     { // point our inputs to their counterparts:
@@ -387,26 +413,6 @@ alloc_outputs(dt_graph_t *graph, dt_node_t *node)
         c->mem   = c2->mem;
         c->image = c2->image;
         // image view will follow in alloc_outputs2
-        if(c->type == dt_token("sink"))
-        {
-          // allocate staging buffer for downloading from connected input
-          VkBufferCreateInfo buffer_info = {
-            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .size = dt_connector_bufsize(c),
-            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-          };
-          QVKR(vkCreateBuffer(qvk.device, &buffer_info, 0, &c->staging));
-
-          VkMemoryRequirements buf_mem_req;
-          vkGetBufferMemoryRequirements(qvk.device, c->staging, &buf_mem_req);
-          if(graph->memory_type_bits_staging != ~0 && buf_mem_req.memoryTypeBits != graph->memory_type_bits_staging)
-            dt_log(s_log_qvk|s_log_err, "staging memory type bits don't match!");
-          graph->memory_type_bits_staging = buf_mem_req.memoryTypeBits;
-          c->mem_staging    = dt_vkalloc(&graph->heap_staging, buf_mem_req.size, buf_mem_req.alignment);
-          c->offset_staging = c->mem_staging->offset;
-          c->size_staging   = c->mem_staging->size;
-        }
       }
     }
   }
@@ -438,7 +444,7 @@ alloc_outputs2(dt_graph_t *graph, dt_node_t *node)
     if(dt_connector_output(c))
     { // allocate our output buffers
       VkFormat format = dt_connector_vkformat(c);
-      vkBindImageMemory(qvk.device, c->image, graph->vkmem, c->offset);
+      vkBindImageMemory(qvk.device, c->image, graph->vkmem.mem, graph->vkmem.offset + c->offset);
 
       VkImageViewCreateInfo images_view_create_info = {
         .sType      = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -471,8 +477,6 @@ alloc_outputs2(dt_graph_t *graph, dt_node_t *node)
       img_dset[i].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
       img_dset[i].pImageInfo      = img_info + i;
 
-      if(c->type == dt_token("source"))
-        vkBindBufferMemory(qvk.device, c->staging, graph->vkmem_staging, c->offset_staging);
     }
     else if(dt_connector_input(c))
     { // point our inputs to their counterparts:
@@ -499,8 +503,6 @@ alloc_outputs2(dt_graph_t *graph, dt_node_t *node)
         dt_log(s_log_err | s_log_pipe, "kernel %"PRItkn"_%"PRItkn":%d is not connected!",
             dt_token_str(node->name), dt_token_str(node->kernel), i);
       }
-      if(c->type == dt_token("sink"))
-        vkBindBufferMemory(qvk.device, c->staging, graph->vkmem_staging, c->offset_staging);
     }
   }
   if(node->dset_layout)
@@ -542,6 +544,8 @@ free_inputs(dt_graph_t *graph, dt_node_t *node)
       //     dt_token_str(node->kernel),
       //     dt_token_str(c->name));
       dt_vkfree(&graph->heap, c->mem);
+      if(!c->mem->ref) // really freed, the buffer is dead after this step
+        graph->plan[graph->node[c->connected_mi].connector[c->connected_mc].plan].end = graph->plan_step;
       // note that we keep the offset and VkImage etc around, we'll be using
       // these in consecutive runs through the pipeline and only clean up at
       // the very end. we just instruct our allocator that we're done with
@@ -555,15 +559,7 @@ free_inputs(dt_graph_t *graph, dt_node_t *node)
       //     dt_token_str(c->name),
       //     c->connected_mi, c->mem->ref);
       dt_vkfree(&graph->heap, c->mem);
-    }
-    // staging memory for sources or sinks only needed during execution once
-    if(c->mem_staging)
-    {
-      // dt_log(s_log_pipe, "freeing staging %"PRItkn"_%"PRItkn" %"PRItkn,
-      //     dt_token_str(node->name),
-      //     dt_token_str(node->kernel),
-      //     dt_token_str(c->name));
-      dt_vkfree(&graph->heap_staging, c->mem_staging);
+      if(!c->mem->ref) graph->plan[c->plan].end = graph->plan_step;
     }
   }
 }
@@ -607,6 +603,26 @@ modify_roi_out(dt_graph_t *graph, dt_module_t *module)
   }
 }
 
+// restrict the roi requested by the sink to the current strip plus halo
+static void
+tile_roi(dt_graph_t *graph, dt_roi_t *roi)
+{
+  uint32_t y0 = graph->tile_y > graph->tile_halo ? graph->tile_y - graph->tile_halo : 0;
+  const uint32_t y1 = MIN(roi->ht, graph->tile_y + graph->tile_ht + graph->tile_halo);
+  // the origin has to be on a multiple of the cfa block on input scale, too,
+  // and exactly so, or the strips don't line up. grow the halo upwards until
+  // it is. for scale p/q this happens every 6q rows, y0 == 0 always works.
+  while(y0 > 0)
+  {
+    const float yi = y0 * roi->scale / DT_GRAPH_TILE_ALIGN;
+    if(fabsf(yi - roundf(yi)) * DT_GRAPH_TILE_ALIGN < 1e-3f) break;
+    y0--;
+  }
+  graph->tile_oy = graph->tile_y - y0;
+  roi->y += roundf(y0 * roi->scale);
+  roi->ht = y1 - y0;
+}
+
 // request input region of interest from sink to source
 static void
 modify_roi_in(dt_graph_t *graph, dt_module_t *module)
@@ -614,6 +630,8 @@ modify_roi_in(dt_graph_t *graph, dt_module_t *module)
   if(module->so->modify_roi_in)
   {
     module->so->modify_roi_in(graph, module);
+    if(graph->tile_cnt && module->connector[0].type == dt_token("sink"))
+      tile_roi(graph, &module->connector[0].roi);
   }
   else
   {
@@ -625,7 +643,9 @@ modify_roi_in(dt_graph_t *graph, dt_module_t *module)
       dt_roi_t *r = &module->connector[0].roi;
       r->wd = r->full_wd;
       r->ht = r->full_ht;
+      r->x = r->y = 0;
       r->scale = 1.0f;
+      if(graph->tile_cnt) tile_roi(graph, r);
     }
     if(output < 0) return;
     dt_roi_t *roi = &module->connector[output].roi;
@@ -662,120 +682,301 @@ void dt_token_print(dt_token_t t)
   fprintf(stderr, "token: %"PRItkn"\n", dt_token_str(t));
 }
 
-static VkResult
-record_command_buffer(dt_graph_t *graph, dt_node_t *node, int *runflag)
+// hash everything that goes into the kernel: rois, params and push constants.
+static uint64_t
+node_hash(const dt_node_t *node)
 {
-  // TODO: run flags and active module
-  if(node->name == dt_token("demosaic")) *runflag = 2; // XXX hack
-  if(node->name == dt_token("srgb2f"))   *runflag = 2; // XXX hack
-  if(!*runflag) return VK_SUCCESS; // nothing to do yet
+  uint64_t hash = DT_HASH_INIT;
+  hash = dt_hash(hash, &node->kernel, sizeof(node->kernel));
+  hash = dt_hash(hash, &node->wd, sizeof(uint32_t)*3);
+  for(int i=0;i<node->num_connectors;i++)
+    hash = dt_hash(hash, &node->connector[i].roi, sizeof(dt_roi_t));
+  hash = dt_hash(hash, node->push_constant, node->push_constant_size);
+  if(node->module->committed_param_size)
+    hash = dt_hash(hash, node->module->committed_param, node->module->committed_param_size);
+  if(node->module->param_size)
+    hash = dt_hash(hash, node->module->param, node->module->param_size);
+  return hash;
+}
 
-  // for drawn/rasterised buffers:
-  uint32_t attachment_desc_cnt = 0;
-  VkAttachmentDescription attachment_desc[DT_MAX_CONNECTORS];
+// commit params and find all modules which need to be processed: the ones
+// whose nodes see different params or rois than in the last run, new sources,
+// and everything downstream of these. the outputs of all other modules are
+// still valid from last time (these are pinned in memory, see alloc_outputs).
+static void
+mark_dirty(dt_graph_t *graph, dt_graph_run_t run)
+{
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    dt_node_t *node = graph->node + n;
+    // copy over module params, per node. on a parameter-only run we only
+    // need to do that for modules which have been flagged as changed, the
+    // others still hold their committed params from last time.
+    if(node->module->so->commit_params &&
+      ((run & s_graph_run_structure) ||
+       (node->module->flags & s_module_request_commit_params)))
+      node->module->so->commit_params(graph, node);
+
+    const uint64_t hash = node_hash(node);
+    if(hash != node->hash ||
+       (run & s_graph_run_alloc_free) || // memory has been shuffled around
+      ((run & s_graph_run_upload_source) && dt_node_source(node)))
+      node->module->flags |= s_module_dirty;
+    node->hash = hash;
+  }
+
+  // propagate from sources to sinks
+  dt_module_t *const arr = graph->module;
+  const int arr_cnt = graph->num_modules;
+#define TRAVERSE_POST\
+  for(int i=0;i<arr[curr].num_connectors;i++)\
+    if(dt_connector_input(arr[curr].connector+i) &&\
+       arr[curr].connector[i].connected_mi >= 0 &&\
+      (arr[arr[curr].connector[i].connected_mi].flags & s_module_dirty))\
+      arr[curr].flags |= s_module_dirty;
+#include "graph-traverse.inc"
+}
+
+// write roi and params to our slice of the persistently mapped uniform
+// buffer. it will be picked up via dynamic offset, so no copies or barriers
+// need to go into the command buffer, and it does not need re-recording.
+static void
+write_uniforms(dt_graph_t *graph, dt_node_t *node)
+{
+  if(!node->pipeline) return;
+  uint8_t *uniform_buf = graph->uniform_mapped
+    + graph->frame_curr * graph->uniform_stride + node->uniform_offset;
+  size_t pos = 0;
+  for(int i=0;i<node->num_connectors;i++)
+  {
+    memcpy(uniform_buf + pos, &node->connector[i].roi, sizeof(dt_roi_t));
+    pos += ((sizeof(dt_roi_t)+15)/16) * 16; // needs vec4 alignment
+  }
+  // copy over module params, per node (committed in mark_dirty).
+  if(node->module->committed_param_size)
+    memcpy(uniform_buf + pos, node->module->committed_param, node->module->committed_param_size);
+  else if(node->module->param_size)
+    memcpy(uniform_buf + pos, node->module->param, node->module->param_size);
+}
+
+// the output connector owning the image behind connector c, or 0.
+static dt_connector_t *
+image_owner(dt_graph_t *graph, dt_node_t *node, int c)
+{
+  dt_connector_t *cn = node->connector + c;
+  if(dt_connector_output(cn)) return cn;
+  if(cn->connected_mi < 0) return 0;
+  return graph->node[cn->connected_mi].connector + cn->connected_mc;
+}
+
+// does any image of node m share device memory with connector c?
+static int
+aliases_node(dt_graph_t *graph, dt_node_t *m, const dt_connector_t *c)
+{
+  for(int i=0;i<m->num_connectors;i++)
+  {
+    const dt_connector_t *o = image_owner(graph, m, i);
+    if(o && o->offset < c->offset + c->size && c->offset < o->offset + o->size)
+      return 1;
+  }
+  return 0;
+}
 
-  VkCommandBuffer cmd_buf = graph->command_buffer;
-  //if(*runflag == 1) // only wait for non-cached inputs
+// put the node one level after all its inputs. memory is recycled in
+// traversal order, so our outputs may alias images used by nodes traversed
+// before us: these need to be done by the time we write, too.
+static void
+schedule_level(dt_graph_t *graph, dt_node_t *node)
+{
+  int level = 0;
+  for(int i=0;i<node->num_connectors;i++)
   {
-    // wait for our input images and transfer them to read only.
-    // also wait for our output buffers to be transferred into general layout.
-    // TODO: is this wasteful on the output buffers because it swizzles data? it could just discard it
+    dt_connector_t *c = node->connector+i;
+    if(dt_connector_input(c) && c->connected_mi >= 0)
+      level = MAX(level, graph->node[c->connected_mi].level + 1);
+    else if(dt_connector_output(c))
+      for(int m=0;m<graph->num_nodes;m++)
+        if(graph->node[m].level >= level && graph->node+m != node &&
+           aliases_node(graph, graph->node+m, c))
+          level = graph->node[m].level + 1;
+  }
+  node->level = level;
+}
+
+// append a transition of the image to the batch, using the layout and access
+// it has at this point in the command buffer.
+static void
+barrier_image(
+    VkImageMemoryBarrier *batch,
+    uint32_t             *cnt,
+    dt_connector_t       *c,
+    VkImageLayout         layout,
+    VkAccessFlags         access)
+{
+  const VkAccessFlags write = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+  // read after read is fine without barrier:
+  if(c->layout == layout && !(c->access & write) && !(access & write)) return;
+  batch[(*cnt)++] = (VkImageMemoryBarrier){
+    .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image               = c->image,
+    .subresourceRange    = {
+      .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+      .baseMipLevel   = 0,
+      .levelCount     = 1,
+      .baseArrayLayer = 0,
+      .layerCount     = 1
+    },
+    .srcAccessMask       = c->access,
+    .dstAccessMask       = access,
+    .oldLayout           = c->layout,
+    .newLayout           = layout,
+  };
+  c->layout = layout;
+  c->access = access;
+}
+
+static void
+barrier_flush(
+    VkCommandBuffer       cmd_buf,
+    VkImageMemoryBarrier *batch,
+    uint32_t             *cnt)
+{
+  if(!*cnt) return;
+  vkCmdPipelineBarrier(cmd_buf,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0, 0, NULL, 0, NULL, *cnt, batch);
+  *cnt = 0;
+}
+
+// leave all images shader readable. this is the state every recorded
+// command buffer starts from, so frames can be resubmitted in any order.
+static void
+record_finish(dt_graph_t *graph)
+{
+  VkCommandBuffer cmd_buf = graph->frame[graph->frame_curr].command_buffer;
+  VkImageMemoryBarrier batch[256];
+  uint32_t cnt = 0;
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    dt_node_t *node = graph->node + n;
+    if(cnt + node->num_connectors > LENGTH(batch)) barrier_flush(cmd_buf, batch, &cnt);
     for(int i=0;i<node->num_connectors;i++)
     {
-      if(dt_connector_input(node->connector+i))
-      {
-        if(!node->module->so->write_sink)
-          BARRIER_IMG_LAYOUT(node->connector[i].image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        else
-          BARRIER_IMG_LAYOUT(node->connector[i].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-      }
-      else if(dt_connector_output(node->connector+i))
-      {
-        // wait for layout transition on the output back to general:
-        if(node->connector[i].flags & s_conn_clear)
-        {
-          BARRIER_IMG_LAYOUT(node->connector[i].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-          // in case clearing is requested, zero out the image:
-          VkClearColorValue col = {{0}};
-          VkImageSubresourceRange range = {
-            .aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel    = 0,
-            .levelCount      = 1,
-            .baseArrayLayer  = 0,
-            .layerCount      = 1
-          };
-          vkCmdClearColorImage(
-              cmd_buf,
-              node->connector[i].image,
-              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-              &col,
-              1,
-              &range);
-        }
-        BARRIER_IMG_LAYOUT(node->connector[i].image, VK_IMAGE_LAYOUT_GENERAL);
-        if(node->connector[i].flags & s_conn_drawn)
-        {
-          // TODO: this connector needs to init a graphics command buffer!
-          // TODO: take note of this (flag) and init a render pass for this node later on!
-          // TODO: collect all s_conn_drawn connectors here and write their attachment_desc to array!
-          attachment_desc[attachment_desc_cnt++] = (VkAttachmentDescription){
-            .format         = dt_connector_vkformat(node->connector+i),
-            .samples        = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR, // VK_ATTACHMENT_LOAD_OP_DONT_CARE, // XXX select on s_conn_clear flag?
-            .storeOp        = VK_ATTACHMENT_STORE_OP_STORE,
-            .stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout    = VK_IMAGE_LAYOUT_GENERAL,
-          };
-        }
-      }
+      dt_connector_t *c = node->connector+i;
+      if(dt_connector_output(c) && c->layout != VK_IMAGE_LAYOUT_UNDEFINED)
+        barrier_image(batch, &cnt, c, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT);
     }
   }
-  *runflag = 1;
+  barrier_flush(cmd_buf, batch, &cnt);
+}
 
-  const uint32_t wd = node->connector[0].roi.wd;
-  const uint32_t ht = node->connector[0].roi.ht;
-  VkBufferImageCopy regions = {
-    .bufferOffset      = 0,
-    .bufferRowLength   = 0,
-    .bufferImageHeight = 0,
-    .imageSubresource  = {
-      .aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT,
-      .mipLevel        = 0,
-      .baseArrayLayer  = 0,
-      .layerCount      = 1
-    },
-    .imageOffset = {0},
-    .imageExtent = {
-      .width  = wd,
-      .height = ht,
-      .depth  = 1,
-    },
+static VkResult record_command_buffer(dt_graph_t *graph, dt_node_t *node);
+
+// record all dirty nodes on one level. they only depend on earlier levels,
+// so they are separated by one barrier batch and may run concurrently.
+static VkResult
+record_level(dt_graph_t *graph, int level)
+{
+  VkCommandBuffer cmd_buf = graph->frame[graph->frame_curr].command_buffer;
+  VkImageMemoryBarrier batch[256];
+  uint32_t cnt = 0;
+  VkImageSubresourceRange range = {
+    .aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT,
+    .baseMipLevel    = 0,
+    .levelCount      = 1,
+    .baseArrayLayer  = 0,
+    .layerCount      = 1
   };
-  if(dt_node_sink(node) && node->module->so->write_sink)
-  { // only schedule copy back if the node actually asks for it
-    vkCmdCopyImageToBuffer(
-        cmd_buf,
-        node->connector[0].image,
-        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        node->connector[0].staging,
-        1, &regions);
-    BARRIER_COMPUTE_BUFFER(node->connector[0].staging);
-  }
-  else if(dt_node_source(node))
+  // first batch: prepare images which are cleared
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    dt_node_t *node = graph->node + n;
+    if(node->level != level || !(node->module->flags & s_module_dirty)) continue;
+    if(cnt + node->num_connectors > LENGTH(batch)) barrier_flush(cmd_buf, batch, &cnt);
+    for(int i=0;i<node->num_connectors;i++)
+    {
+      dt_connector_t *c = node->connector+i;
+      if(dt_connector_output(c) && (c->flags & s_conn_clear))
+        barrier_image(batch, &cnt, c, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT);
+    }
+  }
+  barrier_flush(cmd_buf, batch, &cnt);
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    dt_node_t *node = graph->node + n;
+    if(node->level != level || !(node->module->flags & s_module_dirty)) continue;
+    for(int i=0;i<node->num_connectors;i++)
+    { // in case clearing is requested, zero out the image:
+      dt_connector_t *c = node->connector+i;
+      VkClearColorValue col = {{0}};
+      if(dt_connector_output(c) && (c->flags & s_conn_clear))
+        vkCmdClearColorImage(cmd_buf, c->image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &col, 1, &range);
+    }
+  }
+  // second batch: wait for our inputs and make outputs writable
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    dt_node_t *node = graph->node + n;
+    if(node->level != level || !(node->module->flags & s_module_dirty)) continue;
+    if(cnt + node->num_connectors > LENGTH(batch)) barrier_flush(cmd_buf, batch, &cnt);
+    for(int i=0;i<node->num_connectors;i++)
+    {
+      dt_connector_t *c = image_owner(graph, node, i);
+      if(!c) continue;
+      // sources are uploaded and sinks downloaded outside this command
+      // buffer, through the staging ring:
+      if(dt_connector_input(node->connector+i))
+        barrier_image(batch, &cnt, c, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT);
+      else if(c->type != dt_token("source"))
+        barrier_image(batch, &cnt, c, VK_IMAGE_LAYOUT_GENERAL, VK_ACCESS_SHADER_WRITE_BIT);
+    }
+  }
+  barrier_flush(cmd_buf, batch, &cnt);
+  for(int n=0;n<graph->num_nodes;n++)
+    if(graph->node[n].level == level)
+      QVKR(record_command_buffer(graph, graph->node+n));
+  return VK_SUCCESS;
+}
+
+static VkResult
+record_command_buffer(dt_graph_t *graph, dt_node_t *node)
+{
+  // the output of this module is still valid from the last run:
+  if(!(node->module->flags & s_module_dirty)) return VK_SUCCESS;
+
+  // for drawn/rasterised buffers:
+  uint32_t attachment_desc_cnt = 0;
+  VkAttachmentDescription attachment_desc[DT_MAX_CONNECTORS];
+
+  VkCommandBuffer cmd_buf = graph->frame[graph->frame_curr].command_buffer;
+  // layout transitions and clears have been recorded for the whole level
+  // already, see record_level().
+  for(int i=0;i<node->num_connectors;i++)
   {
-    BARRIER_IMG_LAYOUT(node->connector[0].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    vkCmdCopyBufferToImage(
-        cmd_buf,
-        node->connector[0].staging,
-        node->connector[0].image,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1, &regions);
-    // this will transfer into READ_ONLY_OPTIMAL
-    BARRIER_COMPUTE(node->connector[0].image);
+    if(dt_connector_output(node->connector+i) &&
+      (node->connector[i].flags & s_conn_drawn))
+    {
+      // TODO: this connector needs to init a graphics command buffer!
+      // TODO: take note of this (flag) and init a render pass for this node later on!
+      // TODO: collect all s_conn_drawn connectors here and write their attachment_desc to array!
+      attachment_desc[attachment_desc_cnt++] = (VkAttachmentDescription){
+        .format         = dt_connector_vkformat(node->connector+i),
+        .samples        = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR, // VK_ATTACHMENT_LOAD_OP_DONT_CARE, // XXX select on s_conn_clear flag?
+        .storeOp        = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout    = VK_IMAGE_LAYOUT_GENERAL,
+      };
+    }
   }
 
+  dt_graph_frame_t *frame = graph->frame + graph->frame_curr;
   // TODO: if render pass (means no compute shader): execute the render pass here
 #if 0
   // begin render pass
@@ -789,95 +990,33 @@ record_command_buffer(dt_graph_t *graph, dt_node_t *node, int *runflag)
 
   // add our global uniforms:
   VkDescriptorSet desc_sets[] = {
-    graph->uniform_dset,
+    frame->uniform_dset,
     node->dset,
   };
 
-  // push profiler start
-  if(graph->query_cnt < graph->query_max)
-  {
-    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-        graph->query_pool, graph->query_cnt);
-    graph->query_name  [graph->query_cnt  ] = node->name;
-    graph->query_kernel[graph->query_cnt++] = node->kernel;
-  }
+  // push profiler start. every frame has its own range of queries, sized
+  // for two per node:
+  const uint32_t q = graph->frame_curr * graph->query_max + frame->query_cnt;
+  vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, graph->query_pool, q);
+  graph->query_node[q] = node - graph->node;
 
   vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, node->pipeline);
   vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
-    node->pipeline_layout, 0, LENGTH(desc_sets), desc_sets, 0, 0);
+    node->pipeline_layout, 0, LENGTH(desc_sets), desc_sets, 1, &node->uniform_offset);
 
-  // update some buffers:
+  // update some buffers. roi and params are in the uniform buffer already.
   if(node->push_constant_size)
     vkCmdPushConstants(cmd_buf, node->pipeline_layout,
         VK_SHADER_STAGE_ALL, 0, node->push_constant_size, node->push_constant);
-  uint8_t uniform_buf[4096]; // max would be 65k
-  // can only be 65k or else we need to upload through staging etc
-  // offset and size have to be multiples of 4
-  size_t pos = 0;
-  for(int i=0;i<node->num_connectors;i++)
-  {
-    memcpy(uniform_buf + pos, &node->connector[i].roi, sizeof(dt_roi_t));
-    pos += ((sizeof(dt_roi_t)+15)/16) * 16; // needs vec4 alignment
-  }
-  // copy over module params, per node.
-  // we may want to skip this if the uniform buffer stays the same for all nodes of the module.
-  if(node->module->so->commit_params)
-    node->module->so->commit_params(graph, node);
-
-  if(node->module->committed_param_size)
-  {
-    memcpy(uniform_buf + pos, node->module->committed_param, node->module->committed_param_size);
-    pos += ((node->module->committed_param_size + 15)/16)*16;
-  }
-  else if(node->module->param_size)
-  {
-    memcpy(uniform_buf + pos, node->module->param, node->module->param_size);
-    pos += node->module->param_size;
-  }
-
-  VkBufferMemoryBarrier ub_barrier = {
-    .sType         = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-    .srcAccessMask = VK_ACCESS_UNIFORM_READ_BIT,
-    .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-    .buffer = graph->uniform_buffer,
-    .offset = 0,
-    .size = pos,
-  };
-  vkCmdPipelineBarrier(
-      cmd_buf,
-      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-      VK_PIPELINE_STAGE_TRANSFER_BIT,
-      0,
-      0, NULL,
-      1, &ub_barrier,
-      0, NULL);
-
-  vkCmdUpdateBuffer(cmd_buf, graph->uniform_buffer, 0, pos, uniform_buf);
-
-  ub_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-  ub_barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
-  vkCmdPipelineBarrier(
-      cmd_buf,
-      VK_PIPELINE_STAGE_TRANSFER_BIT,
-      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-      0,
-      0, NULL,
-      1, &ub_barrier,
-      0, NULL);
 
   vkCmdDispatch(cmd_buf,
       (node->wd + 31) / 32,
       (node->ht + 31) / 32,
        node->dp);
 
-  // get a profiler timestamp:
-  if(graph->query_cnt < graph->query_max)
-  {
-    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-        graph->query_pool, graph->query_cnt);
-    graph->query_name  [graph->query_cnt  ] = node->name;
-    graph->query_kernel[graph->query_cnt++] = node->kernel;
-  }
+  // get a profiler timestamp when the dispatch is done:
+  vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, graph->query_pool, q+1);
+  frame->query_cnt += 2;
   return VK_SUCCESS;
 }
 
@@ -921,8 +1060,7 @@ static void
 create_nodes(dt_graph_t *graph, dt_module_t *module)
 {
   if(module->so->create_nodes) return module->so->create_nodes(graph, module);
-  assert(graph->num_nodes < graph->max_nodes);
-  const int nodeid = graph->num_nodes++;
+  const int nodeid = dt_node_add(graph);
   dt_node_t *node = graph->node + nodeid;
   // int ctxnid = -1;
   // dt_node_t *ctxn = 0;
@@ -1009,33 +1147,139 @@ create_nodes(dt_graph_t *graph, dt_module_t *module)
 // - keep nodes, add new ones (or just re-create)
 // - re-alloc
 
-VkResult dt_graph_run(
-    dt_graph_t     *graph,
-    dt_graph_run_t  run)
+// passes which only depend on the modules and the roi: negotiate roi, create
+// nodes and plan the memory layout. nothing is allocated on the device yet.
+// now that we know the live ranges of all buffers in traversal order, pack
+// them again with the whole picture. the greedy placement in alloc_outputs
+// depends on the order of the traversal and fragments the heap.
+static void
+plan_memory(dt_graph_t *graph)
 {
-  // can be only one output sink node that determines ROI. but we can totally
-  // have more than one sink to pull in nodes for. we have to execute some of
-  // this multiple times. also we have a marker on nodes/modules that we
-  // already traversed. there might also be cycles on the module level.
+  const uint64_t vmsize = dt_plan_offsets(graph->plan, graph->plan_cnt);
+  assert(!dt_plan_check(graph->plan, graph->plan_cnt));
+  dt_log(s_log_pipe, "images : planned %g MB, greedy %g MB, live peak %g MB",
+      vmsize/(1024.0*1024.0), graph->heap.vmsize/(1024.0*1024.0),
+      dt_plan_peak(graph->plan, graph->plan_cnt)/(1024.0*1024.0));
+  if(vmsize >= graph->heap.vmsize) return; // keep what we have
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    for(int i=0;i<graph->node[n].num_connectors;i++)
+    {
+      dt_connector_t *c = graph->node[n].connector+i;
+      if(dt_connector_output(c)) c->offset = graph->plan[c->plan].offset;
+    }
+  }
+  graph->heap.vmsize = vmsize;
+}
 
-  if(run & s_graph_run_alloc_dset)
+// condense the connected inputs of all nodes into the edge list, so the
+// traversals don't have to walk the connectors of the nodes.
+static void
+graph_edges(dt_graph_t *graph)
+{
+  graph->edge_beg = realloc(graph->edge_beg, sizeof(int)*(graph->num_nodes+1));
+  int cnt = 0;
+  for(int n=0;n<graph->num_nodes;n++)
   {
-    // init layout of uniform descriptor set:
-    VkDescriptorSetLayoutBinding bindings = {
-      .binding = 0,
-      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-      .descriptorCount = 1,
-      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
-    };
-    VkDescriptorSetLayoutCreateInfo dset_layout_info = {
-      .sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-      .bindingCount = 1,
-      .pBindings    = &bindings,
-    };
-    QVKR(vkCreateDescriptorSetLayout(qvk.device, &dset_layout_info, 0, &graph->uniform_dset_layout));
+    graph->edge_beg[n] = cnt;
+    for(int c=0;c<graph->node[n].num_connectors;c++)
+      if(dt_connector_input(graph->node[n].connector+c) &&
+         graph->node[n].connector[c].connected_mi >= 0) cnt++;
+  }
+  graph->edge_beg[graph->num_nodes] = cnt;
+  graph->edge = realloc(graph->edge, sizeof(int)*(cnt+1));
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    int k = graph->edge_beg[n];
+    for(int c=0;c<graph->node[n].num_connectors;c++)
+      if(dt_connector_input(graph->node[n].connector+c) &&
+         graph->node[n].connector[c].connected_mi >= 0)
+        graph->edge[k++] = graph->node[n].connector[c].connected_mi;
+  }
+}
+
+// outputs may declare a narrower storage format than the one they compute in,
+// for instance display encoded values which are fine with 8 bits. readers
+// only see it through samplers, so this is transparent to the kernels. it's
+// not used for images read by a module which downloads to the host with
+// write_sink(), it expects the declared format (or packs it on the device
+// first). f11 drops alpha and negative values, we only use it for images
+// which end up on screen.
+static void
+graph_formats(dt_graph_t *graph)
+{
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    dt_node_t *node = graph->node + n;
+    for(int c=0;c<node->num_connectors;c++)
+    {
+      if(!dt_connector_input(node->connector+c) ||
+          node->connector[c].connected_mi < 0) continue;
+      dt_connector_t *out = graph->node[node->connector[c].connected_mi].connector +
+        node->connector[c].connected_mc;
+      if(node->module->so->write_sink) out->narrow = 0;
+      if(!dt_node_sink(node) && out->narrow == dt_token("f11")) out->narrow = 0;
+    }
+  }
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    for(int c=0;c<graph->node[n].num_connectors;c++)
+    {
+      dt_connector_t *out = graph->node[n].connector+c;
+      if(out->type != dt_token("write") || !out->narrow ||
+         (out->flags & s_conn_drawn)) continue;
+      dt_connector_t tmp = *out;
+      tmp.format = out->narrow;
+      const VkFormat format = dt_connector_vkformat(&tmp);
+      VkFormatProperties prop;
+      vkGetPhysicalDeviceFormatProperties(qvk.physical_device, format, &prop);
+      const VkFormatFeatureFlags need =
+        VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+      if(format != VK_FORMAT_UNDEFINED && (prop.optimalTilingFeatures & need) == need)
+        out->format = out->narrow;
+    }
+  }
+  // inputs carry the format of the image they are connected to:
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    for(int c=0;c<graph->node[n].num_connectors;c++)
+    {
+      dt_connector_t *in = graph->node[n].connector+c;
+      if(dt_connector_input(in) && in->connected_mi >= 0)
+        in->format = graph->node[in->connected_mi].connector[in->connected_mc].format;
+    }
   }
-  graph->query_cnt = 0;
+}
 
+// walk all inputs and determine roi on all outputs. returns non-zero if
+// the full output dimensions or image parameters of any module changed.
+static int
+graph_roi_out(dt_graph_t *graph)
+{
+  dt_module_t *const arr = graph->module;
+  const int arr_cnt = graph->num_modules;
+  // execute after all inputs have been traversed:
+  // "int curr" will be the current node
+#define TRAVERSE_POST \
+  modify_roi_out(graph, arr+curr);
+#include "graph-traverse.inc"
+  uint64_t hash = DT_HASH_INIT;
+  for(int m=0;m<graph->num_modules;m++)
+  {
+    hash = dt_hash(hash, &arr[m].img_param, sizeof(arr[m].img_param));
+    for(int c=0;c<arr[m].num_connectors;c++)
+      hash = dt_hash(hash, &arr[m].connector[c].roi, sizeof(uint32_t)*2); // full_wd, full_ht
+  }
+  const int changed = hash != graph->roi_hash;
+  graph->roi_hash = hash;
+  return changed;
+}
+
+static VkResult
+graph_plan(
+    dt_graph_t     *graph,
+    dt_graph_run_t  run)
+{
 { // module scope
   dt_module_t *const arr = graph->module;
   const int arr_cnt = graph->num_modules;
@@ -1046,11 +1290,7 @@ VkResult dt_graph_run(
   // "int curr" will be the current node
   // walk all inputs and determine roi on all outputs
   if(run & s_graph_run_roi_out)
-  {
-#define TRAVERSE_POST \
-    modify_roi_out(graph, arr+curr);
-#include "graph-traverse.inc"
-  }
+    graph_roi_out(graph);
 
   // now we don't always want the full size buffer but are interested in a
   // scaled or cropped sub-region. actually this step is performed
@@ -1075,6 +1315,8 @@ VkResult dt_graph_run(
     dt_log(s_log_pipe, "module cycle %"PRItkn"->%"PRItkn"!", dt_token_str(arr[curr].name), dt_token_str(arr[el].name));\
     dt_module_connect(graph, -1,-1, curr, i);
 #include "graph-traverse.inc"
+    graph_edges(graph);
+    graph_formats(graph);
   }
 } // end scope, done with modules
 
@@ -1082,21 +1324,6 @@ VkResult dt_graph_run(
   dt_node_t *const arr = graph->node;
   const int arr_cnt = graph->num_nodes;
 
-  // ==============================================
-  // TODO: tiling:
-  // ==============================================
-#if 0
-  // TODO: while(not happy) {
-  // TODO: 3rd pass: compute memory requirements
-  // TODO: if not happy: cut input roi in half or what
-#define TRAVERSE_POST\
-    alloc_outputs(allocator, arr+curr);\
-    free_inputs (allocator, arr+curr);
-#include "graph-traverse.inc"
-  // }
-  // TODO: do that one after the other for all chopped roi
-#endif
-
   // ==============================================
   // 1st pass alloc and free, detect cycles
   // ==============================================
@@ -1111,78 +1338,625 @@ VkResult dt_graph_run(
     // this is needed for memory allocation later:
 #define TRAVERSE_PRE\
     count_references(graph, arr+curr);
+#define TRAVERSE_EDGE_BEG graph->edge_beg
+#define TRAVERSE_EDGE     graph->edge
 #include "graph-traverse.inc"
     // free pipeline resources if previously allocated anything:
     dt_vkalloc_nuke(&graph->heap);
-    dt_vkalloc_nuke(&graph->heap_staging);
     // XXX TODO: if we do this, we may want to alloc_dset, too?
     graph->dset_cnt_image_read = 0;
     graph->dset_cnt_image_write = 0;
     graph->dset_cnt_buffer = 0;
-    graph->dset_cnt_uniform = 1; // we have one global uniform for roi + params
+    graph->dset_cnt_uniform = DT_GRAPH_MAX_FRAMES; // one dynamic uniform per frame, sliced per node
     graph->memory_type_bits = ~0u;
-    graph->memory_type_bits_staging = ~0u;
+    graph->uniform_size  = 0;
+    graph->uniform_range = 16; // never bind an empty range
+    graph->plan_cnt  = 0;
+    graph->plan_step = 0;
 #define TRAVERSE_POST\
     QVKR(alloc_outputs(graph, arr+curr));\
-    free_inputs       (graph, arr+curr);
+    free_inputs       (graph, arr+curr);\
+    graph->plan_step++;
 #define TRAVERSE_CYCLE\
     dt_log(s_log_pipe, "cycle %"PRItkn"_%"PRItkn"->%"PRItkn"_%"PRItkn"!", \
         dt_token_str(arr[curr].name), dt_token_str(arr[curr].kernel), \
         dt_token_str(arr[el].name), dt_token_str(arr[el].kernel)); \
     dt_node_connect(graph, -1,-1, curr, i);
+#define TRAVERSE_EDGE_BEG graph->edge_beg
+#define TRAVERSE_EDGE     graph->edge
 #include "graph-traverse.inc"
+    plan_memory(graph);
   }
+} // end scope, done with nodes
+  return VK_SUCCESS;
+}
 
-  if(graph->heap.vmsize > graph->vkmem_size)
+// the single sink we can cut into strips, or -1. the strips are stitched
+// together on the host, so the sink needs to be written by write_sink().
+static int
+tile_sink(const dt_graph_t *graph)
+{
+  int sink = -1;
+  for(int m=0;m<graph->num_modules;m++)
   {
-    if(graph->vkmem) vkFreeMemory(qvk.device, graph->vkmem, 0);
-    // image data to pass between nodes
-    VkMemoryAllocateInfo mem_alloc_info = {
-      .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .allocationSize  = graph->heap.vmsize,
-      .memoryTypeIndex = qvk_get_memory_type(graph->memory_type_bits,
-          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
-    };
-    QVKR(vkAllocateMemory(qvk.device, &mem_alloc_info, 0, &graph->vkmem));
-    graph->vkmem_size = graph->heap.vmsize;
+    const dt_module_t *mod = graph->module + m;
+    if(mod->connector[0].type != dt_token("sink")) continue;
+    if(sink >= 0 || !mod->so->write_sink) return -1;
+    sink = m;
   }
+  return sink;
+}
+
+// wait until slot s of the staging ring is free again
+static VkResult
+ring_acquire(dt_graph_t *graph, int s)
+{
+  if(!graph->ring_pending[s]) return VK_SUCCESS;
+  QVKR(vkWaitForFences(qvk.device, 1, graph->ring_fence+s, VK_TRUE, 1ul<<40));
+  graph->ring_pending[s] = 0;
+  return VK_SUCCESS;
+}
+
+// record and submit the copy of rows [y, y+ht) of the image between the
+// buffer and the device, using the command buffer and fence of slot s. the
+// buffer is the staging ring, unless a source is uploaded from imported host
+// memory. outside of these the image stays shader readable, as between all
+// other command buffers. these are submitted to the same queue as the frames,
+// so the barriers order the copy against them. only the first copy to a
+// freshly allocated image transitions it out of the undefined layout, all
+// later bands keep what is already there.
+static VkResult
+ring_copy(
+    dt_graph_t     *graph,
+    int             s,
+    dt_connector_t *c,
+    uint32_t        y,
+    uint32_t        ht,
+    int             upload,
+    VkBuffer        buffer,
+    VkDeviceSize    offset,
+    uint32_t        row_length) // in pixels, 0 for tightly packed
+{
+  VkCommandBuffer cmd_buf = graph->ring_cmd[s];
+  VkCommandBufferBeginInfo begin_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  QVKR(vkBeginCommandBuffer(cmd_buf, &begin_info));
+  const VkImageLayout transfer = upload ?
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  VkImageMemoryBarrier barrier = {
+    .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image               = c->image,
+    .subresourceRange    = {
+      .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+      .baseMipLevel   = 0,
+      .levelCount     = 1,
+      .baseArrayLayer = 0,
+      .layerCount     = 1
+    },
+    .srcAccessMask       = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask       = upload ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_TRANSFER_READ_BIT,
+    // a freshly allocated image has nothing worth keeping
+    .oldLayout           = upload && c->layout == VK_IMAGE_LAYOUT_UNDEFINED ?
+      VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    .newLayout           = transfer,
+  };
+  vkCmdPipelineBarrier(cmd_buf,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0, 0, NULL, 0, NULL, 1, &barrier);
+  VkBufferImageCopy region = {
+    .bufferOffset      = offset,
+    .bufferRowLength   = row_length,
+    .bufferImageHeight = 0,
+    .imageSubresource  = {
+      .aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT,
+      .mipLevel        = 0,
+      .baseArrayLayer  = 0,
+      .layerCount      = 1
+    },
+    .imageOffset = { .x = 0, .y = y, .z = 0 },
+    .imageExtent = {
+      .width  = c->roi.wd,
+      .height = ht,
+      .depth  = 1,
+    },
+  };
+  if(upload)
+    vkCmdCopyBufferToImage(cmd_buf, buffer, c->image, transfer, 1, &region);
+  else
+    vkCmdCopyImageToBuffer(cmd_buf, c->image, transfer, buffer, 1, &region);
+  barrier.srcAccessMask = barrier.dstAccessMask;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout     = transfer;
+  barrier.newLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkCmdPipelineBarrier(cmd_buf,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0, 0, NULL, 0, NULL, 1, &barrier);
+  QVKR(vkEndCommandBuffer(cmd_buf));
 
-  if(graph->heap_staging.vmsize > graph->vkmem_staging_size)
+  VkSubmitInfo submit = {
+    .sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .commandBufferCount = 1,
+    .pCommandBuffers    = &cmd_buf,
+  };
+  vkResetFences(qvk.device, 1, graph->ring_fence+s);
+  QVKR(vkQueueSubmit(qvk.queue_compute, 1, &submit, graph->ring_fence[s]));
+  graph->ring_pending[s] = 1;
+  c->layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  c->access = VK_ACCESS_SHADER_READ_BIT;
+  return VK_SUCCESS;
+}
+
+// rows of the image which fit into one slot of the staging ring
+static inline uint32_t
+ring_rows(const dt_connector_t *c)
+{
+  const size_t row = dt_connector_channels(c) * dt_connector_bytes_per_pixel(c) * c->roi.wd;
+  return (DT_GRAPH_RING_SIZE / DT_GRAPH_RING_SLOTS) / row;
+}
+
+// copy the source straight from the decoded image in host memory, which is
+// imported for the duration of the copy. the import covers the whole pages
+// around the rows. returns an error if this doesn't work out for the buffer,
+// the caller falls back to the staging ring then.
+static VkResult
+upload_source_host(dt_graph_t *graph, dt_node_t *node)
+{
+  dt_module_t *mod = node->module;
+  dt_connector_t *c = node->connector;
+  size_t pitch = 0;
+  const uint8_t *ptr = mod->so->source_ptr(mod, &pitch);
+  if(!ptr) return VK_ERROR_FORMAT_NOT_SUPPORTED;
+  const size_t bpp = dt_connector_channels(c) * dt_connector_bytes_per_pixel(c);
+  const uint64_t align = qvk.host_pointer_alignment;
+  const uintptr_t beg = (uintptr_t)ptr & ~(align-1);
+  const uintptr_t end = ((uintptr_t)ptr + pitch * (c->roi.ht-1) + bpp * c->roi.wd + align-1) & ~(align-1);
+  const uint64_t offset = (uintptr_t)ptr - beg;
+  // buffer to image copies need texel aligned offsets and rows:
+  if(!align || !bpp || pitch % bpp || offset % bpp || offset % 4)
+    return VK_ERROR_FORMAT_NOT_SUPPORTED;
+
+  VkMemoryHostPointerPropertiesEXT host_properties = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+  };
+  QVKR(qvkGetMemoryHostPointerPropertiesEXT(qvk.device,
+        VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, (void *)beg, &host_properties));
+  VkExternalMemoryBufferCreateInfo external_info = {
+    .sType       = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+    .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+  };
+  VkBufferCreateInfo buffer_info = {
+    .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .pNext       = &external_info,
+    .size        = end - beg,
+    .usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+  };
+  VkBuffer buffer;
+  QVKR(vkCreateBuffer(qvk.device, &buffer_info, 0, &buffer));
+  VkMemoryRequirements buf_mem_req;
+  vkGetBufferMemoryRequirements(qvk.device, buffer, &buf_mem_req);
+  const uint32_t type_bits = buf_mem_req.memoryTypeBits & host_properties.memoryTypeBits;
+  if(!type_bits)
   {
-    if(graph->vkmem_staging) vkFreeMemory(qvk.device, graph->vkmem_staging, 0);
-    // staging memory to copy to and from device
-    VkMemoryAllocateInfo mem_alloc_info_staging = {
-      .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .allocationSize  = graph->heap_staging.vmsize,
-      .memoryTypeIndex = qvk_get_memory_type(graph->memory_type_bits_staging,
-          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
-    };
-    QVKR(vkAllocateMemory(qvk.device, &mem_alloc_info_staging, 0, &graph->vkmem_staging));
-    graph->vkmem_staging_size = graph->heap_staging.vmsize;
+    vkDestroyBuffer(qvk.device, buffer, 0);
+    return VK_ERROR_FORMAT_NOT_SUPPORTED;
+  }
+  VkImportMemoryHostPointerInfoEXT import_info = {
+    .sType        = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+    .handleType   = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+    .pHostPointer = (void *)beg,
+  };
+  VkMemoryAllocateInfo mem_alloc_info = {
+    .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .pNext           = &import_info,
+    .allocationSize  = end - beg,
+    .memoryTypeIndex = __builtin_ctz(type_bits),
+  };
+  VkDeviceMemory mem;
+  VkResult res = vkAllocateMemory(qvk.device, &mem_alloc_info, 0, &mem);
+  if(res != VK_SUCCESS)
+  {
+    vkDestroyBuffer(qvk.device, buffer, 0);
+    return res;
+  }
+  res = vkBindBufferMemory(qvk.device, buffer, mem, 0);
+
+  // the decoder may free its buffer once we return, so wait for the copy:
+  const int s = graph->ring_curr;
+  graph->ring_curr = (graph->ring_curr + 1) % DT_GRAPH_RING_SLOTS;
+  if(res == VK_SUCCESS) res = ring_acquire(graph, s);
+  if(res == VK_SUCCESS) res = ring_copy(graph, s, c, 0, c->roi.ht, 1, buffer, offset, pitch / bpp);
+  if(res == VK_SUCCESS) res = ring_acquire(graph, s);
+  vkDestroyBuffer(qvk.device, buffer, 0);
+  vkFreeMemory(qvk.device, mem, 0);
+  return res;
+}
+
+// read the source in bands: the module fills one slot while the previous
+// ones are still being copied to the device. if the module has no pointer
+// for us, because decoding failed, read_source() will report that.
+static VkResult
+upload_source(dt_graph_t *graph, dt_node_t *node)
+{
+  dt_module_t *mod = node->module;
+  dt_connector_t *c = node->connector;
+  if(mod->so->source_ptr && qvk.external_memory_host_supported &&
+     upload_source_host(graph, node) == VK_SUCCESS)
+    return VK_SUCCESS;
+  const uint32_t rows = dt_roi_band_rows(&mod->connector[0].roi, ring_rows(c));
+  if(!rows)
+  {
+    dt_log(s_log_err|s_log_pipe, "source '%"PRItkn"' is too wide for the staging ring!",
+        dt_token_str(node->name));
+    return VK_ERROR_OUT_OF_HOST_MEMORY;
+  }
+  const size_t slot_size = DT_GRAPH_RING_SIZE / DT_GRAPH_RING_SLOTS;
+  const dt_roi_t roi = mod->connector[0].roi;
+  for(uint32_t y=0;y<c->roi.ht;y+=rows)
+  {
+    const int s = graph->ring_curr;
+    graph->ring_curr = (graph->ring_curr + 1) % DT_GRAPH_RING_SLOTS;
+    QVKR(ring_acquire(graph, s));
+    const uint32_t ht = MIN(rows, c->roi.ht - y);
+    // the module reads the roi of its connector, point it to the band:
+    mod->connector[0].roi = dt_roi_band(&roi, y, ht);
+    const int err = mod->so->read_source(mod, graph->ring_mapped + s * slot_size);
+    mod->connector[0].roi = roi;
+    if(err)
+    {
+      dt_log(s_log_err|s_log_pipe, "source '%"PRItkn"' could not read its image!",
+          dt_token_str(mod->name));
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    QVKR(ring_copy(graph, s, c, y, ht, 1, graph->ring_buffer, s * slot_size, 0));
+  }
+  return VK_SUCCESS;
+}
+
+// copy rows [y, y+ht) of the image owned by output connector c to the host.
+// all slots are kept busy while the host copies out the oldest band. if a
+// module is given, its write_rows() can start on every band as it arrives,
+// while the rest is still in flight.
+static VkResult
+download_sink(
+    dt_graph_t     *graph,
+    dt_connector_t *c,
+    uint32_t        y,
+    uint32_t        ht,
+    uint8_t        *out,
+    dt_module_t    *mod)
+{
+  const uint32_t rows = ring_rows(c);
+  if(!rows) return VK_ERROR_OUT_OF_HOST_MEMORY;
+  const size_t slot_size = DT_GRAPH_RING_SIZE / DT_GRAPH_RING_SLOTS;
+  const size_t row = dt_connector_channels(c) * dt_connector_bytes_per_pixel(c) * c->roi.wd;
+  const uint32_t bands = (ht + rows - 1) / rows;
+  for(int s=0;s<DT_GRAPH_RING_SLOTS;s++) QVKR(ring_acquire(graph, s));
+  uint32_t submitted = 0;
+  for(uint32_t b=0;b<bands;b++)
+  {
+    for(;submitted < bands && submitted < b + DT_GRAPH_RING_SLOTS;submitted++)
+      QVKR(ring_copy(graph, submitted % DT_GRAPH_RING_SLOTS, c,
+            y + submitted * rows, MIN(rows, ht - submitted * rows), 0,
+            graph->ring_buffer, (submitted % DT_GRAPH_RING_SLOTS) * slot_size, 0));
+    const int s = b % DT_GRAPH_RING_SLOTS;
+    QVKR(ring_acquire(graph, s));
+    memcpy(out + row * rows * b, graph->ring_mapped + s * slot_size,
+        row * MIN(rows, ht - b * rows));
+    if(mod && mod->so->write_rows)
+      mod->so->write_rows(mod, out, b * rows, MIN(rows, ht - b * rows));
+  }
+  return VK_SUCCESS;
+}
+
+// make room for a begin and an end timestamp for every node in each frame.
+// only called on structural runs, when no frame is in flight.
+static VkResult
+alloc_queries(dt_graph_t *graph)
+{
+  const uint32_t query_max = MAX(2, 2 * graph->num_nodes);
+  if(graph->query_pool && query_max <= graph->query_max) return VK_SUCCESS;
+  if(graph->query_pool) vkDestroyQueryPool(qvk.device, graph->query_pool, 0);
+  graph->query_max = query_max;
+  VkQueryPoolCreateInfo query_pool_info = {
+    .sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+    .queryType  = VK_QUERY_TYPE_TIMESTAMP,
+    .queryCount = graph->query_max * DT_GRAPH_MAX_FRAMES,
+  };
+  QVKR(vkCreateQueryPool(qvk.device, &query_pool_info, NULL, &graph->query_pool));
+  graph->query_pool_results = realloc(graph->query_pool_results, sizeof(uint64_t)*graph->query_max);
+  graph->query_node = realloc(graph->query_node, sizeof(int)*graph->query_max*DT_GRAPH_MAX_FRAMES);
+  return VK_SUCCESS;
+}
+
+// number of nodes before n which run the same kernel for the same module
+// instance. this tells the levels of a pyramid apart for the timings, and
+// stays the same when the nodes are recreated.
+static int
+node_perf_id(const dt_graph_t *graph, int n)
+{
+  const dt_node_t *node = graph->node + n;
+  int id = 0;
+  for(int m=0;m<n;m++)
+    if(graph->node[m].module == node->module &&
+       graph->node[m].name   == node->name &&
+       graph->node[m].kernel == node->kernel) id++;
+  return id;
+}
+
+// wait for a submitted frame, download its sinks and read the timestamps.
+static VkResult
+retire_frame(dt_graph_t *graph, int f)
+{
+  dt_graph_frame_t *frame = graph->frame + f;
+  if(!frame->pending) return VK_SUCCESS;
+  // timeout in nanoseconds, 30 is about 1s
+  QVKR(vkWaitForFences(qvk.device, 1, &frame->fence, VK_TRUE, 1ul<<40));
+  frame->pending = 0;
+
+  if(frame->run & s_graph_run_download_sink)
+  {
+    for(int n=0;n<graph->num_nodes;n++)
+    { // for all sink nodes:
+      dt_node_t *node = graph->node + n;
+      if(!dt_node_sink(node) || !node->module->so->write_sink) continue;
+      dt_connector_t *c = node->connector;
+      dt_connector_t *owner = image_owner(graph, node, 0);
+      if(!owner) continue;
+      const size_t row = dt_connector_channels(c) * dt_connector_bytes_per_pixel(c) * c->roi.wd;
+      if(graph->tile_cnt)
+      { // only a strip: copy it without the halo to the stitch buffer
+        const uint32_t ht = MIN(graph->tile_ht, c->roi.ht - graph->tile_oy);
+        QVKR(download_sink(graph, owner, graph->tile_oy, ht, graph->tile_buf + row * graph->tile_y, 0));
+        continue; // write once stitched
+      }
+      const size_t bufsize = dt_connector_bufsize(c);
+      if(graph->sink_buf_size < bufsize)
+      {
+        free(graph->sink_buf);
+        graph->sink_buf = malloc(bufsize);
+        graph->sink_buf_size = bufsize;
+      }
+      QVKR(download_sink(graph, owner, 0, c->roi.ht, graph->sink_buf, node->module));
+      node->module->so->write_sink(node->module, graph->sink_buf);
+    }
+  }
+
+  const uint32_t q0 = f * graph->query_max;
+  if(!frame->query_cnt) return VK_SUCCESS;
+  QVKR(vkGetQueryPoolResults(qvk.device, graph->query_pool,
+        q0, frame->query_cnt,
+        sizeof(graph->query_pool_results[0]) * graph->query_max,
+        graph->query_pool_results,
+        sizeof(graph->query_pool_results[0]),
+        VK_QUERY_RESULT_64_BIT));
+
+  const uint64_t *res = graph->query_pool_results;
+  uint64_t beg = res[0], end = res[1];
+  for(int i=0;i<frame->query_cnt;i+=2)
+  {
+    dt_node_t *node = graph->node + graph->query_node[q0+i];
+    const double ms = (res[i+1] - res[i]) * 1e-6 * qvk.ticks_to_nanoseconds;
+    uint64_t bytes_read = 0, bytes_written = 0;
+    for(int c=0;c<node->num_connectors;c++)
+    {
+      if(dt_connector_input (node->connector+c)) bytes_read    += dt_connector_bufsize(node->connector+c);
+      if(dt_connector_output(node->connector+c)) bytes_written += dt_connector_bufsize(node->connector+c);
+    }
+    dt_perf_add(&graph->perf, node->module->name, node->module->inst, node->name, node->kernel,
+        node_perf_id(graph, graph->query_node[q0+i]), ms, bytes_read, bytes_written);
+    beg = MIN(beg, res[i]);
+    end = MAX(end, res[i+1]);
+    dt_log(s_log_perf, "query %"PRItkn"_%"PRItkn":\t%8.2f ms",
+        dt_token_str(node->name),
+        dt_token_str(node->kernel), ms);
+  }
+  const double total = (end - beg) * 1e-6 * qvk.ticks_to_nanoseconds;
+  dt_perf_add_total(&graph->perf, total);
+  dt_log(s_log_perf, "total time:\t%8.2f ms", total);
+  return VK_SUCCESS;
+}
+
+// rows of overlap the strips need on the sink: the support of every module,
+// moved to the scale of the sink and summed up along the way from the
+// sources, largest over all ways. -1 if a module needs the whole image.
+// uses the rois of the run over the whole image.
+static int
+tile_halo(dt_graph_t *graph, int sink)
+{
+  int *acc = malloc(sizeof(int)*graph->num_modules);
+  for(int m=0;m<graph->num_modules;m++) acc[m] = 0;
+  const uint32_t sink_ht = graph->module[sink].connector[0].roi.ht;
+  dt_module_t *const arr = graph->module;
+  const int arr_cnt = graph->num_modules;
+#define TRAVERSE_POST\
+  int h = 0;\
+  for(int i=0;i<arr[curr].num_connectors;i++)\
+    if(dt_connector_input(arr[curr].connector+i) && arr[curr].connector[i].connected_mi >= 0)\
+    {\
+      const int in = acc[arr[curr].connector[i].connected_mi];\
+      h = h < 0 || in < 0 ? -1 : MAX(h, in);\
+    }\
+  const int own = arr[curr].so->halo ? arr[curr].so->halo(arr+curr) : 0;\
+  int out = dt_module_get_connector(arr+curr, dt_token("output"));\
+  if(out < 0) out = 0;\
+  const uint32_t ht = MAX(1, arr[curr].connector[out].roi.ht);\
+  acc[curr] = h < 0 || own < 0 ? -1 : h + (own * (uint64_t)sink_ht + ht - 1) / ht;
+#include "graph-traverse.inc"
+  const int halo = acc[sink];
+  free(acc);
+  return halo;
+}
+
+// out of memory: cut the sink roi into horizontal strips, bisect until one
+// strip fits into the budget and then run the whole graph once per strip.
+static VkResult
+graph_run_tiled(
+    dt_graph_t   *graph,
+    int           sink,
+    VkDeviceSize  budget)
+{
+  dt_module_t *mod = graph->module + sink;
+  const dt_roi_t roi = mod->connector[0].roi; // full roi requested by the sink
+  const int halo = tile_halo(graph, sink);
+  if(halo < 0)
+  {
+    dt_log(s_log_err|s_log_pipe, "graph does not fit into %g MB and can't be cut into strips!",
+        budget/(1024.0*1024.0));
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  graph->tile_halo = halo;
+  for(graph->tile_cnt=2;;graph->tile_cnt*=2)
+  {
+    graph->tile_ht = (roi.ht + graph->tile_cnt - 1) / graph->tile_cnt;
+    graph->tile_ht = (graph->tile_ht + DT_GRAPH_TILE_ALIGN - 1) / DT_GRAPH_TILE_ALIGN * DT_GRAPH_TILE_ALIGN;
+    // plan an inner strip, these carry the halo on both sides:
+    graph->tile_y = graph->tile_cnt > 2 ? graph->tile_ht : 0;
+    VkResult err = graph_plan(graph, s_graph_run_all);
+    if(err != VK_SUCCESS) { graph->tile_cnt = 0; return err; }
+    if(graph->heap.vmsize <= budget) break;
+    if(graph->tile_ht <= DT_GRAPH_TILE_ALIGN)
+    {
+      dt_log(s_log_err|s_log_pipe, "graph does not fit into %g MB even when tiled!",
+          budget/(1024.0*1024.0));
+      graph->tile_cnt = 0;
+      return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+  }
+  dt_log(s_log_pipe, "running graph in %d strips of %d rows, budget %g MB",
+      (roi.ht + graph->tile_ht - 1) / graph->tile_ht, graph->tile_ht,
+      budget/(1024.0*1024.0));
+
+  // the strips are stitched in the rows of the sink node, which may be packed
+  // to a different width and format than the module's connector (see
+  // dt_api_sink_pack()). the planned strip has the width of the full image:
+  size_t bufsize = dt_connector_bufsize(mod->connector);
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    const dt_connector_t *c = graph->node[n].connector;
+    if(graph->node[n].module == mod && dt_node_sink(graph->node+n))
+      bufsize = dt_connector_channels(c) * dt_connector_bytes_per_pixel(c) * c->roi.wd * (size_t)roi.ht;
+  }
+  if(graph->tile_buf_size < bufsize)
+  {
+    free(graph->tile_buf);
+    graph->tile_buf = malloc(bufsize);
+    graph->tile_buf_size = bufsize;
+  }
+
+  VkResult err = VK_SUCCESS;
+  for(graph->tile_y=0;graph->tile_y<roi.ht;graph->tile_y+=graph->tile_ht)
+    if((err = dt_graph_run(graph, s_graph_run_all)) != VK_SUCCESS) break;
+  graph->tile_cnt = 0;
+
+  // write the stitched image with the full roi:
+  mod->connector[0].roi = roi;
+  if(err == VK_SUCCESS)
+    mod->so->write_sink(mod, graph->tile_buf);
+  // the nodes are set up for the last strip only, start over next time:
+  graph->runflags = s_graph_run_all;
+  return err;
+}
+
+VkResult dt_graph_run(
+    dt_graph_t     *graph,
+    dt_graph_run_t  run)
+{
+  // can be only one output sink node that determines ROI. but we can totally
+  // have more than one sink to pull in nodes for. we have to execute some of
+  // this multiple times. also we have a marker on nodes/modules that we
+  // already traversed. there might also be cycles on the module level.
+
+  // new output rois without request to recreate the nodes, such as a new
+  // source image: this may decode the image on the cpu. it only touches the
+  // modules, so the device can still be busy with the frames in flight. if
+  // the dimensions are the same as before, keep nodes, images and pipelines.
+  if((run & s_graph_run_roi_out) && !(run & s_graph_run_create_nodes))
+  {
+    run &= ~s_graph_run_roi_out;
+    if(graph_roi_out(graph))
+      run |= (s_graph_run_structure & ~s_graph_run_roi_out) | s_graph_run_record_cmd_buf;
+    else for(int m=0;m<graph->num_modules;m++) // image params may still differ
+      graph->module[m].flags |= s_module_request_commit_params;
   }
 
-  if(graph->vkmem_uniform_size < graph->uniform_size)
+  // the images and memory are shared by all frames in flight, wait for them
+  // before changing anything. also make sure the slot we're going to use is
+  // free again:
+  if(run & s_graph_run_structure)
   {
-    if(graph->vkmem_uniform) vkFreeMemory(qvk.device, graph->vkmem_uniform, 0);
+    QVKR(dt_graph_wait(graph));
+    for(int f=0;f<DT_GRAPH_MAX_FRAMES;f++) graph->frame[f].recorded = 0;
+  }
+  QVKR(retire_frame(graph, graph->frame_curr));
+
+  QVKR(graph_plan(graph, run));
+
+  if((run & s_graph_run_alloc_free) && !graph->tile_cnt)
+  { // our old range and the unused parts of the shared memory are ours to take:
+    const uint32_t type = qvk_get_memory_type(graph->memory_type_bits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    const VkDeviceSize budget = graph->vkmem.size + qvk_get_memory_budget(type) +
+      dt_devmem_available(&dt_pipe.devmem, type);
+    if(graph->heap.vmsize > budget)
+    {
+      const int sink = tile_sink(graph);
+      if(sink >= 0) return graph_run_tiled(graph, sink, budget);
+      dt_log(s_log_pipe, "graph exceeds memory budget of %g MB but has no sink to tile, trying anyways",
+          budget/(1024.0*1024.0));
+    }
+  }
+
+  if(run & s_graph_run_create_nodes)
+    QVKR(alloc_queries(graph));
+
+  int dirty = 0; // anything to run at all?
+  dt_graph_frame_t *frame = graph->frame + graph->frame_curr;
+
+{ // node scope
+  dt_node_t *const arr = graph->node;
+  const int arr_cnt = graph->num_nodes;
+
+  if(graph->heap.vmsize > graph->vkmem.size)
+  { // image data to pass between nodes
+    QVKR(dt_devmem_alloc(&dt_pipe.devmem, &graph->vkmem, graph->heap.vmsize,
+          qvk_get_memory_type(graph->memory_type_bits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)));
+    dt_log(s_log_pipe, "[graph] %g MB of device memory, %g/%g MB used/allocated by all graphs",
+        (graph->vkmem.size + graph->vkmem_uniform.size + graph->vkmem_ring.size)/(1024.0*1024.0),
+        dt_pipe.devmem.used/(1024.0*1024.0), dt_pipe.devmem.allocated/(1024.0*1024.0));
+  }
+
+  // the dynamic offset binds uniform_range bytes, make sure the last slice
+  // does not read past the end of the buffer. every frame in flight has its
+  // own copy of all slices:
+  graph->uniform_stride = align_uniform(graph->uniform_size + graph->uniform_range);
+  const uint32_t uniform_buffer_size = graph->uniform_stride * DT_GRAPH_MAX_FRAMES;
+  if(!graph->uniform_buffer || graph->uniform_buffer_size < uniform_buffer_size)
+  {
+    if(graph->uniform_buffer) vkDestroyBuffer(qvk.device, graph->uniform_buffer, 0);
     // uniform data to pass parameters
     VkBufferCreateInfo buffer_info = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-      .size = graph->uniform_size,
-      .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+      .size = uniform_buffer_size,
+      .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
     QVKR(vkCreateBuffer(qvk.device, &buffer_info, 0, &graph->uniform_buffer));
     VkMemoryRequirements mem_req;
     vkGetBufferMemoryRequirements(qvk.device, graph->uniform_buffer, &mem_req);
-    VkMemoryAllocateInfo mem_alloc_info_uniform = {
-      .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .allocationSize  = graph->uniform_size,
-      .memoryTypeIndex = qvk_get_memory_type(mem_req.memoryTypeBits,
-          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
-    };
-    QVKR(vkAllocateMemory(qvk.device, &mem_alloc_info_uniform, 0, &graph->vkmem_uniform));
-    graph->vkmem_uniform_size = graph->uniform_size;
-    vkBindBufferMemory(qvk.device, graph->uniform_buffer, graph->vkmem_uniform, 0);
+    QVKR(dt_devmem_alloc(&dt_pipe.devmem, &graph->vkmem_uniform, mem_req.size,
+          qvk_get_memory_type(mem_req.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)));
+    graph->uniform_buffer_size = uniform_buffer_size;
+    vkBindBufferMemory(qvk.device, graph->uniform_buffer,
+        graph->vkmem_uniform.mem, graph->vkmem_uniform.offset);
+    // the shared block stays mapped, host coherent:
+    graph->uniform_mapped = graph->vkmem_uniform.mapped;
   }
 
   if(run & s_graph_run_alloc_dset)
@@ -1210,7 +1984,7 @@ VkResult dt_graph_run(
         .type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
         .descriptorCount = 1+graph->dset_cnt_buffer,
       }, {
-        .type            = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        .type            = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
         .descriptorCount = 1+graph->dset_cnt_uniform,
       }};
 
@@ -1230,72 +2004,113 @@ VkResult dt_graph_run(
       QVKR(vkCreateDescriptorPool(qvk.device, &pool_info, 0, &graph->dset_pool));
     }
 
-    // uniform descriptor
-    VkDescriptorSetAllocateInfo dset_info = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-      .descriptorPool = graph->dset_pool,
-      .descriptorSetCount = 1,
-      .pSetLayouts = &graph->uniform_dset_layout,
-    };
-    QVKR(vkAllocateDescriptorSets(qvk.device, &dset_info, &graph->uniform_dset));
-    VkDescriptorBufferInfo uniform_info = {
-      .buffer      = graph->uniform_buffer,
-      .range       = VK_WHOLE_SIZE,
-    };
-    VkWriteDescriptorSet buf_dset = {
-      .sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet          = graph->uniform_dset,
-      .dstBinding      = 0,
-      .dstArrayElement = 0,
-      .descriptorCount = 1,
-      .descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-      .pBufferInfo     = &uniform_info,
-    };
-    vkUpdateDescriptorSets(qvk.device, 1, &buf_dset, 0, NULL);
+    // uniform descriptor, one per frame pointing to its copy of the slices
+    VkDescriptorSetLayout uniform_dset_layout = dt_pipe_uniform_dset_layout();
+    for(int f=0;f<DT_GRAPH_MAX_FRAMES;f++)
+    {
+      VkDescriptorSetAllocateInfo dset_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = graph->dset_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &uniform_dset_layout,
+      };
+      QVKR(vkAllocateDescriptorSets(qvk.device, &dset_info, &graph->frame[f].uniform_dset));
+      VkDescriptorBufferInfo uniform_info = {
+        .buffer      = graph->uniform_buffer,
+        .offset      = f * graph->uniform_stride,
+        .range       = graph->uniform_range,
+      };
+      VkWriteDescriptorSet buf_dset = {
+        .sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet          = graph->frame[f].uniform_dset,
+        .dstBinding      = 0,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .pBufferInfo     = &uniform_info,
+      };
+      vkUpdateDescriptorSets(qvk.device, 1, &buf_dset, 0, NULL);
+    }
   }
 
-  // not really needed, vkBeginCommandBuffer will reset our cmd buf
-  // vkResetCommandPool(qvk.device, graph->command_pool, 0);
-
-  // begin command buffer
-  VkCommandBufferBeginInfo begin_info = {
-    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-    // VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT would allow simultaneous execution while still pending.
-    // not sure about our images, i suppose they will need sync/double buffering in this case
-  };
-  QVKR(vkBeginCommandBuffer(graph->command_buffer, &begin_info));
-  vkCmdResetQueryPool(graph->command_buffer, graph->query_pool, 0, graph->query_max);
+  // ==============================================
+  // 2nd pass finish alloc and record commmand buf
+  // ==============================================
+  if(run & s_graph_run_alloc_dset)
+  {
+#define TRAVERSE_POST\
+    QVKR(alloc_outputs2(graph, arr+curr));
+#define TRAVERSE_EDGE_BEG graph->edge_beg
+#define TRAVERSE_EDGE     graph->edge
+#include "graph-traverse.inc"
+  }
 
-  // upload all source data to staging memory
+  // stream the source data to the now bound images
   if(run & s_graph_run_upload_source)
   {
-    uint8_t *mapped = 0;
-    QVKR(vkMapMemory(qvk.device, graph->vkmem_staging, 0, VK_WHOLE_SIZE, 0, (void**)&mapped));
     for(int n=0;n<graph->num_nodes;n++)
     { // for all source nodes:
       dt_node_t *node = graph->node + n;
       if(dt_node_source(node))
       {
         if(node->module->so->read_source)
-          node->module->so->read_source(node->module,
-              mapped + node->connector[0].offset_staging);
+          QVKR(upload_source(graph, node));
         else
           dt_log(s_log_err|s_log_pipe, "source node '%"PRItkn"' has no read_source() callback!",
               dt_token_str(node->name));
       }
     }
-    vkUnmapMemory(qvk.device, graph->vkmem_staging);
   }
 
-  // ==============================================
-  // 2nd pass finish alloc and record commmand buf
-  // ==============================================
-  int runflag = (run & s_graph_run_upload_source) ? 1 : 0;
+  // find out what needs to run. the command buffer this frame has been
+  // recorded with last time can be resubmitted as long as the same nodes are
+  // dirty: params and rois are read from the persistently mapped uniform
+  // buffer, only push constants are baked into it.
+  mark_dirty(graph, run);
+  uint64_t signature = DT_HASH_INIT;
+  for(int n=0;n<graph->num_nodes;n++)
+  {
+    dt_node_t *node = graph->node + n;
+    if(!(node->module->flags & s_module_dirty)) continue;
+    dirty = 1;
+    signature = dt_hash(signature, &n, sizeof(n));
+    signature = dt_hash(signature, node->push_constant, node->push_constant_size);
+    write_uniforms(graph, node);
+  }
+
+  if((run & s_graph_run_record_cmd_buf) || frame->recorded != signature)
+  {
+    // not really needed, vkBeginCommandBuffer will reset our cmd buf
+    // vkResetCommandPool(qvk.device, graph->command_pool, 0);
+
+    // begin command buffer. no one time submit: we'll resubmit it as long as
+    // only params change.
+    VkCommandBufferBeginInfo begin_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      // VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT would allow simultaneous execution while still pending.
+      // not sure about our images, i suppose they will need sync/double buffering in this case
+    };
+    QVKR(vkBeginCommandBuffer(frame->command_buffer, &begin_info));
+    vkCmdResetQueryPool(frame->command_buffer, graph->query_pool,
+        graph->frame_curr * graph->query_max, graph->query_max);
+    frame->query_cnt = 0;
+
+    // group nodes into dependency levels, unreachable nodes stay at -1:
+    for(int n=0;n<graph->num_nodes;n++) graph->node[n].level = -1;
 #define TRAVERSE_POST\
-  if(run & s_graph_run_alloc_dset)     QVKR(alloc_outputs2(graph, arr+curr));\
-  if(run & s_graph_run_record_cmd_buf) QVKR(record_command_buffer(graph, arr+curr, &runflag));
+    schedule_level(graph, arr+curr);
+#define TRAVERSE_EDGE_BEG graph->edge_beg
+#define TRAVERSE_EDGE     graph->edge
 #include "graph-traverse.inc"
+    int num_levels = 0;
+    for(int n=0;n<graph->num_nodes;n++)
+      num_levels = MAX(num_levels, graph->node[n].level + 1);
+    for(int l=0;l<num_levels;l++)
+      QVKR(record_level(graph, l));
+    record_finish(graph);
+    QVKR(vkEndCommandBuffer(frame->command_buffer));
+    frame->recorded = signature;
+  }
 
 } // end scope, done with nodes
 
@@ -1305,67 +2120,92 @@ VkResult dt_graph_run(
         graph->heap.peak_rss/(1024.0*1024.0),
         graph->heap.vmsize  /(1024.0*1024.0));
 
-    dt_log(s_log_pipe, "staging: peak rss %g MB vmsize %g MB",
-        graph->heap_staging.peak_rss/(1024.0*1024.0),
-        graph->heap_staging.vmsize  /(1024.0*1024.0));
+    dt_log(s_log_pipe, "staging: ring of %d x %g MB",
+        DT_GRAPH_RING_SLOTS, DT_GRAPH_RING_SIZE/DT_GRAPH_RING_SLOTS/(1024.0*1024.0));
   }
 
-  QVKR(vkEndCommandBuffer(graph->command_buffer));
+  // reset run flags:
+  graph->runflags = 0;
+  for(int m=0;m<graph->num_modules;m++)
+    graph->module[m].flags = s_module_request_none;
+
+  // nothing to do if all outputs are still valid from last time. in
+  // particular, the sinks have been written when that frame was retired.
+  if(!dirty) return VK_SUCCESS;
+
+  // the sinks are downloaded when their frame is retired. this one would
+  // overwrite them, so the frames in flight need to be done first:
+  for(int i=1;i<DT_GRAPH_MAX_FRAMES;i++)
+  {
+    const int f = (graph->frame_curr + i) % DT_GRAPH_MAX_FRAMES;
+    if(graph->frame[f].pending && (graph->frame[f].run & s_graph_run_download_sink))
+      QVKR(retire_frame(graph, f));
+  }
 
   VkSubmitInfo submit = {
     .sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
     .commandBufferCount = 1,
-    .pCommandBuffers    = &graph->command_buffer,
+    .pCommandBuffers    = &frame->command_buffer,
   };
 
-  vkResetFences(qvk.device, 1, &graph->command_fence);
-  QVKR(vkQueueSubmit(qvk.queue_compute, 1, &submit, graph->command_fence));
-  if(run & s_graph_run_wait_done) // timeout in nanoseconds, 30 is about 1s
-    QVKR(vkWaitForFences(qvk.device, 1, &graph->command_fence, VK_TRUE, 1ul<<40));
-  
-  if(run & s_graph_run_download_sink)
+  vkResetFences(qvk.device, 1, &frame->fence);
+  QVKR(vkQueueSubmit(qvk.queue_compute, 1, &submit, frame->fence));
+  frame->run     = run;
+  frame->pending = 1;
+  const int f = graph->frame_curr;
+  graph->frame_curr = (graph->frame_curr + 1) % DT_GRAPH_MAX_FRAMES;
+  if(run & s_graph_run_wait_done)
+    return retire_frame(graph, f);
+  return VK_SUCCESS;
+}
+
+VkResult
+dt_graph_poll(dt_graph_t *graph)
+{
+  // the oldest frame comes next in the ring, retire in submission order:
+  for(int i=0;i<DT_GRAPH_MAX_FRAMES;i++)
   {
-    for(int n=0;n<graph->num_nodes;n++)
-    { // for all sink nodes:
-      dt_node_t *node = graph->node + n;
-      if(dt_node_sink(node))
-      {
-        if(node->module->so->write_sink)
-        {
-          uint8_t *mapped = 0;
-          QVKR(vkMapMemory(qvk.device, graph->vkmem_staging, 0, VK_WHOLE_SIZE,
-                0, (void**)&mapped));
-          node->module->so->write_sink(node->module,
-              mapped + node->connector[0].offset_staging);
-          vkUnmapMemory(qvk.device, graph->vkmem_staging);
-        }
-      }
-    }
+    const int f = (graph->frame_curr + i) % DT_GRAPH_MAX_FRAMES;
+    if(!graph->frame[f].pending) continue;
+    if(vkGetFenceStatus(qvk.device, graph->frame[f].fence) != VK_SUCCESS)
+      return VK_NOT_READY;
+    QVKR(retire_frame(graph, f));
   }
+  return VK_SUCCESS;
+}
 
-  QVKR(vkGetQueryPoolResults(qvk.device, graph->query_pool,
-        0, graph->query_cnt,
-        sizeof(graph->query_pool_results[0]) * graph->query_max,
-        graph->query_pool_results,
-        sizeof(graph->query_pool_results[0]),
-        VK_QUERY_RESULT_64_BIT));
-
-  for(int i=0;i<graph->query_cnt;i+=2)
+VkResult
+dt_graph_wait_frames(dt_graph_t *graph, int max_pending)
+{
+  int pending = 0;
+  for(int f=0;f<DT_GRAPH_MAX_FRAMES;f++)
+    pending += graph->frame[f].pending;
+  // retire the oldest first:
+  for(int i=0;i<DT_GRAPH_MAX_FRAMES && pending > max_pending;i++)
   {
-    dt_log(s_log_perf, "query %"PRItkn"_%"PRItkn":\t%8.2f ms",
-        dt_token_str(graph->query_name  [i]),
-        dt_token_str(graph->query_kernel[i]),
-        (graph->query_pool_results[i+1]-
-        graph->query_pool_results[i])* 1e-6 * qvk.ticks_to_nanoseconds);
-  }
-  if(graph->query_cnt)
-    dt_log(s_log_perf, "total time:\t%8.2f ms",
-        (graph->query_pool_results[graph->query_cnt-1]-graph->query_pool_results[0])*1e-6 * qvk.ticks_to_nanoseconds);
-  // reset run flags:
-  graph->runflags = 0;
+    const int f = (graph->frame_curr + i) % DT_GRAPH_MAX_FRAMES;
+    if(!graph->frame[f].pending) continue;
+    QVKR(retire_frame(graph, f));
+    pending--;
+  }
   return VK_SUCCESS;
 }
 
+VkResult
+dt_graph_wait(dt_graph_t *graph)
+{
+  return dt_graph_wait_frames(graph, 0);
+}
+
+void
+dt_graph_module_params_changed(
+    dt_graph_t *g,
+    int         modid)
+{
+  if(modid < 0 || modid >= g->num_modules) return;
+  g->module[modid].flags |= s_module_request_commit_params;
+}
+
 dt_node_t *
 dt_graph_get_display(
     dt_graph_t *g,
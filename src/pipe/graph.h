@@ -2,19 +2,24 @@
 #include "node.h"
 #include "module.h"
 #include "alloc.h"
+#include "devmem.h"
+#include "perf.h"
+#include "plan.h"
+
+#include <stdlib.h>
 
 typedef enum dt_graph_run_t
 {
   // TODO: annotate what affects vk and what doesn't?
   s_graph_run_none           = 0,
-  s_graph_run_roi_out        = 1<<0, // pass 1: recompute output roi
+  s_graph_run_roi_out        = 1<<0, // pass 1: recompute output roi, without create_nodes keep the nodes if the sizes match
   s_graph_run_roi_in         = 1<<1, // pass 2: recompute input roi requests
   s_graph_run_create_nodes   = 1<<2, // pass 2: create nodes from modules
   // TODO: create pipeline + descriptor set layout
   // TODO: allocate images
   s_graph_run_alloc_free     = 1<<3, // pass 3: alloc and free images TODO: only alloc/free heap
   s_graph_run_alloc_dset     = 1<<4, // pass 4: alloc descriptor sets and imageviews
-  s_graph_run_record_cmd_buf = 1<<5, // pass 4: record command buffer
+  s_graph_run_record_cmd_buf = 1<<5, // pass 4: force re-recording the command buffer
   s_graph_run_upload_source  = 1<<6, // final : upload new source image
   s_graph_run_download_sink  = 1<<7, // final : download sink images
   s_graph_run_wait_done      = 1<<8, // wait for fence
@@ -22,10 +27,44 @@ typedef enum dt_graph_run_t
 }
 dt_graph_run_t;
 
+// these change the structure of the graph (nodes, images, descriptor sets).
+// a run without any of them is a parameter-only run which keeps all vulkan
+// resources alive and only re-commits params of flagged modules.
+#define s_graph_run_structure (s_graph_run_roi_out | s_graph_run_roi_in\
+    | s_graph_run_create_nodes | s_graph_run_alloc_free | s_graph_run_alloc_dset)
+
+// strips start on multiples of this, to keep bayer and x-trans phase intact
+#define DT_GRAPH_TILE_ALIGN 6
+
+// number of submissions which can be in flight for one graph at a time
+#define DT_GRAPH_MAX_FRAMES 2
+
+// host visible memory to stream sources and sinks through, independent of the
+// image size. it is cut into slots which are filled and copied in row bands.
+#define DT_GRAPH_RING_SIZE (64ul<<20)
+#define DT_GRAPH_RING_SLOTS 4
+
+// one slot in the ring of submissions of a graph. every slot has its own
+// command buffer, fence, and slice of the uniform memory, so the host can
+// prepare the next frame while the device still works on this one.
+typedef struct dt_graph_frame_t
+{
+  VkCommandBuffer       command_buffer;
+  VkFence               fence;
+  VkDescriptorSet       uniform_dset;   // bound to our slice of the uniform buffer
+  uint64_t              recorded;       // signature of the recorded commands, 0 if stale
+  dt_graph_run_t        run;            // flags this frame has been submitted with
+  int                   pending;        // submitted but not retired yet
+  uint32_t              query_cnt;      // timestamps recorded into our range of the pool
+}
+dt_graph_frame_t;
+
 // the graph is stored as list of modules and list of nodes.
 // these have connectors with detailed buffer information which
 // also hold the id to the other connected module or node. thus,
-// there is no need for an explicit list of connections.
+// there is no need for an explicit list of connections. for traversal,
+// the node inputs are condensed into an edge list once the nodes exist.
+// both lists grow as needed, modules and nodes are referred to by index.
 //
 // one graph is run by one thread, so it encapsulates all necessary
 // multithreading things for the vulkan backend (has it's own command pool for
@@ -34,9 +73,16 @@ typedef struct dt_graph_t
 {
   dt_module_t *module;
   uint32_t num_modules, max_modules;
+  int     *module_hash;      // open addressing (name, inst) -> module id, or -1
+  uint32_t module_hash_size; // power of two
+  uint32_t module_hash_cnt;  // used slots, including removed modules
 
   dt_node_t *node;
   uint32_t num_nodes, max_nodes;
+  int     *edge_beg;         // inputs of node n are edge[edge_beg[n]..edge_beg[n+1])
+  int     *edge;             // node connected to the input
+  uint8_t *traverse_scratch; // stack and marks of graph-traverse.inc, grown on demand
+  size_t   traverse_scratch_size;
 
   // memory pool for node params. this is a simple allocator that increments
   // the end pointer until it is flushed completely.
@@ -46,39 +92,58 @@ typedef struct dt_graph_t
   // TODO: also store full history somewhere
 
   dt_vkalloc_t          heap;           // allocator for device buffers and images
-  dt_vkalloc_t          heap_staging;   // used for staging memory, which has different flags
+  dt_plan_buf_t        *plan;           // live ranges of all node outputs in the traversal
+  int                   plan_cnt, plan_max;
+  int                   plan_step;      // current node in the traversal
 
   uint32_t              memory_type_bits;
-  uint32_t              memory_type_bits_staging;
-  VkDeviceMemory        vkmem;
-  VkDeviceMemory        vkmem_staging;
+  dt_devmem_t           vkmem;          // range of the shared device memory holding the heap
   VkDescriptorPool      dset_pool;
-  VkCommandBuffer       command_buffer; // we might have may buffers to interleave them (thumbnails?)
-  VkCommandPool         command_pool;   // but we definitely need one pool for ourselves (our thread)
-  VkFence               command_fence;  // one per command buffer
-
-  VkBuffer              uniform_buffer; // uniform buffer shared between all nodes
-  VkDeviceMemory        vkmem_uniform;
-  uint32_t              uniform_size;
-  VkDescriptorSetLayout uniform_dset_layout;
-  VkDescriptorSet       uniform_dset;
-
-  size_t                vkmem_size;
-  size_t                vkmem_staging_size;
-  size_t                vkmem_uniform_size;
-
-  uint32_t              query_max;
-  uint32_t              query_cnt;
+  VkCommandPool         command_pool;   // we definitely need one pool for ourselves (our thread)
+  dt_graph_frame_t      frame[DT_GRAPH_MAX_FRAMES]; // ring of command buffers in flight
+  uint32_t              frame_curr;     // the slot recorded and submitted next
+  uint64_t              roi_hash;       // full output sizes and image params of all modules
+
+  VkBuffer              uniform_buffer; // uniform buffer, every node has its own slice
+  dt_devmem_t           vkmem_uniform;
+  uint8_t              *uniform_mapped; // persistently mapped host pointer
+  uint32_t              uniform_size;   // size of all slices
+  uint32_t              uniform_range;  // max size of one slice, bound with dynamic offset
+  uint32_t              uniform_stride; // distance between the frames' copies of all slices
+  uint32_t              uniform_buffer_size;
+
+  VkBuffer              ring_buffer;    // staging ring, persistently mapped
+  dt_devmem_t           vkmem_ring;
+  uint8_t              *ring_mapped;
+  VkCommandBuffer       ring_cmd[DT_GRAPH_RING_SLOTS];   // band copy of every slot
+  VkFence               ring_fence[DT_GRAPH_RING_SLOTS];
+  int                   ring_pending[DT_GRAPH_RING_SLOTS];
+  uint32_t              ring_curr;      // the slot filled next
+  uint8_t              *sink_buf;       // host copy of a sink passed to write_sink()
+  size_t                sink_buf_size;
+
+  uint32_t              query_max;      // per frame, the pool holds all frames. grows with the nodes
   VkQueryPool           query_pool;
   uint64_t             *query_pool_results;
-  dt_token_t           *query_name;
-  dt_token_t           *query_kernel;
+  int                  *query_node;     // node index for every begin query
+  dt_perf_t             perf;           // rolling timings of the retired frames
 
   uint32_t              dset_cnt_image_read;
   uint32_t              dset_cnt_image_write;
   uint32_t              dset_cnt_buffer;
   uint32_t              dset_cnt_uniform;
 
+  // out of core: if the graph does not fit into the device memory budget,
+  // the sink roi is cut into horizontal strips which are processed one after
+  // the other and stitched together on the host.
+  uint32_t              tile_cnt;      // number of strips while tiling, 0 otherwise
+  uint32_t              tile_y;        // first row of the current strip on the sink
+  uint32_t              tile_ht;       // rows per strip, without halo
+  uint32_t              tile_halo;     // rows requested above and below each strip
+  uint32_t              tile_oy;       // halo rows actually above the current strip
+  uint8_t              *tile_buf;      // host buffer the strips are stitched into
+  size_t                tile_buf_size;
+
   dt_graph_run_t        runflags;      // used to trigger next runflags/invalidate things
 }
 dt_graph_t;
@@ -86,12 +151,45 @@ dt_graph_t;
 void dt_graph_init(dt_graph_t *g);
 void dt_graph_cleanup(dt_graph_t *g);
 
+// append a node to the graph and return its id. this is for create_nodes()
+// callbacks. the node array may move, so don't hold on to node pointers
+// across calls.
+static inline int
+dt_node_add(dt_graph_t *graph)
+{
+  if(graph->num_nodes == graph->max_nodes)
+  {
+    graph->max_nodes *= 2;
+    graph->node = (dt_node_t *)realloc(graph->node, sizeof(dt_node_t)*graph->max_nodes);
+  }
+  return graph->num_nodes++;
+}
+
 dt_node_t *dt_graph_get_display(dt_graph_t *g, dt_token_t  which);
 
+// notify the graph that only the param block of the given module changed.
+// the next dt_graph_run() will then re-commit params for this module and
+// resubmit the command buffer, without recreating nodes or reallocating.
+void dt_graph_module_params_changed(dt_graph_t *g, int modid);
+
+// record (if needed) and submit the graph. with s_graph_run_wait_done this
+// blocks until the results are there. without, it returns after submission
+// and the sinks will be written once the frame is retired by a later
+// dt_graph_run(), dt_graph_poll() or dt_graph_wait().
 VkResult dt_graph_run(
     dt_graph_t     *graph,
     dt_graph_run_t  run);
 
+// retire all frames the device is done with, without blocking. returns
+// VK_NOT_READY if some are still in flight.
+VkResult dt_graph_poll(dt_graph_t *graph);
+
+// block until all frames in flight are done and retire them.
+VkResult dt_graph_wait(dt_graph_t *graph);
+
+// retire the oldest frames, blocking, until at most max_pending are in flight.
+VkResult dt_graph_wait_frames(dt_graph_t *graph, int max_pending);
+
 void dt_token_print(dt_token_t t);
 
 VkResult dt_graph_create_shader_module(
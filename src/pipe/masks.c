@@ -190,8 +190,9 @@ dt_masks_record_draw(
     .pClearValues      = &clear_color
   };
 
+  dt_graph_frame_t *frame = graph->frame + graph->frame_curr;
   VkDescriptorSet desc_sets[] = {
-    graph->uniform_dset,
+    frame->uniform_dset,
     node->dset,
   };
 
@@ -200,13 +201,13 @@ dt_masks_record_draw(
   const int pi = dt_module_get_param(node->module->so, dt_token("draw"));
   const float *p_draw = dt_module_param_float(node->module, pi);
 
-  VkCommandBuffer cmd_buf = graph->command_buffer;
+  VkCommandBuffer cmd_buf = frame->command_buffer;
 
   vkCmdBeginRenderPass(cmd_buf, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
   vkCmdBindDescriptorSets(cmd_buf,
       VK_PIPELINE_BIND_POINT_GRAPHICS,
       node->pipeline_layout,
-      0, LENGTH(desc_sets), desc_sets, 0, 0);
+      0, LENGTH(desc_sets), desc_sets, 1, &node->uniform_offset);
   vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, node->pipeline);
   // vert count, instance count, first vert, first instance
   vkCmdDraw(cmd_buf, p_draw[0], 1, 0, 0);
@@ -1,75 +1,128 @@
 #include "module.h"
 #include "graph.h"
+#include "core/core.h"
 #include "core/log.h"
 
+static inline uint32_t
+module_hash(dt_token_t name, dt_token_t inst)
+{
+  const dt_token_t key[] = { name, inst };
+  return dt_hash(DT_HASH_INIT, key, sizeof(key));
+}
+
+static void
+module_hash_insert(dt_graph_t *graph, int modid)
+{
+  const uint32_t mask = graph->module_hash_size - 1;
+  uint32_t h = module_hash(graph->module[modid].name, graph->module[modid].inst) & mask;
+  while(graph->module_hash[h] >= 0) h = (h + 1) & mask;
+  graph->module_hash[h] = modid;
+  graph->module_hash_cnt++;
+}
+
+// rehash all live modules into a table at most half full. this also drops
+// the slots of removed modules.
+static void
+module_hash_rebuild(dt_graph_t *graph)
+{
+  uint32_t size = 64;
+  while(size < 4*graph->num_modules) size *= 2;
+  if(size != graph->module_hash_size)
+  {
+    free(graph->module_hash);
+    graph->module_hash = malloc(sizeof(int)*size);
+    graph->module_hash_size = size;
+  }
+  memset(graph->module_hash, 0xff, sizeof(int)*size); // all -1
+  graph->module_hash_cnt = 0;
+  for(int m=0;m<graph->num_modules;m++)
+    if(graph->module[m].name) module_hash_insert(graph, m);
+}
+
 // this is a public api function
 int dt_module_add(
     dt_graph_t *graph,
     dt_token_t name,
     dt_token_t inst)
 {
-  // add to graph's list
-  // make sure we have enough memory, realloc if not
-  if(graph->num_modules >= graph->max_modules-1)
+  dt_module_so_t *so = dt_pipe_get_module(name);
+  if(!so)
   {
-    assert(0 && "TODO: realloc module graph arrays");
+    dt_log(s_log_pipe|s_log_err, "no such module %"PRItkn"!", dt_token_str(name));
     return -1;
   }
+  if(so->num_connectors == 0)
+  { // nothing to connect, fail
+    dt_log(s_log_pipe|s_log_err, "module %"PRItkn" has no connectors!", dt_token_str(name));
+    return -1;
+  }
+
+  // add to graph's list, make sure we have enough memory:
+  if(graph->num_modules == graph->max_modules)
+  {
+    dt_module_t *old = graph->module;
+    graph->max_modules *= 2;
+    graph->module = realloc(graph->module, sizeof(dt_module_t)*graph->max_modules);
+    for(int n=0;n<graph->num_nodes;n++) // point the nodes to the moved modules
+      graph->node[n].module = graph->module + (graph->node[n].module - old);
+  }
   const int modid = graph->num_modules++;
 
   dt_module_t *mod = graph->module + modid;
+  mod->so = so;
   mod->name = name;
   mod->inst = inst;
   mod->data = 0;
+  mod->flags = s_module_request_none;
 
-  // copy over initial info from module class:
-  for(int i=0;i<dt_pipe.num_modules;i++)
-  { // TODO: speed this up somehow?
-    if(name == dt_pipe.module[i].name)
-    {
-      mod->so = dt_pipe.module + i;
-      // init params:
-      mod->param_size = 0;
-      if(mod->so->num_params)
-      {
-        dt_ui_param_t *p = mod->so->param[mod->so->num_params-1];
-        mod->param_size = p->offset + dt_ui_param_size(p->type, p->cnt);
-        mod->param = graph->params_pool + graph->params_end;
-        graph->params_end += mod->param_size;
-        assert(graph->params_end <= graph->params_max);
-      }
-      for(int p=0;p<mod->so->num_params;p++)
-      { // init default params
-        dt_ui_param_t *pp = mod->so->param[p];
-        memcpy(mod->param + pp->offset, pp->val, dt_ui_param_size(pp->type, pp->cnt));
-      }
-      for(int c=0;c<mod->so->num_connectors;c++)
-      { // init connectors from our module class:
-        mod->connector[c] = mod->so->connector[c];
-        dt_connector_t *cn = mod->connector+c;
-        cn->mem = 0;
-        // set connector's ref id's to -1 or ref count to 0 if a write|source node
-        if(cn->type == dt_token("read") || cn->type == dt_token("sink"))
-        {
-          cn->connected_mi = -1;
-          cn->connected_mc = -1;
-        }
-        else if(cn->type == dt_token("write") || cn->type == dt_token("source"))
-        {
-          cn->connected_mi = 0;
-          cn->connected_mc = 0;
-        }
-      }
-      mod->num_connectors = mod->so->num_connectors;
-      break;
+  // copy over initial info from module class. init params:
+  mod->param = 0;
+  mod->param_size = 0;
+  if(mod->so->num_params)
+  {
+    dt_ui_param_t *p = mod->so->param[mod->so->num_params-1];
+    mod->param_size = p->offset + dt_ui_param_size(p->type, p->cnt);
+    if(graph->params_end + mod->param_size > graph->params_max)
+    { // grow the pool and move the params of all other modules along
+      uint8_t *old = graph->params_pool;
+      while(graph->params_end + mod->param_size > graph->params_max)
+        graph->params_max *= 2;
+      graph->params_pool = realloc(graph->params_pool, graph->params_max);
+      for(int m=0;m<modid;m++)
+        if(graph->module[m].param)
+          graph->module[m].param = graph->params_pool + (graph->module[m].param - old);
     }
+    mod->param = graph->params_pool + graph->params_end;
+    graph->params_end += mod->param_size;
   }
-  if(mod->num_connectors == 0)
-  { // if connectors still empty fail
-    dt_log(s_log_pipe|s_log_err, "module %"PRItkn" has no connectors!", dt_token_str(name));
-    graph->num_modules--;
-    return -1;
+  for(int p=0;p<mod->so->num_params;p++)
+  { // init default params
+    dt_ui_param_t *pp = mod->so->param[p];
+    memcpy(mod->param + pp->offset, pp->val, dt_ui_param_size(pp->type, pp->cnt));
+  }
+  for(int c=0;c<mod->so->num_connectors;c++)
+  { // init connectors from our module class:
+    mod->connector[c] = mod->so->connector[c];
+    dt_connector_t *cn = mod->connector+c;
+    cn->mem = 0;
+    // set connector's ref id's to -1 or ref count to 0 if a write|source node
+    if(cn->type == dt_token("read") || cn->type == dt_token("sink"))
+    {
+      cn->connected_mi = -1;
+      cn->connected_mc = -1;
+    }
+    else if(cn->type == dt_token("write") || cn->type == dt_token("source"))
+    {
+      cn->connected_mi = 0;
+      cn->connected_mc = 0;
+    }
   }
+  mod->num_connectors = mod->so->num_connectors;
+
+  if(2*(graph->module_hash_cnt + 1) > graph->module_hash_size)
+    module_hash_rebuild(graph); // includes the new module
+  else
+    module_hash_insert(graph, modid);
 
   if(mod->so->init) mod->so->init(mod);
   return modid;
@@ -109,12 +162,15 @@ int dt_module_get(
     dt_token_t name,
     dt_token_t inst)
 {
-  // TODO: some smarter way? hash table? benchmark how much we lose
-  // through this stupid O(n) approach. after all the comparisons are
-  // fast and we don't have all that many modules.
-  for(int i=0;i<graph->num_modules;i++)
-    if(graph->module[i].name == name &&
-       graph->module[i].inst == inst)
-      return i;
+  // removed modules have their name cleared and are skipped
+  if(!graph->module_hash_size) return -1;
+  const uint32_t mask = graph->module_hash_size - 1;
+  for(uint32_t h=module_hash(name, inst)&mask;graph->module_hash[h]>=0;h=(h+1)&mask)
+  {
+    const int m = graph->module_hash[h];
+    if(graph->module[m].name == name &&
+       graph->module[m].inst == inst)
+      return m;
+  }
   return -1;
 }
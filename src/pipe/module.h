@@ -32,6 +32,15 @@ typedef struct dt_image_params_t
 }
 dt_image_params_t;
 
+// flags requesting work on a module instance during the next graph run.
+typedef enum dt_module_flags_t
+{
+  s_module_request_none          = 0,
+  s_module_request_commit_params = 1<<0, // param block changed, re-commit it
+  s_module_dirty                 = 1<<1, // params, roi or inputs changed, needs to run
+}
+dt_module_flags_t;
+
 // this is an instance of a module.
 typedef struct dt_module_t
 {
@@ -47,6 +56,8 @@ typedef struct dt_module_t
 
   dt_image_params_t img_param;
 
+  dt_module_flags_t flags; // requests for the next graph run, reset after
+
   // TODO: parameters:
   // human facing parameters for gui + serialisation
   // compute facing parameters for uniform upload
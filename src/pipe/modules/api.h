@@ -98,8 +98,7 @@ dt_api_blur(
   {
     // TODO: could run these on downsampled image instead
     // add nodes blur2h and blur2v
-    assert(graph->num_nodes < graph->max_nodes);
-    const int id_blur2h = graph->num_nodes++;
+    const int id_blur2h = dt_node_add(graph);
     dt_node_t *node_blur2h = graph->node + id_blur2h;
     *node_blur2h = (dt_node_t) {
       .name   = dt_token("shared"),
@@ -115,8 +114,7 @@ dt_api_blur(
       .push_constant_size = 4,
       .push_constant = {1u<<i},
     };
-    assert(graph->num_nodes < graph->max_nodes);
-    const int id_blur2v = graph->num_nodes++;
+    const int id_blur2v = dt_node_add(graph);
     dt_node_t *node_blur2v = graph->node + id_blur2v;
     *node_blur2v = (dt_node_t) {
       .name   = dt_token("shared"),
@@ -174,8 +172,7 @@ dt_api_guided_filter(
   };
 
   // TODO: compute grey scale image rg32 with (I, I*I)
-  assert(graph->num_nodes < graph->max_nodes);
-  const int id_guided1 = graph->num_nodes++;
+  const int id_guided1 = dt_node_add(graph);
   *entry_nodeid = id_guided1;
   dt_node_t *node_guided1 = graph->node + id_guided1;
   *node_guided1 = (dt_node_t) {
@@ -200,8 +197,7 @@ dt_api_guided_filter(
   // a = var_I / (var_I + eps)
   // with var_I = corr_I - mean_I * mean_I
   // b = mean_I - a * mean_I
-  assert(graph->num_nodes < graph->max_nodes);
-  const int id_guided2 = graph->num_nodes++;
+  const int id_guided2 = dt_node_add(graph);
   dt_node_t *node_guided2 = graph->node + id_guided2;
   ci.chan = dt_token("rg");
   *node_guided2 = (dt_node_t) {
@@ -226,8 +222,7 @@ dt_api_guided_filter(
 
   // final kernel:
   // output = mean_a * I + mean_b
-  assert(graph->num_nodes < graph->max_nodes);
-  const int id_guided3 = graph->num_nodes++;
+  const int id_guided3 = dt_node_add(graph);
   dt_node_t *node_guided3 = graph->node + id_guided3;
   ci.chan = dt_token("rgba");
   co.chan = dt_token("rgba");
@@ -257,6 +252,94 @@ dt_api_guided_filter(
   *exit_nodeid = id_guided3;
 }
 
+// bytes per pixel of the host layouts a sink can ask for
+static inline size_t
+dt_api_pack_bpp(dt_token_t layout)
+{
+  switch(layout)
+  {
+    case dt_token("rgb8")  : return 3;
+    case dt_token("rgb16f"): return 6;
+    case dt_token("rgb32f"): return 12;
+  }
+  return 0;
+}
+
+// bytes per row of the packed image, as it arrives in write_sink()
+static inline size_t
+dt_api_pack_pitch(dt_token_t layout, uint32_t wd)
+{
+  return (dt_api_pack_bpp(layout) * wd + 15) / 16 * 16;
+}
+
+// create nodes for a sink which is downloaded to write_sink(): a kernel packs
+// the input into rows of the given layout (rgb8 from ui8, rgb16f or rgb32f
+// from f16/f32 rgba) on the device, so only the bytes which end up in the
+// file are copied to the host. the rows are stored as rgba ui32 texels and
+// padded to 16 bytes. call this from the sink's create_nodes(). a change of
+// params alone doesn't recreate the nodes, so don't pick the layout by them.
+static inline void
+dt_api_sink_pack(
+    dt_graph_t  *graph,
+    dt_module_t *module,
+    dt_token_t   layout)
+{
+  dt_roi_t roi = module->connector[0].roi;
+  roi.wd = dt_api_pack_pitch(layout, roi.wd) / 16;
+  dt_connector_t ci = {
+    .name   = dt_token("input"),
+    .type   = dt_token("read"),
+    .chan   = module->connector[0].chan,
+    .format = module->connector[0].format,
+    .roi    = module->connector[0].roi,
+    .connected_mi = -1,
+  };
+  dt_connector_t co = {
+    .name   = dt_token("output"),
+    .type   = dt_token("write"),
+    .chan   = dt_token("rgba"),
+    .format = dt_token("ui32"),
+    .roi    = roi,
+  };
+  dt_connector_t cs = {
+    .name   = dt_token("input"),
+    .type   = dt_token("sink"),
+    .chan   = dt_token("rgba"),
+    .format = dt_token("ui32"),
+    .roi    = roi,
+    .connected_mi = -1,
+  };
+  const int id_pack = dt_node_add(graph);
+  dt_node_t *node_pack = graph->node + id_pack;
+  *node_pack = (dt_node_t) {
+    .name   = dt_token("shared"),
+    .kernel = layout == dt_token("rgb8")   ? dt_token("pack8") :
+             (layout == dt_token("rgb16f") ? dt_token("pack16f") : dt_token("pack32f")),
+    .module = module,
+    .wd     = roi.wd,
+    .ht     = roi.ht,
+    .dp     = 1,
+    .num_connectors = 2,
+    .connector = {
+      ci, co,
+    },
+  };
+  const int id_sink = dt_node_add(graph);
+  dt_node_t *node_sink = graph->node + id_sink;
+  *node_sink = (dt_node_t) {
+    .name   = module->name,
+    .kernel = dt_token("main"),
+    .module = module,
+    .num_connectors = 1,
+    .connector = {
+      cs,
+    },
+  };
+  dt_connector_copy(graph, module, 0, id_pack, 0);
+  graph->node[id_pack].connector[0].type = dt_token("read"); // was "sink" on the module
+  CONN(dt_node_connect(graph, id_pack, 1, id_sink, 0));
+}
+
 static inline const uint32_t *dt_module_param_uint32(
     const dt_module_t *module,
     int paramid)
@@ -2,6 +2,14 @@
 #include <math.h>
 #include <stdlib.h>
 
+// the guided filter blurs twice, each time with a-trous steps of 1, 2 and 4
+// and a five tap kernel, so 2+4+8 rows on either side.
+int
+halo(dt_module_t *module)
+{
+  return 2*(2+4+8);
+}
+
 void
 create_nodes(
     dt_graph_t  *graph,
@@ -42,8 +50,7 @@ create_nodes(
     .format = dt_token("f16"),
     .roi    = module->connector[1].roi,
   };
-  assert(graph->num_nodes < graph->max_nodes);
-  const int id_comb = graph->num_nodes++;
+  const int id_comb = dt_node_add(graph);
   dt_node_t *node_comb = graph->node + id_comb;
   *node_comb = (dt_node_t) {
     .name   = dt_token("contrast"),
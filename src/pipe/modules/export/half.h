@@ -1,6 +1,6 @@
 #pragma once
 #include <stdint.h>
-#include <xmmintrin.h>
+#include <immintrin.h>
 
 // float->half variants.
 // by Fabian "ryg" Giesen.
@@ -144,3 +144,49 @@ static inline __m128i float_to_half_SSE2(__m128 f)
   return final;
 #undef CONSTF
 }
+
+// the other direction, 4 halves in the low 16 bits of each lane.
+// denormals, inf and nan are preserved.
+static inline __m128 half_to_float_SSE2(__m128i h)
+{
+  __m128i mask_nosign = _mm_set1_epi32(0x7fff);
+  __m128  magic       = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+  __m128i was_infnan  = _mm_set1_epi32(0x7bff);
+  __m128  exp_infnan  = _mm_castsi128_ps(_mm_set1_epi32(255 << 23));
+
+  __m128i expmant     = _mm_and_si128(mask_nosign, h);
+  __m128i justsign    = _mm_xor_si128(h, expmant);
+  __m128i shifted     = _mm_slli_epi32(expmant, 13);
+  __m128  scaled      = _mm_mul_ps(_mm_castsi128_ps(shifted), magic);
+  __m128i b_wasinfnan = _mm_cmpgt_epi32(expmant, was_infnan);
+  __m128i sign        = _mm_slli_epi32(justsign, 16);
+  __m128  infnanexp   = _mm_and_ps(_mm_castsi128_ps(b_wasinfnan), exp_infnan);
+  __m128  sign_inf    = _mm_or_ps(_mm_castsi128_ps(sign), infnanexp);
+  return _mm_or_ps(scaled, sign_inf);
+}
+
+// convert n halves to floats, 4 at a time
+__attribute__((target("f16c")))
+static inline void half_to_float_n_F16C(const uint16_t *in, float *out, size_t n)
+{
+  size_t k = 0;
+  for(;k+4<=n;k+=4)
+    _mm_storeu_ps(out + k, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(in + k))));
+  for(;k<n;k++) out[k] = half_to_float(in[k]);
+}
+
+static inline void half_to_float_n_SSE2(const uint16_t *in, float *out, size_t n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  size_t k = 0;
+  for(;k+4<=n;k+=4)
+    _mm_storeu_ps(out + k, half_to_float_SSE2(
+          _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(in + k)), zero)));
+  for(;k<n;k++) out[k] = half_to_float(in[k]);
+}
+
+static inline void half_to_float_n(const uint16_t *in, float *out, size_t n)
+{
+  if(__builtin_cpu_supports("f16c")) half_to_float_n_F16C(in, out, n);
+  else half_to_float_n_SSE2(in, out, n);
+}
@@ -1,7 +1,8 @@
 #include "modules/api.h"
-#include "half.h"
+#include "write.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 void modify_roi_in(
@@ -17,42 +18,118 @@ void modify_roi_in(
   r->scale = 1.0f;
 }
 
-// called after pipeline finished up to here.
-// our input buffer will come in memory mapped.
-void write_sink(
-    dt_module_t *module,
-    void *buf)
+// the input is half float, download it as such no matter the format. this way
+// the nodes don't depend on the format parameter, and pfm converts on the host.
+void create_nodes(
+    dt_graph_t  *graph,
+    dt_module_t *module)
 {
+  dt_api_sink_pack(graph, module, dt_token("rgb16f"));
+}
+
+// the file which is being written, rows are appended as they arrive
+typedef struct export_t
+{
+  FILE    *f;
+  void    *buf;  // the rows are streamed from
+  char     filename[512];
+  uint32_t rows; // written so far
+  int      tif;
+  int      err;
+}
+export_t;
+
+int init(dt_module_t *mod)
+{
+  export_t *dat = malloc(sizeof(*dat));
+  memset(dat, 0, sizeof(*dat));
+  mod->data = dat;
+  return 0;
+}
+
+// finish the file and report
+static void
+close_file(export_t *exp)
+{
+  if(!exp->f) return;
+  exp->err |= fclose(exp->f) != 0;
+  if(exp->err) fprintf(stderr, "[export] failed to write '%s'\n", exp->filename);
+  exp->f = 0;
+}
+
+void cleanup(dt_module_t *mod)
+{
+  if(!mod->data) return;
+  close_file(mod->data);
+  free(mod->data);
+  mod->data = 0;
+}
+
+static void
+open_file(dt_module_t *module)
+{
+  export_t *exp = module->data;
   const char *basename = dt_module_param_string(module, 0);
+  const char *format   = dt_module_param_string(module, 1);
   fprintf(stderr, "[export] writing '%s'\n", basename);
-  uint16_t *p16 = buf;
-
   const int width  = module->connector[0].roi.wd;
   const int height = module->connector[0].roi.ht;
-
-  char filename[512];
-  snprintf(filename, sizeof(filename), "%s.pfm", basename);
-  FILE* f = fopen(filename, "wb");
-  if(f)
+  const int tif = exp->tif = !strcmp(format, "tif");
+  snprintf(exp->filename, sizeof(exp->filename), "%s.%s", basename, tif ? "tif" : "pfm");
+  exp->rows = 0;
+  exp->err  = 0;
+  exp->f = fopen(exp->filename, "wb");
+  if(!exp->f)
   {
-    // align pfm header to sse, assuming the file will
-    // be mmapped to page boundaries.
-    char header[1024];
-    snprintf(header, 1024, "PF\n%d %d\n-1.0", width, height);
-    size_t len = strlen(header);
-    fprintf(f, "PF\n%d %d\n-1.0", width, height);
-    ssize_t off = 0;
-    while((len + 1 + off) & 0xf) off++;
-    while(off-- > 0) fprintf(f, "0");
-    fprintf(f, "\n");
-    for(size_t k=0;k<width*height;k++)
-    {
-      float p32[3] = {
-        half_to_float(p16[4*k+0]),
-        half_to_float(p16[4*k+1]),
-        half_to_float(p16[4*k+2])};
-      fwrite(p32, sizeof(float), 3ul, f);
-    }
-    fclose(f);
+    fprintf(stderr, "[export] failed to write '%s'\n", exp->filename);
+    return;
+  }
+  exp->err = tif ? tif_header(exp->f, width, height) : pfm_header(exp->f, width, height);
+}
+
+// append the rows up to end
+static void
+append_rows(dt_module_t *module, const uint8_t *buf, uint32_t end)
+{
+  export_t *exp = module->data;
+  if(!exp->f || exp->err || end <= exp->rows) return;
+  const int width = module->connector[0].roi.wd;
+  const size_t pitch = dt_api_pack_pitch(dt_token("rgb16f"), width);
+  if(exp->tif)
+    exp->err = fwrite_rows(exp->f, buf + pitch * exp->rows,
+        dt_api_pack_bpp(dt_token("rgb16f")) * width, pitch, end - exp->rows);
+  else
+    exp->err = fwrite_rows_float(exp->f, buf + pitch * exp->rows,
+        width, pitch, end - exp->rows);
+  exp->rows = end;
+}
+
+// the rows go to disk as they arrive, while the rest is downloaded
+void write_rows(
+    dt_module_t *module,
+    void        *buf,
+    uint32_t     y,
+    uint32_t     ht)
+{
+  export_t *exp = module->data;
+  if(y == 0)
+  { // a new image. if the last one was left unfinished, it stays that way.
+    close_file(exp);
+    open_file(module);
+    exp->buf = buf;
   }
+  append_rows(module, buf, y + ht);
+}
+
+// called after pipeline finished up to here.
+// our input buffer will come in memory mapped, packed to half rgb rows.
+void write_sink(
+    dt_module_t *module,
+    void *buf)
+{
+  export_t *exp = module->data;
+  if(exp->f && exp->buf != buf) close_file(exp); // left over from an unfinished download
+  if(!exp->f) open_file(module); // no rows streamed in before
+  append_rows(module, buf, module->connector[0].roi.ht);
+  close_file(exp);
 }
@@ -0,0 +1,156 @@
+#pragma once
+#include "half.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// writers for the rows we get from the graph. these are packed on the device
+// into half float rgb rows (see dt_api_sink_pack()), so for tiff all that's
+// left is to skip the padding at the end of the rows. if there is none, the
+// whole image goes out in one call. pfm wants floats, the rows are converted
+// in blocks on the way out. the headers can be written separately, to stream
+// in the rows band by band.
+
+#define EXPORT_BLOCK_PX (1<<18) // pixels converted per write
+
+static inline int
+fwrite_rows(
+    FILE          *f,
+    const uint8_t *buf,
+    size_t         row,    // bytes per row in the file
+    size_t         pitch,  // bytes per row in the buffer
+    int            height)
+{
+  if(row == pitch) return fwrite(buf, row, height, f) != (size_t)height;
+  for(int j=0;j<height;j++)
+    if(fwrite(buf + pitch * j, row, 1, f) != 1) return 1;
+  return 0;
+}
+
+// half float rows to 32-bit float rows, as many rows as fit into a block at
+// a time. every block is written in one go.
+static inline int
+fwrite_rows_float(
+    FILE          *f,
+    const uint8_t *buf,
+    int            width,
+    size_t         pitch, // bytes per row in the buffer
+    int            height)
+{
+  const int rows = width < EXPORT_BLOCK_PX ? EXPORT_BLOCK_PX / width : 1;
+  float *block = malloc(sizeof(float) * 3 * width * rows);
+  int err = !block;
+  for(int j=0;j<height&&!err;j+=rows)
+  {
+    const int n = height - j < rows ? height - j : rows;
+    for(int r=0;r<n;r++)
+      half_to_float_n((const uint16_t *)(buf + pitch * (j + r)), block + 3 * width * r, 3 * width);
+    err = fwrite(block, sizeof(float) * 3 * width, n, f) != (size_t)n;
+  }
+  free(block);
+  return err;
+}
+
+// 32-bit float rgb pfm
+static inline int
+pfm_header(
+    FILE *f,
+    int   width,
+    int   height)
+{
+  // align pfm header to sse, assuming the file will
+  // be mmapped to page boundaries.
+  char header[1024];
+  snprintf(header, 1024, "PF\n%d %d\n-1.0", width, height);
+  size_t len = strlen(header);
+  fprintf(f, "PF\n%d %d\n-1.0", width, height);
+  ssize_t off = 0;
+  while((len + 1 + off) & 0xf) off++;
+  while(off-- > 0) fprintf(f, "0");
+  return fprintf(f, "\n") != 1;
+}
+
+static inline int
+write_pfm(
+    const char    *filename,
+    const uint8_t *buf,
+    int            width,
+    int            height,
+    size_t         pitch)
+{
+  FILE* f = fopen(filename, "wb");
+  if(!f) return 1;
+  int err = pfm_header(f, width, height);
+  if(!err) err = fwrite_rows_float(f, buf, width, pitch, height);
+  err |= fclose(f) != 0;
+  return err;
+}
+
+// one little endian tiff directory entry, returns the next one
+static inline uint8_t*
+tif_tag(uint8_t *e, uint16_t tag, uint16_t type, uint32_t cnt, uint32_t val)
+{
+  memcpy(e+0, &tag,  2);
+  memcpy(e+2, &type, 2);
+  memcpy(e+4, &cnt,  4);
+  if(type == 3 && cnt == 1)
+  { // shorts are left aligned in the value
+    const uint16_t v = val;
+    memcpy(e+8, &v, 2);
+  }
+  else memcpy(e+8, &val, 4);
+  return e + 12;
+}
+
+// 16-bit half float rgb tiff, uncompressed in one strip
+static inline int
+tif_header(
+    FILE *f,
+    int   width,
+    int   height)
+{
+  const size_t npx = (size_t)width * height;
+  if(npx * 6 > UINT32_MAX) return 1; // would need bigtiff
+  // header, then one directory with 11 entries, then the values which don't
+  // fit into the entries, then the pixels aligned to 16 bytes.
+  const uint16_t num = 11;
+  const uint32_t ifd = 8;
+  const uint32_t bps = ifd + 2 + 12*num + 4, fmt = bps + 6, data = 160;
+  uint8_t header[160] = { 'I', 'I', 42, 0, ifd };
+  uint8_t *e = header + ifd;
+  memcpy(e, &num, 2);
+  e += 2;
+  e = tif_tag(e, 256, 4, 1, width);   // image width
+  e = tif_tag(e, 257, 4, 1, height);  // image length
+  e = tif_tag(e, 258, 3, 3, bps);     // bits per sample
+  e = tif_tag(e, 259, 3, 1, 1);       // no compression
+  e = tif_tag(e, 262, 3, 1, 2);       // rgb
+  e = tif_tag(e, 273, 4, 1, data);    // strip offsets
+  e = tif_tag(e, 277, 3, 1, 3);       // samples per pixel
+  e = tif_tag(e, 278, 4, 1, height);  // rows per strip
+  e = tif_tag(e, 279, 4, 1, npx * 6); // strip byte counts
+  e = tif_tag(e, 284, 3, 1, 1);       // chunky planar config
+  e = tif_tag(e, 339, 3, 3, fmt);     // sample format
+  const uint16_t bits[] = { 16, 16, 16 }, ieee[] = { 3, 3, 3 };
+  memcpy(header + bps, bits, sizeof(bits));
+  memcpy(header + fmt, ieee, sizeof(ieee)); // ieee floating point
+  return fwrite(header, sizeof(header), 1, f) != 1;
+}
+
+static inline int
+write_tif(
+    const char    *filename,
+    const uint8_t *buf,
+    int            width,
+    int            height,
+    size_t         pitch)
+{
+  FILE* f = fopen(filename, "wb");
+  if(!f) return 1;
+  int err = tif_header(f, width, height);
+  if(!err) err = fwrite_rows(f, buf, sizeof(uint16_t) * 3 * width, pitch, height);
+  err |= fclose(f) != 0;
+  return err;
+}
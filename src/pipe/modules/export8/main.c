@@ -1,10 +1,14 @@
 #include "modules/api.h"
+#include "core/core.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <setjmp.h>
 #include <jpeglib.h>
+#include <pthread.h>
+#include <unistd.h>
 
 void modify_roi_in(
     dt_graph_t *graph,
@@ -19,6 +23,14 @@ void modify_roi_in(
   r->scale = 1.0f;
 }
 
+// have the rows packed to rgb8 on the device, that's what libjpeg takes
+void create_nodes(
+    dt_graph_t  *graph,
+    dt_module_t *module)
+{
+  dt_api_sink_pack(graph, module, dt_token("rgb8"));
+}
+
 typedef struct jpgerr_t
 {
   struct jpeg_error_mgr pub;
@@ -34,72 +46,540 @@ error_exit(j_common_ptr cinfo)
   longjmp(myerr->setjmp_buffer, 1);
 }
 
-// called after pipeline finished up to here.
-// our input buffer will come in memory mapped.
-void write_sink(
-    dt_module_t *module,
-    void *buf)
+#define JPG_STRIP_HT 256 // don't split the encode into strips smaller than this
+
+// compression settings, same for the whole image and every strip of it
+static void
+jpeg_setup(
+    struct jpeg_compress_struct *cinfo,
+    int   width,
+    int   height,
+    float quality,
+    int   optimize)
 {
-  const char *basename = dt_module_param_string(module, 0);
-  fprintf(stderr, "[export8] writing '%s'\n", basename);
+  cinfo->image_width  = width;
+  cinfo->image_height = height;
+  cinfo->input_components = 3;
+  cinfo->in_color_space = JCS_RGB;
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, quality, TRUE);
+  // same quality tradeoff as darktable
+  if(quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+  if(quality > 95) cinfo->dct_method = JDCT_FLOAT;
+  if(quality < 50) cinfo->dct_method = JDCT_IFAST;
+  if(quality < 80) cinfo->smoothing_factor = 20;
+  if(quality < 60) cinfo->smoothing_factor = 40;
+  if(quality < 40) cinfo->smoothing_factor = 60;
+  cinfo->optimize_coding = optimize;
+  cinfo->density_unit = 1;
+  cinfo->X_density = 300;
+  cinfo->Y_density = 300;
+}
 
-  const int width  = module->connector[0].roi.wd;
-  const int height = module->connector[0].roi.ht;
-  const uint8_t *in = buf;
+// rows [y0, y1) of the packed rgb image, compressed into a complete jpg in memory
+typedef struct jpgstrip_t
+{
+  const uint8_t *in;
+  size_t         pitch;
+  int            width, y0, y1;
+  float          quality;
+  int            optimize; // 1: tables of its own, 2: count symbols for tables shared by all strips
+  long           freq[2][NUM_HUFF_TBLS][257]; // dc and ac huffman symbols, for optimize == 2
+  const JHUFF_TBL *huff;   // the shared dc and ac tables, NUM_HUFF_TBLS each, once they are known
+  struct jpgcoef_t *coef;  // the strip read back, for optimize == 2
+  unsigned char *out;
+  unsigned long  out_size;
+  int            err;
+}
+jpgstrip_t;
 
-  char filename[512];
-  snprintf(filename, sizeof(filename), "%s.jpg", basename);
+// the scan order of the coefficients within a block
+static const int jpg_zigzag[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
 
+static inline int
+jpg_nbits(int v)
+{
+  v = abs(v);
+  return v ? 32 - __builtin_clz(v) : 0;
+}
 
-  jpgerr_t jerr;
+// count the huffman symbols a baseline scan of the coefficients is made of,
+// going through the interleaved mcus like the encoder does. the blocks which
+// only pad the mcus at the right and bottom repeat the dc of the block
+// before them and have no ac, this is what the encoder writes for them.
+static void
+jpeg_count(
+    struct jpeg_decompress_struct *dinfo,
+    jvirt_barray_ptr              *coef,
+    long                           freq[2][NUM_HUFF_TBLS][257])
+{
+  int last_dc[MAX_COMPONENTS] = {0};
+  const int mcu_x = (dinfo->image_width  + 8*dinfo->max_h_samp_factor - 1) / (8*dinfo->max_h_samp_factor);
+  const int mcu_y = (dinfo->image_height + 8*dinfo->max_v_samp_factor - 1) / (8*dinfo->max_v_samp_factor);
+  for(int my=0;my<mcu_y;my++)
+  {
+    JBLOCKARRAY rows[MAX_COMPONENTS];
+    for(int ci=0;ci<dinfo->num_components;ci++)
+      rows[ci] = (*dinfo->mem->access_virt_barray)((j_common_ptr)dinfo, coef[ci],
+          my * dinfo->comp_info[ci].v_samp_factor, dinfo->comp_info[ci].v_samp_factor, FALSE);
+    for(int mx=0;mx<mcu_x;mx++) for(int ci=0;ci<dinfo->num_components;ci++)
+    {
+      const jpeg_component_info *comp = dinfo->comp_info + ci;
+      long *dc = freq[0][comp->dc_tbl_no], *ac = freq[1][comp->ac_tbl_no];
+      for(int yy=0;yy<comp->v_samp_factor;yy++) for(int xx=0;xx<comp->h_samp_factor;xx++)
+      {
+        const int bx = mx * comp->h_samp_factor + xx, by = my * comp->v_samp_factor + yy;
+        if(bx >= comp->width_in_blocks || by >= comp->height_in_blocks)
+        { // dummy block
+          dc[0]++;
+          ac[0]++;
+          continue;
+        }
+        const JCOEF *b = rows[ci][yy][bx];
+        dc[jpg_nbits(b[0] - last_dc[ci])]++;
+        last_dc[ci] = b[0];
+        // most coefficients are zero, only visit the others:
+        uint64_t nz = 0;
+        for(int k=1;k<64;k++) nz |= (uint64_t)(b[jpg_zigzag[k]] != 0) << k;
+        int k0 = 0;
+        for(;nz;nz&=nz-1)
+        {
+          const int k = __builtin_ctzll(nz);
+          int r = k - k0 - 1;
+          for(;r>15;r-=16) ac[0xf0]++; // zero run length
+          ac[(r << 4) + jpg_nbits(b[jpg_zigzag[k]])]++;
+          k0 = k;
+        }
+        if(k0 < 63) ac[0]++; // end of block
+      }
+    }
+  }
+}
+
+// optimal huffman code lengths for the symbol frequencies, limited to 16
+// bits and without a code of all ones (jpeg annex k.2). this is what
+// libjpeg does for optimize_coding, it just doesn't take counts from outside.
+static void
+jpeg_huff_table(JHUFF_TBL *htbl, const long count[257])
+{
+  long freq[257];
+  uint8_t bits[33] = {0};
+  int codesize[257] = {0}, others[257];
+  memcpy(freq, count, sizeof(freq));
+  for(int i=0;i<257;i++) others[i] = -1;
+  freq[256] = 1; // reserve the code of all ones
+  for(;;)
+  { // merge the two least frequent subtrees
+    int c1 = -1, c2 = -1;
+    long v = LONG_MAX;
+    for(int i=0;i<=256;i++) if(freq[i] && freq[i] <= v) { v = freq[i]; c1 = i; }
+    v = LONG_MAX;
+    for(int i=0;i<=256;i++) if(freq[i] && freq[i] <= v && i != c1) { v = freq[i]; c2 = i; }
+    if(c2 < 0) break;
+    freq[c1] += freq[c2];
+    freq[c2] = 0;
+    codesize[c1]++;
+    while(others[c1] >= 0) { c1 = others[c1]; codesize[c1]++; }
+    others[c1] = c2;
+    codesize[c2]++;
+    while(others[c2] >= 0) { c2 = others[c2]; codesize[c2]++; }
+  }
+  for(int i=0;i<=256;i++) if(codesize[i]) bits[MIN(codesize[i], 32)]++;
+  for(int i=32;i>16;i--) while(bits[i] > 0)
+  { // move pairs of too long codes up the tree
+    int j = i - 2;
+    while(bits[j] == 0) j--;
+    bits[i] -= 2;
+    bits[i-1]++;
+    bits[j+1] += 2;
+    bits[j]--;
+  }
+  int i = 16;
+  while(bits[i] == 0) i--;
+  bits[i]--; // drop the reserved code
+  memcpy(htbl->bits, bits, sizeof(htbl->bits));
+  int p = 0;
+  for(int len=1;len<=32;len++) for(int c=0;c<256;c++)
+    if(codesize[c] == len) htbl->huffval[p++] = c;
+  htbl->sent_table = FALSE;
+}
+
+// number of codes in the table, 0 if no symbols were counted for it
+static inline int
+jpeg_huff_used(const JHUFF_TBL *htbl)
+{
+  int n = 0;
+  for(int l=1;l<=16;l++) n += htbl->bits[l];
+  return n;
+}
+
+// the strip read back from its standard tables: the coefficients stay in
+// memory until the strip is coded again with the shared tables.
+typedef struct jpgcoef_t
+{
+  jpgerr_t                      err;
+  struct jpeg_decompress_struct dinfo;
+  jvirt_barray_ptr             *coef;
+}
+jpgcoef_t;
+
+static void
+jpeg_coef_free(jpgstrip_t *s)
+{
+  if(!s->coef) return;
+  jpeg_destroy_decompress(&s->coef->dinfo);
+  free(s->coef);
+  s->coef = 0;
+}
+
+// read the coefficients of the strip and count its huffman symbols
+static void
+jpeg_count_strip(jpgstrip_t *s)
+{
+  jpgcoef_t *c = s->coef = malloc(sizeof(*c));
+  c->dinfo.err = jpeg_std_error(&c->err.pub);
+  c->err.pub.error_exit = error_exit;
+  jpeg_create_decompress(&c->dinfo);
+  if(setjmp(c->err.setjmp_buffer))
+  {
+    jpeg_coef_free(s);
+    s->err = 1;
+    return;
+  }
+  jpeg_mem_src(&c->dinfo, s->out, s->out_size);
+  jpeg_read_header(&c->dinfo, TRUE);
+  c->coef = jpeg_read_coefficients(&c->dinfo);
+  jpeg_count(&c->dinfo, c->coef, s->freq);
+}
+
+// write the coefficients of the strip again with the shared tables, which
+// only redoes the entropy coding
+static void*
+jpeg_optimize(void *arg)
+{
+  jpgstrip_t *s = arg;
+  jpgcoef_t *c = s->coef;
   struct jpeg_compress_struct cinfo;
+  unsigned char *out = 0;
+  unsigned long out_size = 0;
+  cinfo.err = &c->err.pub;
+  jpeg_create_compress(&cinfo);
+  if(setjmp(c->err.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&cinfo);
+    free(out);
+    s->err = 1;
+    return 0;
+  }
+  jpeg_mem_dest(&cinfo, &out, &out_size);
+  jpeg_copy_critical_parameters(&c->dinfo, &cinfo);
+  cinfo.optimize_coding = FALSE;
+  for(int t=0;t<2*NUM_HUFF_TBLS;t++)
+  {
+    if(!jpeg_huff_used(s->huff + t)) continue;
+    JHUFF_TBL **h = t < NUM_HUFF_TBLS ? cinfo.dc_huff_tbl_ptrs + t : cinfo.ac_huff_tbl_ptrs + t - NUM_HUFF_TBLS;
+    if(!*h) *h = jpeg_alloc_huff_table((j_common_ptr)&cinfo);
+    **h = s->huff[t];
+  }
+  jpeg_write_coefficients(&cinfo, c->coef);
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  free(s->out);
+  s->out = out;
+  s->out_size = out_size;
+  return 0;
+}
 
+static void*
+jpeg_encode(void *arg)
+{
+  jpgstrip_t *s = arg;
+  jpgerr_t jerr;
+  struct jpeg_compress_struct cinfo;
   cinfo.err = jpeg_std_error(&jerr.pub);
   jerr.pub.error_exit = error_exit;
   if(setjmp(jerr.setjmp_buffer))
   {
     jpeg_destroy_compress(&cinfo);
-    return;
+    s->err = 1;
+    return 0;
   }
   jpeg_create_compress(&cinfo);
-  FILE *f = fopen(filename, "wb");
-  if(!f) return;
-  jpeg_stdio_dest(&cinfo, f);
-
-  cinfo.image_width  = width;
-  cinfo.image_height = height;
-  cinfo.input_components = 3;
-  cinfo.in_color_space = JCS_RGB;
-  jpeg_set_defaults(&cinfo);
-  const float quality = dt_module_param_float(module, 1)[0];
-  jpeg_set_quality(&cinfo, quality, TRUE);
-  // same quality tradeoff as darktable
-  if(quality > 90) cinfo.comp_info[0].v_samp_factor = 1;
-  if(quality > 92) cinfo.comp_info[0].h_samp_factor = 1;
-  if(quality > 95) cinfo.dct_method = JDCT_FLOAT;
-  if(quality < 50) cinfo.dct_method = JDCT_IFAST;
-  if(quality < 80) cinfo.smoothing_factor = 20;
-  if(quality < 60) cinfo.smoothing_factor = 40;
-  if(quality < 40) cinfo.smoothing_factor = 60;
-  cinfo.optimize_coding = 1;
-  cinfo.density_unit = 1;
-  cinfo.X_density = 300;
-  cinfo.Y_density = 300;
-
+  jpeg_mem_dest(&cinfo, &s->out, &s->out_size);
+  jpeg_setup(&cinfo, s->width, s->y1 - s->y0, s->quality, s->optimize == 1);
   jpeg_start_compress(&cinfo, TRUE);
-
-  uint8_t *row = malloc((size_t)3 * width * sizeof(uint8_t));
   while(cinfo.next_scanline < cinfo.image_height)
   {
-    JSAMPROW tmp[1];
-    const uint8_t *buf = in + (size_t)cinfo.next_scanline * cinfo.image_width * 4;
-    for(int i = 0; i < width; i++)
-      for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
-    tmp[0] = row;
-    jpeg_write_scanlines(&cinfo, tmp, 1);
+    JSAMPROW tmp[16];
+    const uint8_t *buf = s->in + ((size_t)s->y0 + cinfo.next_scanline) * s->pitch;
+    const int num = MIN(16, cinfo.image_height - cinfo.next_scanline);
+    for(int j=0;j<num;j++) tmp[j] = (JSAMPROW)buf + s->pitch * j;
+    jpeg_write_scanlines(&cinfo, tmp, num);
   }
   jpeg_finish_compress(&cinfo);
-  free(row);
   jpeg_destroy_compress(&cinfo);
-  fclose(f);
+  if(s->optimize == 2) jpeg_count_strip(s);
+  return 0;
+}
+
+// offset of the start of scan marker in the headers of a jpg, or 0
+static size_t
+find_sos(const uint8_t *b, size_t size)
+{
+  size_t i = 2; // skip start of image
+  while(i + 4 <= size && b[i] == 0xff)
+  {
+    if(b[i+1] == 0xda) return i;
+    i += 2 + ((b[i+2] << 8) | b[i+3]);
+  }
+  return 0;
+}
+
+// glue the strips together: the headers of the first one with the full
+// height and a restart interval of one strip, followed by the entropy coded
+// data of all strips, separated by restart markers. every strip starts with
+// fresh dc predictors and ends byte aligned, which is exactly what the
+// decoder expects after a restart marker. all strips have to be coded with
+// the same huffman tables for this, see optimize_strips().
+static int
+jpeg_splice(
+    FILE             *f,
+    const jpgstrip_t *strip,
+    int               num_strips,
+    int               height,
+    int               restart)
+{
+  uint8_t *b = strip[0].out;
+  const size_t sos = find_sos(b, strip[0].out_size);
+  if(!sos) return 1;
+  for(size_t i=2;i<sos;i+=2+((b[i+2]<<8)|b[i+3]))
+  { // patch image height in the start of frame
+    if(b[i+1] == 0xc0 || b[i+1] == 0xc1)
+    {
+      b[i+5] = height >> 8;
+      b[i+6] = height & 0xff;
+    }
+  }
+  const uint8_t dri[] = { 0xff, 0xdd, 0x00, 0x04, restart >> 8, restart & 0xff };
+  const size_t sos_len = 2 + ((b[sos+2] << 8) | b[sos+3]);
+  int err = fwrite(b, sos, 1, f) != 1;
+  err |= fwrite(dri, sizeof(dri), 1, f) != 1;
+  err |= fwrite(b + sos, sos_len, 1, f) != 1;
+  for(int s=0;s<num_strips && !err;s++)
+  {
+    const uint8_t *o = strip[s].out;
+    const size_t beg = find_sos(o, strip[s].out_size);
+    const size_t end = strip[s].out_size - 2; // end of image marker
+    if(!beg || o[end] != 0xff || o[end+1] != 0xd9) return 1;
+    const size_t data = beg + 2 + ((o[beg+2] << 8) | o[beg+3]);
+    err |= fwrite(o + data, end - data, 1, f) != 1;
+    const uint8_t rst[] = { 0xff, s == num_strips-1 ? 0xd9 : 0xd0 + (s & 7) };
+    err |= fwrite(rst, sizeof(rst), 1, f) != 1;
+  }
+  return err;
+}
+
+// the strips of the image being encoded. each one starts on its own thread
+// as soon as its rows are downloaded.
+typedef struct export8_t
+{
+  jpgstrip_t *strip;
+  pthread_t  *thread;
+  int         num_strips;
+  int         num_started;
+  int         strip_mcu_y, mcu_x; // strip height and width in mcus
+  JHUFF_TBL   huff[2*NUM_HUFF_TBLS]; // dc and ac tables shared by the strips
+}
+export8_t;
+
+int init(dt_module_t *mod)
+{
+  export8_t *dat = malloc(sizeof(*dat));
+  memset(dat, 0, sizeof(*dat));
+  mod->data = dat;
+  return 0;
+}
+
+// wait for all started strips, encode the ones which didn't get a thread.
+// returns non-zero if any of them failed.
+static int
+finish_strips(export8_t *exp)
+{
+  int err = 0;
+  for(int s=0;s<exp->num_started;s++)
+  {
+    if(exp->strip[s].err == -1)
+    {
+      exp->strip[s].err = 0;
+      jpeg_encode(exp->strip + s);
+    }
+    else pthread_join(exp->thread[s], 0);
+    err |= exp->strip[s].err;
+  }
+  return err;
+}
+
+static void
+free_strips(export8_t *exp)
+{
+  for(int s=0;s<exp->num_strips;s++)
+  {
+    jpeg_coef_free(exp->strip + s);
+    free(exp->strip[s].out);
+  }
+  free(exp->strip);
+  free(exp->thread);
+  exp->strip  = 0;
+  exp->thread = 0;
+  exp->num_strips = exp->num_started = 0;
+}
+
+void cleanup(dt_module_t *mod)
+{
+  if(!mod->data) return;
+  finish_strips(mod->data);
+  free_strips(mod->data);
+  free(mod->data);
+  mod->data = 0;
+}
+
+// cut the image into strips for the encoder threads
+static void
+plan_strips(dt_module_t *module, void *buf)
+{
+  export8_t *exp = module->data;
+  const int width  = module->connector[0].roi.wd;
+  const int height = module->connector[0].roi.ht;
+  const float quality = dt_module_param_float(module, 1)[0];
+  // strips have to be whole rows of mcus, and a restart interval has at most
+  // 65535 of these. the mcu size depends on the chroma subsampling above.
+  const int mcu_wd = quality > 92 ? 8 : 16, mcu_ht = quality > 90 ? 8 : 16;
+  const int mcu_y = (height + mcu_ht - 1) / mcu_ht;
+  exp->mcu_x = (width  + mcu_wd - 1) / mcu_wd;
+  int num_strips = CLAMP(height / JPG_STRIP_HT, 1, sysconf(_SC_NPROCESSORS_ONLN));
+  exp->strip_mcu_y = MAX(1, MIN((mcu_y + num_strips - 1) / num_strips, 65535 / exp->mcu_x));
+  exp->num_strips  = (mcu_y + exp->strip_mcu_y - 1) / exp->strip_mcu_y;
+  exp->num_started = 0;
+  exp->strip  = malloc(sizeof(jpgstrip_t) * exp->num_strips);
+  exp->thread = malloc(sizeof(pthread_t)  * exp->num_strips);
+  for(int s=0;s<exp->num_strips;s++)
+  {
+    exp->strip[s] = (jpgstrip_t) {
+      .in       = buf,
+      .pitch    = dt_api_pack_pitch(dt_token("rgb8"), width),
+      .width    = width,
+      .y0       = s * exp->strip_mcu_y * mcu_ht,
+      .y1       = MIN(height, (s+1) * exp->strip_mcu_y * mcu_ht),
+      .quality  = quality,
+      .optimize = exp->num_strips == 1 ? 1 : 2,
+    };
+  }
+}
+
+// the strips are encoded with the standard huffman tables first, and count
+// the symbols they are made of. merge these into one set of optimal tables
+// and redo the entropy coding of every strip with it, on all cores. this
+// comes out as small as optimize_coding on the whole image.
+static int
+optimize_strips(export8_t *exp)
+{
+  for(int t=0;t<2*NUM_HUFF_TBLS;t++)
+  {
+    long freq[257] = {0};
+    int used = 0;
+    for(int s=0;s<exp->num_strips;s++) for(int c=0;c<256;c++)
+      freq[c] += exp->strip[s].freq[t/NUM_HUFF_TBLS][t%NUM_HUFF_TBLS][c];
+    for(int c=0;c<256;c++) used |= freq[c] != 0;
+    memset(exp->huff + t, 0, sizeof(exp->huff[t]));
+    if(used) jpeg_huff_table(exp->huff + t, freq);
+  }
+  for(int s=0;s<exp->num_strips;s++)
+  {
+    exp->strip[s].huff = exp->huff;
+    if(pthread_create(exp->thread + s, 0, jpeg_optimize, exp->strip + s))
+      exp->strip[s].err = -1;
+  }
+  int err = 0;
+  for(int s=0;s<exp->num_strips;s++)
+  {
+    if(exp->strip[s].err == -1)
+    {
+      exp->strip[s].err = 0;
+      jpeg_optimize(exp->strip + s);
+    }
+    else pthread_join(exp->thread[s], 0);
+    err |= exp->strip[s].err;
+  }
+  return err;
+}
+
+// start encoding the strips which lie completely above row end
+static void
+start_strips(export8_t *exp, uint32_t end)
+{
+  for(;exp->num_started<exp->num_strips;exp->num_started++)
+  {
+    jpgstrip_t *strip = exp->strip + exp->num_started;
+    if(strip->y1 > end) break;
+    if(pthread_create(exp->thread + exp->num_started, 0, jpeg_encode, strip))
+      strip->err = -1; // encode it on the calling thread when finishing
+  }
+}
+
+// the strips start encoding while the rows below are still downloading
+void write_rows(
+    dt_module_t *module,
+    void        *buf,
+    uint32_t     y,
+    uint32_t     ht)
+{
+  export8_t *exp = module->data;
+  if(y == 0)
+  { // a new image, drop what's left of an unfinished one
+    finish_strips(exp);
+    free_strips(exp);
+    plan_strips(module, buf);
+  }
+  start_strips(exp, y + ht);
+}
+
+// called after pipeline finished up to here.
+// our input buffer will come in memory mapped, packed to rgb8 rows.
+// large images are encoded in horizontal strips on all cores.
+void write_sink(
+    dt_module_t *module,
+    void *buf)
+{
+  export8_t *exp = module->data;
+  const char *basename = dt_module_param_string(module, 0);
+  fprintf(stderr, "[export8] writing '%s'\n", basename);
+
+  char filename[512];
+  snprintf(filename, sizeof(filename), "%s.jpg", basename);
+  if(exp->strip && exp->strip[0].in != buf)
+  { // left over from an unfinished download
+    finish_strips(exp);
+    free_strips(exp);
+  }
+  if(!exp->strip) plan_strips(module, buf); // no rows streamed in before
+  start_strips(exp, module->connector[0].roi.ht);
+  int err = finish_strips(exp);
+  if(!err && exp->num_strips > 1) err = optimize_strips(exp);
+  FILE *f = fopen(filename, "wb");
+  if(!f) err = 1;
+  if(!err)
+  {
+    if(exp->num_strips == 1) err = fwrite(exp->strip[0].out, exp->strip[0].out_size, 1, f) != 1;
+    else err = jpeg_splice(f, exp->strip, exp->num_strips,
+        module->connector[0].roi.ht, exp->strip_mcu_y * exp->mcu_x);
+  }
+  if(err) fprintf(stderr, "[export8] failed to write '%s'\n", filename);
+  if(f) fclose(f);
+  free_strips(exp);
 }
@@ -20,6 +20,13 @@ void modify_roi_in(
   module->connector[0].roi.ht = module->connector[0].roi.full_ht;
 }
 
+// the histogram is collected over the whole image
+int
+halo(dt_module_t *module)
+{
+  return -1;
+}
+
 void
 create_nodes(
     dt_graph_t  *graph,
@@ -44,8 +51,7 @@ create_nodes(
     .flags  = s_conn_clear,
   };
 
-  assert(graph->num_nodes < graph->max_nodes);
-  const int id_collect = graph->num_nodes++;
+  const int id_collect = dt_node_add(graph);
   dt_node_t *node_collect = graph->node + id_collect;
   *node_collect = (dt_node_t) {
     .name   = dt_token("hist"),
@@ -66,8 +72,7 @@ create_nodes(
   co.chan   = dt_token("rgba");
   co.format = dt_token("f16");
   co.flags  = 0;
-  assert(graph->num_nodes < graph->max_nodes);
-  const int id_map = graph->num_nodes++;
+  const int id_map = dt_node_add(graph);
   dt_node_t *node_map = graph->node + id_map;
   *node_map = (dt_node_t) {
     .name   = dt_token("hist"),
@@ -0,0 +1,184 @@
+#pragma once
+#include "pipe/module.h"
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <linux/limits.h>
+
+// cache of decoded source images for input modules. a module keeps one
+// static instance, which is shared by all graphs in the process since the
+// module's dso is only loaded once. entries are keyed on file name and
+// modification time. once the decoded data exceeds the size limit, entries
+// are evicted in least recently used order. entries in use by a module
+// instance are never evicted.
+// a miss inserts a placeholder, and the thread which got the miss decodes
+// the image and hands it over with put (or calls abort). other threads asking
+// for the same file meanwhile wait for it instead of decoding it again, so
+// the graph can pick up an image that is still being prefetched.
+
+#define DT_IMGCACHE_SIZE (1ul<<30) // default limit on decoded bytes per module class
+
+typedef struct dt_imgcache_entry_t
+{
+  char              filename[PATH_MAX];
+  struct timespec   mtime;
+  uint64_t          size;    // decoded bytes, counted against the limit
+  int               ref;     // module instances using this
+  uint64_t          lru;     // time of last use
+  dt_image_params_t img_param;
+  uint32_t          wd, ht;  // of the decoded image
+  void             *data;    // decoded image, owned by the cache, 0 while decoding
+  void            (*free)(void *data);
+}
+dt_imgcache_entry_t;
+
+typedef struct dt_imgcache_t
+{
+  pthread_mutex_t       mutex;
+  pthread_cond_t        done;    // signalled when a placeholder is filled or dropped
+  dt_imgcache_entry_t **entry;
+  int                   num_entries, max_entries;
+  uint64_t              size, max_size;  // max_size 0 means DT_IMGCACHE_SIZE
+  uint64_t              clock;
+}
+dt_imgcache_t;
+
+// static initialiser, works for c and c++:
+#define DT_IMGCACHE_INIT { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, 0, 0 }
+
+static inline void
+dt_imgcache_evict(dt_imgcache_t *c)
+{ // call with the mutex held
+  const uint64_t max_size = c->max_size ? c->max_size : DT_IMGCACHE_SIZE;
+  while(c->size > max_size)
+  {
+    int lru = -1;
+    for(int i=0;i<c->num_entries;i++)
+      if(!c->entry[i]->ref && c->entry[i]->data && (lru < 0 || c->entry[i]->lru < c->entry[lru]->lru))
+        lru = i;
+    if(lru < 0) return; // everything is in use
+    dt_imgcache_entry_t *e = c->entry[lru];
+    c->size -= e->size;
+    e->free(e->data);
+    free(e);
+    c->entry[lru] = c->entry[--c->num_entries];
+  }
+}
+
+// returns the entry of the file with its current modification time and
+// takes a reference. if it has to be decoded, returns 0 and the caller has to
+// follow up with either put or abort.
+static inline dt_imgcache_entry_t*
+dt_imgcache_get(dt_imgcache_t *c, const char *filename)
+{
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+  stat(filename, &st);
+  dt_imgcache_entry_t *e = 0;
+  pthread_mutex_lock(&c->mutex);
+  for(int i=0;i<c->num_entries;i++)
+  {
+    if(strcmp(c->entry[i]->filename, filename)) continue;
+    if(!c->entry[i]->data)
+    { // somebody else is decoding it, wait and look again
+      pthread_cond_wait(&c->done, &c->mutex);
+      i = -1;
+      continue;
+    }
+    if(c->entry[i]->mtime.tv_sec  == st.st_mtim.tv_sec &&
+       c->entry[i]->mtime.tv_nsec == st.st_mtim.tv_nsec)
+    {
+      e = c->entry[i];
+      e->ref++;
+      e->lru = c->clock++;
+      pthread_mutex_unlock(&c->mutex);
+      return e;
+    }
+  }
+  // insert placeholder:
+  e = (dt_imgcache_entry_t *)malloc(sizeof(*e));
+  memset(e, 0, sizeof(*e));
+  snprintf(e->filename, sizeof(e->filename), "%s", filename);
+  e->mtime = st.st_mtim;
+  if(c->num_entries == c->max_entries)
+  {
+    c->max_entries = c->max_entries ? 2*c->max_entries : 16;
+    c->entry = (dt_imgcache_entry_t **)realloc(c->entry, sizeof(dt_imgcache_entry_t*)*c->max_entries);
+  }
+  c->entry[c->num_entries++] = e;
+  pthread_mutex_unlock(&c->mutex);
+  return 0;
+}
+
+static inline int
+dt_imgcache_placeholder(dt_imgcache_t *c, const char *filename)
+{ // call with the mutex held
+  for(int i=0;i<c->num_entries;i++)
+    if(!c->entry[i]->data && !strcmp(c->entry[i]->filename, filename))
+      return i;
+  return -1;
+}
+
+// hand the decoded data for a miss in get to the cache and take a reference
+// on its entry. waiting threads will pick it up.
+static inline dt_imgcache_entry_t*
+dt_imgcache_put(
+    dt_imgcache_t           *c,
+    const char              *filename,
+    const dt_image_params_t *img_param,
+    uint32_t                 wd,
+    uint32_t                 ht,
+    void                    *data,
+    uint64_t                 size,
+    void                   (*free_data)(void *))
+{
+  pthread_mutex_lock(&c->mutex);
+  const int i = dt_imgcache_placeholder(c, filename);
+  assert(i >= 0); // put without a miss in get
+  dt_imgcache_entry_t *e = c->entry[i];
+  e->size      = size;
+  e->ref       = 1;
+  e->img_param = *img_param;
+  e->wd        = wd;
+  e->ht        = ht;
+  e->data      = data;
+  e->free      = free_data;
+  e->lru       = c->clock++;
+  c->size += size;
+  dt_imgcache_evict(c);
+  pthread_cond_broadcast(&c->done);
+  pthread_mutex_unlock(&c->mutex);
+  return e;
+}
+
+// decoding after a miss in get failed, drop the placeholder.
+static inline void
+dt_imgcache_abort(dt_imgcache_t *c, const char *filename)
+{
+  pthread_mutex_lock(&c->mutex);
+  const int i = dt_imgcache_placeholder(c, filename);
+  if(i >= 0)
+  {
+    free(c->entry[i]);
+    c->entry[i] = c->entry[--c->num_entries];
+  }
+  pthread_cond_broadcast(&c->done);
+  pthread_mutex_unlock(&c->mutex);
+}
+
+// drop the reference taken by get or put. the entry stays cached until it
+// is the least recently used one and the cache is over its limit.
+static inline void
+dt_imgcache_release(dt_imgcache_t *c, dt_imgcache_entry_t *e)
+{
+  if(!e) return;
+  pthread_mutex_lock(&c->mutex);
+  e->ref--;
+  dt_imgcache_evict(c);
+  pthread_mutex_unlock(&c->mutex);
+}
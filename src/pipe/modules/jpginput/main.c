@@ -1,17 +1,28 @@
 #include "modules/api.h"
+#include "modules/imgcache.h"
+#include "core/core.h"
 
 #include <jpeglib.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <linux/limits.h>
 #include <setjmp.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// decoded images, shared by all instances in all graphs
+static dt_imgcache_t cache = DT_IMGCACHE_INIT;
+
+#define JPG_STRIP_HT 256 // don't split the decode into strips smaller than this
 
 typedef struct jpginput_buf_t
 {
-  char filename[PATH_MAX];
-  uint32_t width, height;
-  struct jpeg_decompress_struct dinfo;
-  FILE *f;
+  dt_imgcache_entry_t *img;                // full size rgba image in the cache
+  char                 filename[PATH_MAX]; // the header below is read from this
+  uint32_t             wd, ht;             // full size from the header
+  int                  denom;              // of the scaled image, 0 if there is none
+  uint8_t             *scaled;             // rgba image at 1/denom size, private to this instance
+  uint32_t             scaled_wd, scaled_ht;
 }
 jpginput_buf_t;
 
@@ -30,103 +41,256 @@ error_exit(j_common_ptr cinfo)
   longjmp(myerr->setjmp_buffer, 1);
 }
 
-static int 
-read_header(
-    dt_module_t *mod,
-    const char *filename)
+// the compressed file in memory, decoded into rows [y0, y1) of the output
+typedef struct jpgstrip_t
 {
-  jpginput_buf_t *jpg = mod->data;
-  if(jpg && !strcmp(jpg->filename, filename))
-    return 0; // already loaded
-  assert(jpg); // this should be inited in init()
+  const uint8_t *file;
+  size_t         file_size;
+  int            denom;
+  uint32_t       y0, y1;
+  uint8_t       *out;  // rgba, rows of 4*wd bytes
+  int            err;
+}
+jpgstrip_t;
 
-  jpg->f = fopen(filename, "rb");
-  if(!jpg->f) return 1;
+// setup decompression from memory at 1/denom scale. with libjpeg-turbo the
+// colour conversion writes rgba straight away (simd), otherwise we expand rgb.
+static void
+jpeg_setup(
+    struct jpeg_decompress_struct *dinfo,
+    const uint8_t *file,
+    size_t         file_size,
+    int            denom)
+{
+  jpeg_create_decompress(dinfo);
+  jpeg_mem_src(dinfo, (unsigned char *)file, file_size);
+  jpeg_read_header(dinfo, TRUE);
+  dinfo->scale_num   = 1;
+  dinfo->scale_denom = denom;
+#ifdef JCS_ALPHA_EXTENSIONS
+  dinfo->out_color_space = JCS_EXT_RGBA;
+#else
+  dinfo->out_color_space = JCS_RGB;
+#endif
+  jpeg_calc_output_dimensions(dinfo);
+}
 
+static void*
+jpeg_decode_strip(void *arg)
+{
+  jpgstrip_t *s = arg;
+  struct jpeg_decompress_struct dinfo;
   jpgerr_t err;
-  jpg->dinfo.err = jpeg_std_error(&err.pub);
+  uint8_t *volatile row = 0;
+  dinfo.err = jpeg_std_error(&err.pub);
   err.pub.error_exit = error_exit;
   if(setjmp(err.setjmp_buffer))
   {
-    jpeg_destroy_decompress(&(jpg->dinfo));
-    fclose(jpg->f);
-    jpg->filename[0] = 0;
-    return 1;
+    jpeg_destroy_decompress(&dinfo);
+    free(row);
+    s->err = 1;
+    return 0;
   }
-  jpeg_create_decompress(&(jpg->dinfo));
-  jpeg_stdio_src(&(jpg->dinfo), jpg->f);
-  // setup_read_exif(&(jpg->dinfo));
-  // setup_read_icc_profile(&(jpg->dinfo));
-  // jpg->dinfo.buffered_image = TRUE;
-  jpeg_read_header(&(jpg->dinfo), TRUE);
-  jpg->dinfo.out_color_space = JCS_RGB;
-  jpg->dinfo.out_color_components = 3;
-  jpg->width = jpg->dinfo.image_width;
-  jpg->height = jpg->dinfo.image_height;
-
-  for(int k=0;k<4;k++)
+  jpeg_setup(&dinfo, s->file, s->file_size, s->denom);
+  (void)jpeg_start_decompress(&dinfo);
+  const uint32_t wd = dinfo.output_width;
+#ifdef LIBJPEG_TURBO_VERSION
+  // still has to run the entropy decoder over the rows above us, but skips
+  // the idct and colour conversion, which is where the time goes:
+  if(s->y0) jpeg_skip_scanlines(&dinfo, s->y0);
+#else
+  assert(s->y0 == 0);
+#endif
+  while(dinfo.output_scanline < s->y1)
   {
-    mod->img_param.black[k]        = 0.0f;
-    mod->img_param.white[k]        = 1.0f;
-    mod->img_param.whitebalance[k] = 1.0f;
+    uint8_t *out = s->out + 4 * wd * dinfo.output_scanline;
+#ifdef JCS_ALPHA_EXTENSIONS
+    JSAMPROW rows[16];
+    const int num = MIN(16, s->y1 - dinfo.output_scanline);
+    for(int j=0;j<num;j++) rows[j] = out + 4 * wd * j;
+    if(jpeg_read_scanlines(&dinfo, rows, num) == 0) longjmp(err.setjmp_buffer, 1);
+#else
+    if(!row) row = malloc(3 * wd);
+    JSAMPROW row_pointer[1] = { row };
+    if(jpeg_read_scanlines(&dinfo, row_pointer, 1) != 1) longjmp(err.setjmp_buffer, 1);
+    for(unsigned int i = 0; i < wd; i++)
+    {
+      for(int k=0;k<3;k++) out[4 * i + k] = row[3 * i + k];
+      out[4 * i + 3] = 255;
+    }
+#endif
   }
-  mod->img_param.filters = 0;
-
-  snprintf(jpg->filename, sizeof(jpg->filename), "%s", filename);
+  // we may not have read all rows, so abort instead of finish:
+  jpeg_abort_decompress(&dinfo);
+  jpeg_destroy_decompress(&dinfo);
+  free(row);
   return 0;
 }
 
-static int
-read_plain(
-    jpginput_buf_t *jpg, uint8_t *out)
+// decode the whole image to rgba at 1/denom size (1, 2, 4, 8) in the dct
+// domain. large images are decoded in horizontal strips on all cores.
+// returns 0 on failure.
+static uint8_t*
+jpeg_decode(
+    const char *filename,
+    int         denom,
+    uint32_t   *wd,
+    uint32_t   *ht)
 {
-  JSAMPROW row_pointer[1];
-  row_pointer[0] = malloc(jpg->dinfo.output_width * jpg->dinfo.num_components);
-  uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  FILE *f = fopen(filename, "rb");
+  if(!f) return 0;
+  fseek(f, 0, SEEK_END);
+  const size_t file_size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *file = malloc(file_size);
+  const int rd = fread(file, 1, file_size, f) == file_size;
+  fclose(f);
+  if(!rd)
   {
-    if(jpeg_read_scanlines(&(jpg->dinfo), row_pointer, 1) != 1)
-    {
-      jpeg_destroy_decompress(&(jpg->dinfo));
-      free(row_pointer[0]);
-      fclose(jpg->f);
-      jpg->filename[0] = 0;
-      return 1;
+    free(file);
+    return 0;
+  }
+
+  struct jpeg_decompress_struct dinfo;
+  jpgerr_t err;
+  dinfo.err = jpeg_std_error(&err.pub);
+  err.pub.error_exit = error_exit;
+  if(setjmp(err.setjmp_buffer))
+  {
+    jpeg_destroy_decompress(&dinfo);
+    free(file);
+    return 0;
+  }
+  jpeg_setup(&dinfo, file, file_size, denom);
+  *wd = dinfo.output_width;
+  *ht = dinfo.output_height;
+  // progressive files would be decoded completely by every strip
+  const int progressive = dinfo.progressive_mode;
+  jpeg_destroy_decompress(&dinfo);
+
+  int num_strips = 1;
+#ifdef LIBJPEG_TURBO_VERSION
+  if(!progressive)
+    num_strips = CLAMP(*ht / JPG_STRIP_HT, 1, sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+  uint8_t *out = malloc(sizeof(uint8_t) * 4 * *wd * *ht);
+  jpgstrip_t strip[num_strips];
+  pthread_t  thread[num_strips];
+  for(int s=0;s<num_strips;s++)
+  {
+    strip[s] = (jpgstrip_t) {
+      .file      = file,
+      .file_size = file_size,
+      .denom     = denom,
+      .y0        = (uint64_t)*ht * s / num_strips,
+      .y1        = (uint64_t)*ht * (s+1) / num_strips,
+      .out       = out,
+    };
+    if(s && pthread_create(thread + s, 0, jpeg_decode_strip, strip + s))
+    { // decode it on this thread below
+      strip[s].err = -1;
     }
-    for(unsigned int i = 0; i < jpg->dinfo.image_width; i++)
-      for(int k = 0; k < 3; k++) tmp[4 * i + k] = row_pointer[0][3 * i + k];
-    tmp += 4 * jpg->width;
   }
-  free(row_pointer[0]);
-  return 0;
+  jpeg_decode_strip(strip);
+  int fail = strip[0].err;
+  for(int s=1;s<num_strips;s++)
+  {
+    if(strip[s].err == -1) jpeg_decode_strip(strip + s);
+    else pthread_join(thread[s], 0);
+    fail |= strip[s].err > 0;
+  }
+  free(file);
+  if(fail)
+  {
+    free(out);
+    return 0;
+  }
+  return out;
 }
 
+// read the full image dimensions, without decoding
 static int
-jpeg_read(
-    jpginput_buf_t *jpg, uint8_t *out)
+jpeg_header(
+    jpginput_buf_t *jpg,
+    const char     *filename)
 {
+  if(!strcmp(jpg->filename, filename)) return 0;
+  free(jpg->scaled);
+  jpg->scaled = 0;
+  jpg->denom = 0;
+  jpg->filename[0] = 0;
+  FILE *f = fopen(filename, "rb");
+  if(!f) return 1;
+  struct jpeg_decompress_struct dinfo;
   jpgerr_t err;
-  jpg->dinfo.err = jpeg_std_error(&err.pub);
+  dinfo.err = jpeg_std_error(&err.pub);
   err.pub.error_exit = error_exit;
   if(setjmp(err.setjmp_buffer))
   {
-    jpeg_destroy_decompress(&(jpg->dinfo));
-    fclose(jpg->f);
-    jpg->filename[0] = 0;
+    jpeg_destroy_decompress(&dinfo);
+    fclose(f);
     return 1;
   }
-
-  (void)jpeg_start_decompress(&(jpg->dinfo));
-  read_plain(jpg, out);
-  (void)jpeg_finish_decompress(&(jpg->dinfo));
-  // i think libjpeg doesn't want us to retain the state, at least not the way
-  // by splitting here. so we'll just clean it all up:
-  jpeg_destroy_decompress(&(jpg->dinfo));
-  fclose(jpg->f);
-  jpg->filename[0] = 0;
+  jpeg_create_decompress(&dinfo);
+  jpeg_stdio_src(&dinfo, f);
+  jpeg_read_header(&dinfo, TRUE);
+  jpg->wd = dinfo.image_width;
+  jpg->ht = dinfo.image_height;
+  jpeg_destroy_decompress(&dinfo);
+  fclose(f);
+  snprintf(jpg->filename, sizeof(jpg->filename), "%s", filename);
   return 0;
 }
 
+// largest dct domain downscaling which still has enough pixels for the roi
+static int
+scale_denom(float scale)
+{
+  int denom = 1;
+  while(denom < 8 && 2*denom <= scale) denom *= 2;
+  return denom;
+}
+
+// get the decoded image from the cache or decode it, returns 0 on failure
+static dt_imgcache_entry_t*
+load(const char *filename)
+{
+  dt_imgcache_entry_t *img = dt_imgcache_get(&cache, filename);
+  if(img) return img;
+
+  uint32_t wd, ht;
+  uint8_t *buf = jpeg_decode(filename, 1, &wd, &ht);
+  if(!buf)
+  {
+    dt_imgcache_abort(&cache, filename);
+    return 0;
+  }
+  dt_image_params_t img_param;
+  for(int k=0;k<4;k++)
+  {
+    img_param.black[k]        = 0.0f;
+    img_param.white[k]        = 1.0f;
+    img_param.whitebalance[k] = 1.0f;
+  }
+  img_param.filters = 0;
+  return dt_imgcache_put(&cache, filename, &img_param, wd, ht,
+      buf, sizeof(uint8_t) * 4 * wd * ht, free);
+}
+
+static int
+load_jpg(
+    dt_module_t *mod,
+    const char *filename)
+{
+  jpginput_buf_t *jpg = mod->data;
+  assert(jpg); // this should be inited in init()
+  if(jpg->img && !strcmp(jpg->img->filename, filename))
+    return 0; // already loaded
+  dt_imgcache_release(&cache, jpg->img); // different image
+  jpg->img = load(filename);
+  return jpg->img == 0;
+}
+
 int init(dt_module_t *mod)
 {
   jpginput_buf_t *dat = malloc(sizeof(*dat));
@@ -139,37 +303,116 @@ void cleanup(dt_module_t *mod)
 {
   if(!mod->data) return;
   jpginput_buf_t *jpg = mod->data;
-  jpeg_destroy_decompress(&(jpg->dinfo));
-  if(jpg->filename[0])
-  {
-    if(jpg->f) fclose(jpg->f);
-    jpg->filename[0] = 0;
-  }
+  dt_imgcache_release(&cache, jpg->img);
+  free(jpg->scaled);
   free(jpg);
   mod->data = 0;
 }
 
+// decode at 1/denom size for this instance only, previews are cheap enough
+static int
+load_scaled(
+    dt_module_t *mod,
+    const char  *filename,
+    int          denom)
+{
+  jpginput_buf_t *jpg = mod->data;
+  if(jpeg_header(jpg, filename)) return 1;
+  if(jpg->denom == denom) return 0;
+  free(jpg->scaled);
+  jpg->scaled = jpeg_decode(filename, denom, &jpg->scaled_wd, &jpg->scaled_ht);
+  jpg->denom = jpg->scaled ? denom : 0;
+  return jpg->scaled == 0;
+}
+
 // this callback is responsible to set the full_{wd,ht} dimensions on the
-// regions of interest on all "write"|"source" channels
+// regions of interest on all "write"|"source" channels. we only need the
+// header for this, decoding waits until we know the scale of the roi.
 void modify_roi_out(
     dt_graph_t  *graph,
     dt_module_t *mod)
 {
-  // load image if not happened yet
   const char *filename = dt_module_param_string(mod, 0);
-  if(read_header(mod, filename)) return;
   jpginput_buf_t *jpg = mod->data;
-  mod->connector[0].roi.full_wd = jpg->width;
-  mod->connector[0].roi.full_ht = jpg->height;
+  if(jpeg_header(jpg, filename)) return;
+  mod->connector[0].roi.full_wd = jpg->wd;
+  mod->connector[0].roi.full_ht = jpg->ht;
+  for(int k=0;k<4;k++)
+  {
+    mod->img_param.black[k]        = 0.0f;
+    mod->img_param.white[k]        = 1.0f;
+    mod->img_param.whitebalance[k] = 1.0f;
+  }
+  mod->img_param.filters = 0;
 }
 
+// the roi may be a strip if the graph is processed in tiles or a band of
+// the staging ring. the full size image is cached, so we only copy rows.
+// downscaled rois are decoded at the closest larger dct scale and sampled
+// from there.
 int read_source(
     dt_module_t *mod,
     void *mapped)
 {
   const char *filename = dt_module_param_string(mod, 0);
-  if(read_header(mod, filename)) return 1;
   jpginput_buf_t *jpg = mod->data;
-  jpeg_read(jpg, mapped);
+  const dt_roi_t *roi = &mod->connector[0].roi;
+  const int denom = scale_denom(roi->scale);
+  const uint8_t *in;
+  uint32_t wd, ht;
+  if(denom > 1)
+  {
+    if(load_scaled(mod, filename, denom)) return 1;
+    in = jpg->scaled;
+    wd = jpg->scaled_wd;
+    ht = jpg->scaled_ht;
+  }
+  else
+  {
+    if(load_jpg(mod, filename)) return 1;
+    in = jpg->img->data;
+    wd = jpg->img->wd;
+    ht = jpg->img->ht;
+  }
+  uint8_t *out = mapped;
+  if(roi->scale == denom)
+  {
+    for(unsigned int j = 0; j < roi->ht; j++)
+      memcpy(out + 4 * roi->wd * j,
+          in + 4 * (wd * (roi->y / denom + j) + roi->x / denom),
+          sizeof(uint8_t) * 4 * roi->wd);
+    return 0;
+  }
+  for(unsigned int j = 0; j < roi->ht; j++)
+  {
+    const uint32_t y = MIN(ht-1, (roi->y + j * roi->scale) / denom);
+    for(unsigned int i = 0; i < roi->wd; i++)
+    {
+      const uint32_t x = MIN(wd-1, (roi->x + i * roi->scale) / denom);
+      memcpy(out + 4 * (roi->wd * j + i), in + 4 * (wd * y + x), 4);
+    }
+  }
   return 0;
 }
+
+// let the graph copy straight from the cached image if it can
+const void *source_ptr(
+    dt_module_t *mod,
+    size_t *pitch)
+{
+  const dt_roi_t *roi = &mod->connector[0].roi;
+  if(roi->scale != 1.0f) return 0;
+  const char *filename = dt_module_param_string(mod, 0);
+  if(load_jpg(mod, filename)) return 0;
+  jpginput_buf_t *jpg = mod->data;
+  *pitch = sizeof(uint8_t) * 4 * jpg->img->wd;
+  return (const uint8_t *)jpg->img->data + 4 * (jpg->img->wd * roi->y + roi->x);
+}
+
+// decode into the cache on a worker thread, before the file is opened
+int prefetch(const char *filename)
+{
+  dt_imgcache_entry_t *img = load(filename);
+  dt_imgcache_release(&cache, img);
+  return img == 0;
+}
@@ -20,6 +20,13 @@ commit_params(
 }
 #endif
 
+// the coarsest levels of the pyramid see the whole image
+int
+halo(dt_module_t *module)
+{
+  return -1;
+}
+
 void
 create_nodes(
     dt_graph_t  *graph,
@@ -63,8 +70,7 @@ create_nodes(
   const int num_gamma = 6;
 #endif
 
-  assert(graph->num_nodes < graph->max_nodes);
-  const int id_curve = graph->num_nodes++;
+  const int id_curve = dt_node_add(graph);
   dt_node_t *node_curve = graph->node + id_curve;
   *node_curve = (dt_node_t) {
     .name   = dt_token("llap"),
@@ -126,8 +132,7 @@ create_nodes(
     for(int k=0;k<num_gamma+1;k++)
     { // for all brightness levels gamma:
       // one reduce node taking this gamma one coarser
-      assert(graph->num_nodes < graph->max_nodes);
-      id_reduce[l][k] = graph->num_nodes++;
+      id_reduce[l][k] = dt_node_add(graph);
       cn_reduce[l][k] = 1;
       dt_node_t *node_reduce = graph->node + id_reduce[l][k];
       *node_reduce = (dt_node_t) {
@@ -152,8 +157,7 @@ create_nodes(
     // output:
     // - next finer output pyramid
     // const float scale = l/(nl-1.0);
-    assert(graph->num_nodes < graph->max_nodes);
-    id_assemble[l] = graph->num_nodes++;
+    id_assemble[l] = dt_node_add(graph);
     dt_node_t *node_assemble = graph->node + id_assemble[l];
     *node_assemble = (dt_node_t) {
       .name   = dt_token("llap"),
@@ -204,8 +208,7 @@ create_nodes(
   cy.name = dt_token("inlum");
   co.chan = dt_token("rgba");
   co.name = dt_token("output");
-  assert(graph->num_nodes < graph->max_nodes);
-  const int id_col = graph->num_nodes++;
+  const int id_col = dt_node_add(graph);
   dt_node_t *node_col = graph->node + id_col;
   *node_col = (dt_node_t) {
     .name   = dt_token("llap"),
@@ -239,8 +242,7 @@ create_nodes(
   co.name = dt_token("output");
   ci.roi  = graph->node[id_assemble[nl-1]].connector[1].roi;
   co.roi  = graph->node[id_assemble[nl-1]].connector[1].roi;
-  assert(graph->num_nodes < graph->max_nodes);
-  const int id_film = graph->num_nodes++;
+  const int id_film = dt_node_add(graph);
   dt_node_t *node_film = graph->node + id_film;
   *node_film = (dt_node_t) {
     .name   = dt_token("filmcurv"),
@@ -1,10 +1,19 @@
 // unfortunately we'll link to rawspeed, so we need c++ here.
 #include "RawSpeed-API.h"
 #include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <mutex>
+#include <vector>
+#include <algorithm>
 
 extern "C" {
 #include "modules/api.h"
+#include "modules/imgcache.h"
+#include "core/core.h"
 
 static rawspeed::CameraMetaData *meta = 0;
 
@@ -15,17 +24,52 @@ int rawspeed_get_number_of_processor_cores()
   return sysconf(_SC_NPROCESSORS_ONLN);
 }
 
-typedef struct rawinput_buf_t
-{
-  std::unique_ptr<rawspeed::RawDecoder> d;
-  std::unique_ptr<const rawspeed::Buffer> m;
+// decoded images, shared by all instances in all graphs
+static dt_imgcache_t cache = DT_IMGCACHE_INIT;
 
-  char filename[PATH_MAX] = {0};
+// what the image cache holds for us: the cfa plane, cropped to start at a
+// full block and to a multiple of the block size. it either lives in the
+// image decoded by rawspeed or in a mapped cache file.
+typedef struct rawinput_img_t
+{
+  rawspeed::RawImage *raw;      // decoded image, or 0 if mapped
+  void               *map;      // mapped cache file, or 0 if decoded
+  size_t              map_size;
+  const uint8_t      *data;     // top left pixel of the cropped plane
+  size_t              pitch;    // in bytes
+  int                 ox, oy;   // of the cropped plane in the uncropped image
+}
+rawinput_img_t;
 
-  int ox, oy;
+typedef struct rawinput_buf_t
+{
+  dt_imgcache_entry_t *img; // holds a rawinput_img_t
 }
 rawinput_buf_t;
 
+// optional on-disk cache of the cropped cfa plane, so opening the same file
+// again does not need to run rawspeed. switched on by setting VKDT_RAW_CACHE
+// to the size limit in megabytes. the files go to $XDG_CACHE_HOME/vkdt/raw,
+// are named after a hash of the path of the raw, and are only used if size
+// and modification time of the raw match the ones in the header. the oldest
+// files are deleted when the limit is exceeded.
+#define RAWCACHE_MAGIC   0x63727464u // "dtrc"
+#define RAWCACHE_VERSION 1
+#define RAWCACHE_DATA    4096        // offset of the pixels, page aligned so they can be imported
+
+typedef struct rawcache_header_t
+{
+  uint32_t          magic, version;
+  uint64_t          src_size;       // of the raw file
+  int64_t           src_mtime_sec;  // modification time of the raw file
+  int64_t           src_mtime_nsec;
+  uint32_t          wd, ht;         // of the cropped ui16 plane
+  int32_t           ox, oy;         // of the cropped plane in the uncropped image
+  dt_image_params_t img_param;
+}
+rawcache_header_t;
+static_assert(sizeof(rawcache_header_t) <= RAWCACHE_DATA, "raw cache header too large");
+
 namespace {
 
 // TODO: put in header!
@@ -72,59 +116,341 @@ rawspeed_load_meta()
   }
 }
 
+void
+free_img(void *data)
+{
+  rawinput_img_t *img = (rawinput_img_t *)data;
+  if(img->map) munmap(img->map, img->map_size);
+  delete img->raw;
+  delete img;
+}
+
+inline const rawinput_img_t *
+get_img(rawinput_buf_t *mod_data)
+{
+  return (const rawinput_img_t *)mod_data->img->data;
+}
+
+// size limit of the disk cache in bytes, 0 if switched off
+uint64_t
+rawcache_limit()
+{
+  const char *limit = getenv("VKDT_RAW_CACHE");
+  return limit ? strtoull(limit, 0, 10) << 20 : 0;
+}
+
 int
-load_raw(
-    dt_module_t *mod,
-    const char *filename)
+rawcache_dir(char *dir, size_t size)
 {
-  rawinput_buf_t *mod_data = (rawinput_buf_t *)mod->data;
-  if(mod_data)
+  const char *xdg  = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if(xdg && xdg[0]) snprintf(dir, size, "%s/vkdt", xdg);
+  else if(home)     snprintf(dir, size, "%s/.cache/vkdt", home);
+  else return 1;
+  if(mkdir(dir, 0755) && errno != EEXIST) return 1;
+  const size_t len = strlen(dir);
+  snprintf(dir + len, size - len, "/raw");
+  if(mkdir(dir, 0755) && errno != EEXIST) return 1;
+  return 0;
+}
+
+void
+rawcache_filename(const char *dir, const char *filename, char *cachefile, size_t size)
+{
+  char path[PATH_MAX];
+  if(!realpath(filename, path)) snprintf(path, sizeof(path), "%s", filename);
+  snprintf(cachefile, size, "%s/%016lx.raw", dir,
+      (unsigned long)dt_hash(DT_HASH_INIT, path, strlen(path)));
+}
+
+// delete the least recently used cache files until at most size bytes remain
+void
+rawcache_evict(const char *dir, uint64_t size)
+{
+  DIR *dp = opendir(dir);
+  if(!dp) return;
+  struct file_t { std::string name; uint64_t size; time_t mtime; };
+  std::vector<file_t> files;
+  uint64_t total = 0;
+  struct dirent *ep;
+  while((ep = readdir(dp)))
   {
-    if(!strcmp(mod_data->filename, filename))
-      return 0; // already loaded
+    const size_t len = strlen(ep->d_name);
+    if(len < 4 || strcmp(ep->d_name + len - 4, ".raw")) continue;
+    std::string name = std::string(dir) + "/" + ep->d_name;
+    struct stat st;
+    if(stat(name.c_str(), &st)) continue;
+    files.push_back({name, (uint64_t)st.st_size, st.st_mtime});
+    total += st.st_size;
   }
-  else
+  closedir(dp);
+  if(total <= size) return;
+  std::sort(files.begin(), files.end(),
+      [](const file_t &a, const file_t &b) { return a.mtime < b.mtime; });
+  for(size_t i=0;i<files.size() && total > size;i++)
+    if(!unlink(files[i].name.c_str())) total -= files[i].size;
+}
+
+// map the cache file of the raw if there is a valid one, 0 otherwise
+rawinput_img_t *
+rawcache_read(
+    const char        *filename,
+    dt_image_params_t *img_param,
+    uint32_t          *wd,
+    uint32_t          *ht)
+{
+  char dir[1024], cachefile[1280];
+  struct stat st, cst;
+  if(stat(filename, &st) || rawcache_dir(dir, sizeof(dir))) return 0;
+  rawcache_filename(dir, filename, cachefile, sizeof(cachefile));
+  int fd = open(cachefile, O_RDONLY);
+  if(fd < 0) return 0;
+  rawcache_header_t h;
+  if(fstat(fd, &cst) || read(fd, &h, sizeof(h)) != sizeof(h) ||
+     h.magic != RAWCACHE_MAGIC || h.version != RAWCACHE_VERSION ||
+     h.src_size != (uint64_t)st.st_size ||
+     h.src_mtime_sec  != st.st_mtim.tv_sec ||
+     h.src_mtime_nsec != st.st_mtim.tv_nsec ||
+     (uint64_t)cst.st_size != RAWCACHE_DATA + sizeof(uint16_t) * (uint64_t)h.wd * h.ht)
   {
-    assert(0); // this should be inited in init()
+    close(fd);
+    return 0;
   }
+  void *map = mmap(0, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  futimens(fd, 0); // mark as recently used
+  close(fd);
+  if(map == MAP_FAILED) return 0;
+  rawinput_img_t *img = new rawinput_img_t();
+  img->map      = map;
+  img->map_size = cst.st_size;
+  img->data     = (const uint8_t *)map + RAWCACHE_DATA;
+  img->pitch    = sizeof(uint16_t) * h.wd;
+  img->ox       = h.ox;
+  img->oy       = h.oy;
+  *img_param    = h.img_param;
+  *wd           = h.wd;
+  *ht           = h.ht;
+  return img;
+}
 
-  snprintf(mod_data->filename, sizeof(mod_data->filename), "%s", filename);
-  rawspeed::FileReader f(mod_data->filename);
+// write the cropped plane to the disk cache, if it fits the size limit.
+// goes through a temporary file so concurrent readers never see half of it.
+void
+rawcache_write(
+    const char              *filename,
+    const rawinput_img_t    *img,
+    const dt_image_params_t *img_param,
+    uint32_t                 wd,
+    uint32_t                 ht,
+    uint64_t                 limit)
+{
+  char dir[1024], cachefile[1280], tmpfile[1300];
+  struct stat st;
+  const uint64_t size = RAWCACHE_DATA + sizeof(uint16_t) * (uint64_t)wd * ht;
+  if(size > limit || stat(filename, &st) || rawcache_dir(dir, sizeof(dir))) return;
+  rawcache_filename(dir, filename, cachefile, sizeof(cachefile));
+  rawcache_evict(dir, limit - size);
+  snprintf(tmpfile, sizeof(tmpfile), "%s.XXXXXX", cachefile);
+  int fd = mkstemp(tmpfile);
+  if(fd < 0) return;
+  FILE *f = fdopen(fd, "wb");
+  if(!f)
+  {
+    close(fd);
+    unlink(tmpfile);
+    return;
+  }
+  uint8_t header[RAWCACHE_DATA] = {0};
+  rawcache_header_t *h = (rawcache_header_t *)header;
+  h->magic          = RAWCACHE_MAGIC;
+  h->version        = RAWCACHE_VERSION;
+  h->src_size       = st.st_size;
+  h->src_mtime_sec  = st.st_mtim.tv_sec;
+  h->src_mtime_nsec = st.st_mtim.tv_nsec;
+  h->wd             = wd;
+  h->ht             = ht;
+  h->ox             = img->ox;
+  h->oy             = img->oy;
+  h->img_param      = *img_param;
+  int err = fwrite(header, sizeof(header), 1, f) != 1;
+  for(uint32_t j=0;j<ht&&!err;j++)
+    err = fwrite(img->data + img->pitch * j, sizeof(uint16_t) * wd, 1, f) != 1;
+  err |= fclose(f) != 0;
+  if(err || rename(tmpfile, cachefile)) unlink(tmpfile);
+}
+
+// offset of the first full block of the sensor filter pattern
+void
+cfa_offset(
+    const rawspeed::RawImage &raw,
+    const uint32_t filters,
+    int *ox_out, int *oy_out)
+{
+  int ox = 0, oy = 0;
+
+  // special handling for x-trans sensors
+  if(filters == 9u)
+  {
+    uint8_t f[6][6];
+    // get 6x6 CFA offset from top left of cropped image
+    // NOTE: This is different from how things are done with Bayer
+    // sensors. For these, the CFA in cameras.xml is pre-offset
+    // depending on the distance modulo 2 between raw and usable
+    // image data. For X-Trans, the CFA in cameras.xml is
+    // (currently) aligned with the top left of the raw data.
+    for(int i = 0; i < 6; ++i)
+      for(int j = 0; j < 6; ++j)
+        f[j][i] = raw->cfa.getColorAt(i, j);
+
+    // find first green in same row
+    for(ox=0;ox<6&&FCxtrans(0,ox,f)!=1;ox++)
+      ;
+    if(FCxtrans(0,ox+1,f) != 1 && FCxtrans(0,ox+2,f) != 1) // center of x-cross, need to go 2 down
+    {
+      oy = 2;
+      ox = (ox + 2) % 3;
+    }
+    if(FCxtrans(oy+1,ox,f) == 1) // two greens above one another, nede to go down one
+      oy++;
+    if(FCxtrans(oy,ox+1,f) == 1)
+    { // if x+1 is green, too, either x++ or x-=2 if x>=2
+      if(ox >= 2) ox -= 2;
+      else ox++;
+    }
+    // now we should be at the beginning of a green 5-cross block.
+    if(FCxtrans(oy,ox+1,f) == 2)
+    { // if x+1 == red and y+1 == blue, all good!
+      // if not, x+=3 or y+=3, equivalently.
+      if(ox < oy) ox += 3;
+      else        oy += 3;
+    }
+  }
+  else
+  {
+    if(FC(0,0,filters) == 1)
+    {
+      if(FC(0,1,filters) == 0) ox = 1;
+      if(FC(0,1,filters) == 2) oy = 1;
+    }
+    else if(FC(0,0,filters) == 2)
+    {
+      ox = oy = 1;
+    }
+  }
+  *ox_out = ox;
+  *oy_out = oy;
+}
 
+// get the decoded image from the cache, the disk cache, or decode it.
+// returns 0 on failure.
+dt_imgcache_entry_t *
+load(const char *filename)
+{
+  dt_imgcache_entry_t *entry = dt_imgcache_get(&cache, filename);
+  if(entry) return entry;
+
+  const uint64_t limit = rawcache_limit();
+  dt_image_params_t img_param;
+  uint32_t wd, ht;
+  rawinput_img_t *img = limit ? rawcache_read(filename, &img_param, &wd, &ht) : 0;
+  if(img)
+    return dt_imgcache_put(&cache, filename, &img_param, wd, ht,
+        img, img->map_size, free_img);
+
+  rawspeed::RawImage *raw = 0;
   try
   {
     rawspeed_load_meta();
 
-    mod_data->m = f.readFile();
+    // the file buffer and the decoder only live until the image is decoded,
+    // the cache keeps the image only:
+    {
+      rawspeed::FileReader f(filename);
+      std::unique_ptr<const rawspeed::Buffer> m = f.readFile();
+      rawspeed::RawParser t(m.get());
+      std::unique_ptr<rawspeed::RawDecoder> d = t.getDecoder(meta);
 
-    rawspeed::RawParser t(mod_data->m.get());
-    mod_data->d = t.getDecoder(meta);
+      if(!d.get())
+      {
+        dt_imgcache_abort(&cache, filename);
+        return 0;
+      }
 
-    if(!mod_data->d.get()) return 1;
+      d->failOnUnknown = true;
+      d->checkSupport(meta);
+      d->decodeRaw();
+      d->decodeMetaData(meta);
 
-    mod_data->d->failOnUnknown = true;
-    mod_data->d->checkSupport(meta);
-    mod_data->d->decodeRaw();
-    mod_data->d->decodeMetaData(meta);
+      const auto errors = d->mRaw->getErrors();
+      for(const auto &error : errors) fprintf(stderr, "[rawspeed] (%s) %s\n", filename, error.c_str());
 
-    const auto errors = mod_data->d->mRaw->getErrors();
-    for(const auto &error : errors) fprintf(stderr, "[rawspeed] (%s) %s\n", mod_data->filename, error.c_str());
+      // TODO: do some corruption detection and support for esoteric formats/fails here
+      raw = new rawspeed::RawImage(d->mRaw);
+    }
 
-    // TODO: do some corruption detection and support for esoteric formats/fails here
+    // the cached image is shared read only, so do everything that writes to it now:
+    if((*raw)->blackLevelSeparate[0] == -1)
+      (*raw)->calculateBlackAreas();
+    for(int k=0;k<4;k++)
+    {
+      img_param.black[k]        = (*raw)->blackLevelSeparate[k];
+      img_param.white[k]        = (*raw)->whitePoint;
+      img_param.whitebalance[k] = (*raw)->metadata.wbCoeffs[k] * 1.0f/1024.0f;
+    }
+    // TODO: xtrans
+    // uncrop bayer sensor filter
+    rawspeed::iPoint2D cropTL = (*raw)->getCropOffset();
+    img_param.filters = (*raw)->cfa.getDcrawFilter();
+    if(img_param.filters != 9u)
+      img_param.filters = rawspeed::ColorFilterArray::shiftDcrawFilter(
+          (*raw)->cfa.getDcrawFilter(),
+          cropTL.x, cropTL.y);
+
+    // now we need to account for the pixel shift due to an offset filter,
+    // and round down to full block size:
+    img = new rawinput_img_t();
+    img->raw = raw;
+    cfa_offset(*raw, img_param.filters, &img->ox, &img->oy);
+    rawspeed::iPoint2D dim_uncropped = (*raw)->getUncroppedDim();
+    const int block = img_param.filters == 9u ? 3 : 2;
+    wd = ((dim_uncropped.x - img->ox)/block)*block;
+    ht = ((dim_uncropped.y - img->oy)/block)*block;
+    img->data  = (*raw)->getDataUncropped(img->ox, img->oy);
+    img->pitch = (*raw)->pitch;
+
+    if(limit && (*raw)->getBpp() == sizeof(uint16_t))
+      rawcache_write(filename, img, &img_param, wd, ht, limit);
+    return dt_imgcache_put(&cache, filename, &img_param, wd, ht,
+        img, (uint64_t)(*raw)->pitch * dim_uncropped.y, free_img);
   }
   catch(const std::exception &exc)
   {
-    printf("[rawspeed] (%s) %s\n", mod_data->filename, exc.what());
-    return 1;
+    printf("[rawspeed] (%s) %s\n", filename, exc.what());
   }
   catch(...)
   {
     printf("[rawspeed] unhandled exception in\n");
-    return 1;
   }
+  delete raw;
+  dt_imgcache_abort(&cache, filename);
   return 0;
 }
 
+int
+load_raw(
+    dt_module_t *mod,
+    const char *filename)
+{
+  rawinput_buf_t *mod_data = (rawinput_buf_t *)mod->data;
+  assert(mod_data); // this should be inited in init()
+  if(mod_data->img && !strcmp(mod_data->img->filename, filename))
+    return 0; // already loaded
+  dt_imgcache_release(&cache, mod_data->img); // different image
+  mod_data->img = load(filename);
+  return mod_data->img == 0;
+}
+
+
 } // end anonymous namespace
 
 int init(dt_module_t *mod)
@@ -146,9 +472,7 @@ void cleanup(dt_module_t *mod)
 
   if(!mod->data) return;
   rawinput_buf_t *mod_data = (rawinput_buf_t *)mod->data;
-  /* free auto pointers */
-  mod_data->d.reset();
-  mod_data->m.reset();
+  dt_imgcache_release(&cache, mod_data->img);
   delete mod_data;
   mod->data = 0;
 }
@@ -163,91 +487,14 @@ void modify_roi_out(
   const char *filename = dt_module_param_string(mod, 0);
   if(load_raw(mod, filename)) return;
   rawinput_buf_t *mod_data = (rawinput_buf_t *)mod->data;
-  rawspeed::iPoint2D dim_uncropped = mod_data->d->mRaw->getUncroppedDim();
-  // we know we only have one connector called "output" (see our "connectors" file)
-  mod->connector[0].roi.full_wd = dim_uncropped.x;
-  mod->connector[0].roi.full_ht = dim_uncropped.y;
+  // we know we only have one connector called "output" (see our "connectors" file).
+  // the cached plane is already shifted to the filter offset and rounded to
+  // full blocks.
+  mod->connector[0].roi.full_wd = mod_data->img->wd;
+  mod->connector[0].roi.full_ht = mod_data->img->ht;
 
   // TODO: data type, channels, bpp
-  if(mod_data->d->mRaw->blackLevelSeparate[0] == -1)
-    mod_data->d->mRaw->calculateBlackAreas();
-  for(int k=0;k<4;k++)
-  {
-    mod->img_param.black[k]        = mod_data->d->mRaw->blackLevelSeparate[k];
-    mod->img_param.white[k]        = mod_data->d->mRaw->whitePoint;
-    mod->img_param.whitebalance[k] = mod_data->d->mRaw->metadata.wbCoeffs[k] * 1.0f/1024.0f;
-  }
-  // TODO: xtrans
-  // uncrop bayer sensor filter
-  rawspeed::iPoint2D cropTL = mod_data->d->mRaw->getCropOffset();
-  mod->img_param.filters = mod_data->d->mRaw->cfa.getDcrawFilter();
-  if(mod->img_param.filters != 9u)
-    mod->img_param.filters = rawspeed::ColorFilterArray::shiftDcrawFilter(
-        mod_data->d->mRaw->cfa.getDcrawFilter(),
-        cropTL.x, cropTL.y);
-
-  // now we need to account for the pixel shift due to an offset filter:
-  dt_roi_t *ro = &mod->connector[0].roi;
-  int ox = 0, oy = 0;
-
-  // special handling for x-trans sensors
-  if(mod->img_param.filters == 9u)
-  {
-    uint8_t f[6][6];
-    // get 6x6 CFA offset from top left of cropped image
-    // NOTE: This is different from how things are done with Bayer
-    // sensors. For these, the CFA in cameras.xml is pre-offset
-    // depending on the distance modulo 2 between raw and usable
-    // image data. For X-Trans, the CFA in cameras.xml is
-    // (currently) aligned with the top left of the raw data.
-    for(int i = 0; i < 6; ++i)
-      for(int j = 0; j < 6; ++j)
-        f[j][i] = mod_data->d->mRaw->cfa.getColorAt(i, j);
-
-    // find first green in same row
-    for(ox=0;ox<6&&FCxtrans(0,ox,f)!=1;ox++)
-      ;
-    if(FCxtrans(0,ox+1,f) != 1 && FCxtrans(0,ox+2,f) != 1) // center of x-cross, need to go 2 down
-    {
-      oy = 2;
-      ox = (ox + 2) % 3;
-    }
-    if(FCxtrans(oy+1,ox,f) == 1) // two greens above one another, nede to go down one
-      oy++;
-    if(FCxtrans(oy,ox+1,f) == 1)
-    { // if x+1 is green, too, either x++ or x-=2 if x>=2
-      if(ox >= 2) ox -= 2;
-      else ox++;
-    }
-    // now we should be at the beginning of a green 5-cross block.
-    if(FCxtrans(oy,ox+1,f) == 2)
-    { // if x+1 == red and y+1 == blue, all good!
-      // if not, x+=3 or y+=3, equivalently.
-      if(ox < oy) ox += 3;
-      else        oy += 3;
-    }
-  }
-  else
-  {
-    uint32_t f = mod->img_param.filters;
-    if(FC(0,0,f) == 1)
-    {
-      if(FC(0,1,f) == 0) ox = 1;
-      if(FC(0,1,f) == 2) oy = 1;
-    }
-    else if(FC(0,0,f) == 2)
-    {
-      ox = oy = 1;
-    }
-  }
-  mod_data->ox = ox;
-  mod_data->oy = oy;
-  ro->full_wd -= ox;
-  ro->full_ht -= oy;
-  // round down to full block size:
-  const int block = mod->img_param.filters == 9u ? 3 : 2;
-  ro->full_wd = (ro->full_wd/block)*block;
-  ro->full_ht = (ro->full_ht/block)*block;
+  mod->img_param = mod_data->img->img_param;
 }
 
 int read_source(
@@ -259,34 +506,44 @@ int read_source(
   if(err) return 1;
   uint16_t *buf = (uint16_t *)mapped;
 
-  // dimensions of uncropped image
   rawinput_buf_t *mod_data = (rawinput_buf_t *)mod->data;
-  rawspeed::iPoint2D dim_uncropped = mod_data->d->mRaw->getUncroppedDim();
-  int wd = dim_uncropped.x;
-  int ht = dim_uncropped.y;
-
-  int ox = mod_data->ox;
-  int oy = mod_data->oy;
-  wd -= ox;
-  ht -= oy;
-  // round down to full block size:
-  const int block = mod->img_param.filters == 9u ? 3 : 2;
-  wd = (wd/block)*block;
-  ht = (ht/block)*block;
-  // TODO: make sure the roi we get on the connector agrees with this!
-  const size_t bufsize_compact = (size_t)wd * ht * mod_data->d->mRaw->getBpp();
-  const size_t bufsize_rawspeed = (size_t)mod_data->d->mRaw->pitch * dim_uncropped.y;
-  if(bufsize_compact == bufsize_rawspeed)
-  {
-    memcpy(buf, mod_data->d->mRaw->getDataUncropped(0, 0), bufsize_compact);
-    return 0;
-  }
-  else
-  {
-    for(int j=0;j<ht;j++)
-      memcpy(buf + j*wd, mod_data->d->mRaw->getDataUncropped(ox, j+oy), sizeof(uint16_t)*wd);
+  const rawinput_img_t *img = get_img(mod_data);
+  // the roi on the connector may be a horizontal strip only, if the graph
+  // is processed in tiles:
+  const dt_roi_t *roi = &mod->connector[0].roi;
+  const uint8_t *in = img->data + img->pitch * roi->y + sizeof(uint16_t) * roi->x;
+  if(img->pitch == sizeof(uint16_t) * roi->wd)
+  { // compact, as in the disk cache
+    memcpy(buf, in, img->pitch * roi->ht);
     return 0;
   }
+  for(uint32_t j=0;j<roi->ht;j++)
+    memcpy(buf + j*roi->wd, in + img->pitch * j, sizeof(uint16_t)*roi->wd);
+  return 0;
+}
+
+// decode into the cache on a worker thread, before the file is opened
+int prefetch(const char *filename)
+{
+  dt_imgcache_entry_t *img = load(filename);
+  dt_imgcache_release(&cache, img);
+  return img == 0;
+}
+
+// let the graph copy straight from the decoded buffer or the mapped cache
+// file if it can
+const void *source_ptr(
+    dt_module_t *mod,
+    size_t *pitch)
+{
+  const char *filename = dt_module_param_string(mod, 0);
+  if(load_raw(mod, filename)) return 0;
+  rawinput_buf_t *mod_data = (rawinput_buf_t *)mod->data;
+  const rawinput_img_t *img = get_img(mod_data);
+  if(img->raw && (*img->raw)->getBpp() != sizeof(uint16_t)) return 0;
+  const dt_roi_t *roi = &mod->connector[0].roi;
+  *pitch = img->pitch;
+  return img->data + img->pitch * roi->y + sizeof(uint16_t) * roi->x;
 }
 
 } // extern "C"
@@ -28,6 +28,12 @@ typedef struct dt_node_t
 
   uint32_t push_constant[64];  // GTX1080 has size == 256 as max anyways
   size_t   push_constant_size;
+
+  uint64_t hash;        // params, rois and push constants as of the last run
+  int      level;       // dependency level in the command buffer, -1 if unreachable
+
+  uint32_t uniform_offset; // our slice of the graph's uniform buffer
+  uint32_t uniform_size;
 }
 dt_node_t;
 
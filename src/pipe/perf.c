@@ -0,0 +1,146 @@
+#include "perf.h"
+#include "core/log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+
+void
+dt_perf_init(dt_perf_t *p)
+{
+  memset(p, 0, sizeof(*p));
+  p->max_entries = 64;
+  p->entry = malloc(sizeof(dt_perf_entry_t)*p->max_entries);
+}
+
+void
+dt_perf_cleanup(dt_perf_t *p)
+{
+  free(p->entry);
+  memset(p, 0, sizeof(*p));
+}
+
+void
+dt_perf_reset(dt_perf_t *p)
+{
+  p->num_entries = 0;
+  p->runs = 0;
+}
+
+static dt_perf_entry_t*
+get_entry(
+    dt_perf_t *p,
+    dt_token_t module,
+    dt_token_t inst,
+    dt_token_t name,
+    dt_token_t kernel,
+    int        id)
+{
+  for(int i=0;i<p->num_entries;i++)
+    if(p->entry[i].module == module && p->entry[i].inst == inst &&
+       p->entry[i].name   == name   && p->entry[i].kernel == kernel &&
+       p->entry[i].id     == id)
+      return p->entry + i;
+  if(p->num_entries == p->max_entries)
+  {
+    p->max_entries *= 2;
+    p->entry = realloc(p->entry, sizeof(dt_perf_entry_t)*p->max_entries);
+  }
+  dt_perf_entry_t *e = p->entry + p->num_entries++;
+  memset(e, 0, sizeof(*e));
+  e->module = module;
+  e->inst   = inst;
+  e->name   = name;
+  e->kernel = kernel;
+  e->id     = id;
+  e->min    = DBL_MAX;
+  return e;
+}
+
+void
+dt_perf_add(
+    dt_perf_t *p,
+    dt_token_t module,
+    dt_token_t inst,
+    dt_token_t name,
+    dt_token_t kernel,
+    int        id,
+    double     ms,
+    uint64_t   bytes_read,
+    uint64_t   bytes_written)
+{
+  dt_perf_entry_t *e = get_entry(p, module, inst, name, kernel, id);
+  e->sample[e->runs++ % DT_PERF_SAMPLES] = ms;
+  if(ms < e->min) e->min = ms;
+  e->bytes_read    = bytes_read;
+  e->bytes_written = bytes_written;
+}
+
+void
+dt_perf_add_total(dt_perf_t *p, double ms)
+{
+  p->total[p->runs++ % DT_PERF_SAMPLES] = ms;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+  const double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+void
+dt_perf_stats(
+    const double    *sample,
+    uint64_t         runs,
+    dt_perf_stats_t *s)
+{
+  memset(s, 0, sizeof(*s));
+  if(!runs) return;
+  const int cnt = runs < DT_PERF_SAMPLES ? runs : DT_PERF_SAMPLES;
+  double sorted[DT_PERF_SAMPLES];
+  memcpy(sorted, sample, sizeof(double)*cnt);
+  qsort(sorted, cnt, sizeof(double), compare_double);
+  for(int i=0;i<cnt;i++) s->mean += sorted[i];
+  s->mean  /= cnt;
+  s->min    = sorted[0];
+  s->median = sorted[cnt/2];
+  // nearest rank:
+  s->p95    = sorted[(95*cnt + 99)/100 - 1];
+  s->last   = sample[(runs-1) % DT_PERF_SAMPLES];
+}
+
+int
+dt_perf_write_json(const dt_perf_t *p, const char *filename)
+{
+  FILE *f = fopen(filename, "wb");
+  if(!f)
+  {
+    dt_log(s_log_err, "could not open perf report '%s' for writing!", filename);
+    return 1;
+  }
+  dt_perf_stats_t s;
+  dt_perf_stats(p->total, p->runs, &s);
+  fprintf(f, "{\n  \"runs\": %lu,\n  \"window\": %d,\n", p->runs, DT_PERF_SAMPLES);
+  fprintf(f, "  \"total_ms\": { \"min\": %.4f, \"mean\": %.4f, \"median\": %.4f, \"p95\": %.4f, \"last\": %.4f },\n",
+      s.min, s.mean, s.median, s.p95, s.last);
+  fprintf(f, "  \"nodes\": [");
+  for(int i=0;i<p->num_entries;i++)
+  {
+    const dt_perf_entry_t *e = p->entry + i;
+    dt_perf_stats(e->sample, e->runs, &s);
+    fprintf(f, "%s\n    { \"module\": \"%"PRItkn"\", \"inst\": \"%"PRItkn"\","
+        " \"name\": \"%"PRItkn"\", \"kernel\": \"%"PRItkn"\", \"id\": %d, \"runs\": %lu,"
+        " \"min_ms\": %.4f, \"mean_ms\": %.4f, \"median_ms\": %.4f, \"p95_ms\": %.4f, \"last_ms\": %.4f,"
+        " \"bytes_read\": %lu, \"bytes_written\": %lu }",
+        i ? "," : "",
+        dt_token_str(e->module), dt_token_str(e->inst),
+        dt_token_str(e->name), dt_token_str(e->kernel), e->id, e->runs,
+        e->min, s.mean, s.median, s.p95, s.last,
+        e->bytes_read, e->bytes_written);
+  }
+  fprintf(f, "\n  ]\n}\n");
+  fclose(f);
+  return 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "token.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+// rolling per-node performance statistics, filled from the timestamp
+// queries of every retired frame. entries are keyed by module instance,
+// node name, kernel and the number of nodes running the same kernel in the
+// instance before this one (llap runs the same kernels on every pyramid
+// level, for instance). this survives the nodes being recreated on
+// structural changes.
+
+// number of most recent runs kept to compute median and percentiles
+#define DT_PERF_SAMPLES 64
+
+typedef struct dt_perf_entry_t
+{
+  dt_token_t module;                   // module class and instance the node belongs to
+  dt_token_t inst;
+  dt_token_t name;
+  dt_token_t kernel;
+  int        id;                       // occurrence of this kernel in the instance
+  uint64_t   runs;                     // number of samples ever added
+  double     min;                      // in milliseconds, over all runs
+  double     sample[DT_PERF_SAMPLES];  // ring buffer of the latest timings in ms
+  uint64_t   bytes_read;               // image bytes of all inputs, last run
+  uint64_t   bytes_written;            // image bytes of all outputs, last run
+}
+dt_perf_entry_t;
+
+typedef struct dt_perf_t
+{
+  dt_perf_entry_t *entry;
+  uint32_t         num_entries;
+  uint32_t         max_entries;
+  uint64_t         runs;               // number of frames with timings
+  double           total[DT_PERF_SAMPLES]; // whole command buffer time per frame in ms
+}
+dt_perf_t;
+
+// summary of the ring buffer of one entry
+typedef struct dt_perf_stats_t
+{
+  double min;
+  double mean;
+  double median;
+  double p95;
+  double last;
+}
+dt_perf_stats_t;
+
+void dt_perf_init(dt_perf_t *p);
+void dt_perf_cleanup(dt_perf_t *p);
+
+// forget all timings
+void dt_perf_reset(dt_perf_t *p);
+
+// add one timing of the given node
+void dt_perf_add(
+    dt_perf_t *p,
+    dt_token_t module,
+    dt_token_t inst,
+    dt_token_t name,
+    dt_token_t kernel,
+    int        id,
+    double     ms,
+    uint64_t   bytes_read,
+    uint64_t   bytes_written);
+
+// add the time of one whole frame
+void dt_perf_add_total(dt_perf_t *p, double ms);
+
+// compute statistics over the latest samples
+void dt_perf_stats(
+    const double    *sample,
+    uint64_t         runs,
+    dt_perf_stats_t *s);
+
+// write all entries as json. returns 0 on success.
+int dt_perf_write_json(const dt_perf_t *p, const char *filename);
@@ -0,0 +1,109 @@
+#include "plan.h"
+#include "core/core.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline int
+live_overlap(const dt_plan_buf_t *a, const dt_plan_buf_t *b)
+{
+  return a->beg <= b->end && b->beg <= a->end;
+}
+
+// sort keys, to get away with plain qsort
+typedef struct sort_t
+{
+  uint64_t key;
+  int      beg;
+  int      idx;
+}
+sort_t;
+
+static int
+compare_size(const void *a, const void *b)
+{ // largest first, then earlier live range
+  const sort_t *sa = a, *sb = b;
+  if(sa->key != sb->key) return sa->key < sb->key ? 1 : -1;
+  return sa->beg - sb->beg;
+}
+
+static int
+compare_offset(const void *a, const void *b)
+{
+  const sort_t *sa = a, *sb = b;
+  return (sa->key > sb->key) - (sa->key < sb->key);
+}
+
+uint64_t
+dt_plan_offsets(dt_plan_buf_t *buf, int cnt)
+{
+  sort_t *order  = malloc(sizeof(sort_t)*cnt);
+  sort_t *placed = malloc(sizeof(sort_t)*cnt);
+  for(int i=0;i<cnt;i++)
+    order[i] = (sort_t){ .key = buf[i].size, .beg = buf[i].beg, .idx = i };
+  qsort(order, cnt, sizeof(sort_t), compare_size);
+
+  uint64_t vmsize = 0;
+  for(int i=0;i<cnt;i++)
+  {
+    dt_plan_buf_t *b = buf + order[i].idx;
+    // collect the buffers placed so far that are live at the same time:
+    int num_placed = 0;
+    for(int j=0;j<i;j++)
+      if(live_overlap(b, buf + order[j].idx))
+        placed[num_placed++] = (sort_t){ .key = buf[order[j].idx].offset, .idx = order[j].idx };
+    qsort(placed, num_placed, sizeof(sort_t), compare_offset);
+
+    // find the smallest gap we fit into, or go behind all of them:
+    uint64_t end = 0, best = -1ul;
+    b->offset = -1ul;
+    for(int j=0;j<num_placed;j++)
+    {
+      const dt_plan_buf_t *o = buf + placed[j].idx;
+      const uint64_t offset = (end + b->alignment - 1) & ~(b->alignment - 1);
+      if(o->offset >= offset + b->size && o->offset - end < best)
+      {
+        best = o->offset - end;
+        b->offset = offset;
+      }
+      end = MAX(end, o->offset + o->size);
+    }
+    if(b->offset == -1ul)
+      b->offset = (end + b->alignment - 1) & ~(b->alignment - 1);
+    vmsize = MAX(vmsize, b->offset + b->size);
+  }
+  free(order);
+  free(placed);
+  return vmsize;
+}
+
+int
+dt_plan_check(const dt_plan_buf_t *buf, int cnt)
+{
+  for(int i=0;i<cnt;i++)
+  {
+    if(buf[i].offset & (buf[i].alignment - 1)) return 1;
+    for(int j=i+1;j<cnt;j++)
+      if(live_overlap(buf+i, buf+j) &&
+         buf[i].offset < buf[j].offset + buf[j].size &&
+         buf[j].offset < buf[i].offset + buf[i].size)
+        return 2;
+  }
+  return 0;
+}
+
+uint64_t
+dt_plan_peak(const dt_plan_buf_t *buf, int cnt)
+{
+  // the sum only changes where a buffer starts:
+  uint64_t peak = 0;
+  for(int i=0;i<cnt;i++)
+  {
+    uint64_t sum = 0;
+    for(int j=0;j<cnt;j++)
+      if(buf[j].beg <= buf[i].beg && buf[i].beg <= buf[j].end)
+        sum += buf[j].size;
+    peak = MAX(peak, sum);
+  }
+  return peak;
+}
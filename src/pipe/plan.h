@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+
+// offline placement of buffers with known live ranges into one heap.
+// the graph uses this after a first pass through the schedule determined
+// when each buffer is allocated and freed. packing the buffers with all
+// their live ranges known gives a much smaller heap than placing them
+// greedily in traversal order.
+
+typedef struct dt_plan_buf_t
+{
+  uint64_t size;
+  uint64_t alignment;  // power of two
+  int      beg, end;   // first and last step the buffer is live, inclusive
+  uint64_t offset;     // result: placement in the heap
+}
+dt_plan_buf_t;
+
+// assign offsets so that buffers with overlapping live ranges don't overlap
+// in memory. largest buffers are placed first, each into the smallest gap
+// between the buffers live at the same time. returns the heap size needed.
+uint64_t dt_plan_offsets(dt_plan_buf_t *buf, int cnt);
+
+// returns non-zero if two buffers which are live at the same time share
+// memory, or if a buffer is misaligned. O(n^2).
+int dt_plan_check(const dt_plan_buf_t *buf, int cnt);
+
+// largest sum of sizes of all buffers live at the same step. no placement
+// can do better than this.
+uint64_t dt_plan_peak(const dt_plan_buf_t *buf, int cnt);
@@ -0,0 +1,105 @@
+#include "prefetch.h"
+#include "global.h"
+#include "core/log.h"
+#include "pthread_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/limits.h>
+
+typedef struct dt_prefetch_job_t
+{
+  pthread_pool_task_t task; // first, so joined tasks cast back to their job
+  dt_module_so_t     *so;
+  char                filename[PATH_MAX];
+}
+dt_prefetch_job_t;
+
+// only the front-end thread queues hints, so the counter needs no lock
+static struct
+{
+  pthread_pool_t        pool;
+  pthread_pool_worker_t worker[DT_PREFETCH_WORKERS];
+  int                   num_workers;
+  int                   num_jobs; // handed to the pool and not joined yet
+}
+prefetch;
+
+static void *
+job_run(void *arg)
+{
+  dt_prefetch_job_t *job = arg;
+  if(job->so->prefetch(job->filename))
+    dt_log(s_log_pipe, "[prefetch] could not decode '%s'", job->filename);
+  return 0;
+}
+
+// free the jobs which are done
+static void
+join_done()
+{
+  pthread_pool_task_t *task;
+  while(!pthread_pool_tryjoin(&prefetch.pool, &task))
+  {
+    free(task);
+    prefetch.num_jobs--;
+  }
+}
+
+int
+dt_prefetch_init()
+{
+  memset(&prefetch, 0, sizeof(prefetch));
+  if(pthread_pool_create(&prefetch.pool, 0)) return 1;
+  for(int k=0;k<DT_PREFETCH_WORKERS;k++)
+    if(!pthread_pool_worker_init(prefetch.worker + k, &prefetch.pool, 0))
+      prefetch.num_workers++;
+  if(!prefetch.num_workers)
+  {
+    pthread_pool_destroy(&prefetch.pool);
+    return 1;
+  }
+  return 0;
+}
+
+void
+dt_prefetch_cleanup()
+{
+  if(!prefetch.num_workers) return;
+  // nobody wants the pending ones any more, take them out of the queue:
+  pthread_mutex_lock(&prefetch.pool.mutex);
+  pthread_pool_task_t *pending = prefetch.pool.tasks_pending;
+  prefetch.pool.tasks_pending = 0;
+  pthread_mutex_unlock(&prefetch.pool.mutex);
+  pthread_pool_wait(&prefetch.pool);
+  join_done();
+  while(pending)
+  {
+    pthread_pool_task_t *next = pending->next;
+    free(pending);
+    pending = next;
+  }
+  pthread_pool_destroy(&prefetch.pool);
+  memset(&prefetch, 0, sizeof(prefetch));
+}
+
+int
+dt_prefetch(dt_token_t module, const char *filename)
+{
+  if(!prefetch.num_workers) return 1;
+  dt_module_so_t *so = dt_pipe_get_module(module);
+  if(!so || !so->prefetch) return 1;
+  join_done();
+  if(prefetch.num_jobs >= DT_PREFETCH_MAX_JOBS) return 1;
+  dt_prefetch_job_t *job = malloc(sizeof(*job));
+  job->so = so;
+  snprintf(job->filename, sizeof(job->filename), "%s", filename);
+  if(pthread_pool_task_init(&job->task, &prefetch.pool, job_run, job))
+  {
+    free(job);
+    return 1;
+  }
+  prefetch.num_jobs++;
+  return 0;
+}
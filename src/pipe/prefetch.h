@@ -0,0 +1,21 @@
+#pragma once
+#include "token.h"
+
+// decodes source images ahead of time. the front-end hints which files it
+// will open next, and a few worker threads hand them to the prefetch callback
+// of the source module, which decodes into the image cache of the module
+// class. when a graph opens the file later on, the source only picks up the
+// decoded image, or waits for the worker in case it isn't done yet.
+
+#define DT_PREFETCH_WORKERS  2 // rawspeed decodes in parallel itself, don't start many
+#define DT_PREFETCH_MAX_JOBS 8 // hints beyond this many pending decodes are dropped
+
+// start the worker threads, returns non-zero on failure
+int dt_prefetch_init();
+
+// drop pending hints, wait for the running decodes and stop the workers
+void dt_prefetch_cleanup();
+
+// hint that the given source module (rawinput, jpginput) will soon open this
+// file. returns non-zero if the hint is dropped.
+int dt_prefetch(dt_token_t module, const char *filename);
@@ -0,0 +1,178 @@
+#pragma once
+// the previous allocator with a sorted free list, O(n) alloc and free.
+// only kept here as a baseline for the benchmark in alloc.c. the consistency
+// checks on every call are stripped.
+#include "../dlist.h"
+#include "core/core.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+typedef struct dt_listmem_t
+{
+  uint64_t offset;          // to be uploaded as uniform/push const
+  uint64_t offset_orig;     // unaligned offset
+  uint64_t ref  : 16;       // reference count
+  uint64_t size : 48;       // only for us, the gpu will know what they asked for
+  struct dt_listmem_t *prev;  // for alloced/free lists
+  struct dt_listmem_t *next;
+}
+dt_listmem_t;
+
+typedef struct dt_listalloc_t
+{
+  dt_listmem_t *used;
+  dt_listmem_t *free;
+
+  // fixed size pool of dt_listmem_t to not fragment our real heap with this nonsense:
+  uint64_t pool_size;
+  dt_listmem_t *vkmem_pool; // fixed size pool allocation
+  dt_listmem_t *unused;     // linked list into the above which are neither used nor free
+
+  uint64_t heap_size;
+  uint64_t peak_rss;
+  uint64_t rss;
+  uint64_t vmsize; // <= necessary to stay within limits here!
+}
+dt_listalloc_t;
+
+static void dt_listalloc_nuke(dt_listalloc_t *a);
+
+static void
+dt_listalloc_init(dt_listalloc_t *a)
+{
+  memset(a, 0, sizeof(*a));
+  a->heap_size = 1ul<<40; // doesn't matter, we'll never allocate this for real
+  a->pool_size = 4096; // the original had 100, not enough for the traces
+  a->vkmem_pool = malloc(sizeof(dt_listmem_t)*a->pool_size);
+  dt_listalloc_nuke(a);
+}
+
+static void
+dt_listalloc_cleanup(dt_listalloc_t *a)
+{
+  // free whole thing
+  free(a->vkmem_pool);
+  // don't free a, it's owned externally
+  memset(a, 0, sizeof(*a));
+}
+
+static void
+dt_listalloc_nuke(dt_listalloc_t *a)
+{
+  memset(a->vkmem_pool, 0, sizeof(dt_listmem_t)*a->pool_size); 
+  a->free = a->used = a->unused = 0;
+  a->free = DLIST_PREPEND(a->free, a->vkmem_pool);
+  a->free->offset = 0;
+  a->free->offset_orig = 0;
+  a->free->size = a->heap_size;
+  for(int i=1;i<a->pool_size;i++)
+    a->unused = DLIST_PREPEND(a->unused, a->vkmem_pool+i);
+  a->peak_rss = a->rss = a->vmsize = 0ul;
+}
+
+static dt_listmem_t*
+dt_listalloc(dt_listalloc_t *a, uint64_t size, uint64_t alignment)
+{
+  // linear scan through free list O(n)
+  dt_listmem_t *l = a->free;
+  while(l)
+  {
+    dt_listmem_t *mem = 0;
+    if(l->size == size && !(l->offset & (alignment-1)))
+    { // replace entry
+      mem = l;
+      if(l == a->free) a->free = l->next;
+      DLIST_RM_ELEMENT(mem);
+    }
+    else if((l->size > size && !(l->offset_orig & (alignment-1))) ||
+        l->size > size + alignment)
+    { // grab new mem entry from unused list
+      assert(a->unused && "vkalloc: no more free slots!");
+      if(!a->unused) return 0;
+      mem = a->unused;
+      a->unused = DLIST_REMOVE(a->unused, mem); // remove first is O(1)
+      // split, push to used and modify free entry.
+      // we'll just forget about the bits in between our base pointer
+      // and the requested alignment. we rely on nuking the memory pool
+      // very often anyways. plus, what's a few kilobytes among friends.
+      size_t end = l->offset_orig + l->size;
+      mem->offset_orig = l->offset_orig;
+      mem->offset = ((l->offset_orig + (alignment-1)) & ~(alignment-1));
+      assert(size < 1ul<<48);
+      mem->size = size;
+      l->offset = l->offset_orig = mem->offset + mem->size;
+      assert(end >= l->offset_orig);
+      l->size = end - l->offset_orig;
+    }
+
+    if(mem)
+    {
+      a->rss += mem->size;
+      a->peak_rss = MAX(a->peak_rss, a->rss);
+      a->vmsize = MAX(a->vmsize, mem->offset + mem->size);
+      a->used = DLIST_PREPEND(a->used, mem);
+      mem->ref = 1;
+      return mem;
+    }
+    l = l->next;
+  }
+  assert(0 && "out of memory slots!");
+  return 0;
+}
+
+static void
+dt_listfree(dt_listalloc_t *a, dt_listmem_t *mem)
+{
+  assert(mem->ref > 0);
+  if(mem->ref)
+  {
+    mem->ref--;
+    if(mem->ref) return; // don't free if still referenced
+  }
+  else return; // no ref count: already freed
+  // remove from used list, put back to free list.
+  a->rss -= mem->size;
+  a->used = DLIST_REMOVE(a->used, mem);
+  dt_listmem_t *l = a->free;
+  do
+  {
+    // keep sorted
+    if(!l || l->offset >= mem->offset + mem->size)
+    {
+      dt_listmem_t *t = DLIST_PREPEND(l, mem);
+      if(l == a->free) a->free = t; // keep consistent
+      // merge blocks:
+      t = mem->prev;
+      if(t)
+      { // merge with before
+        if(t->offset + t->size == mem->offset_orig)
+        {
+          t->size += mem->size + mem->offset - mem->offset_orig;
+          if(a->free == mem) a->free = mem->next;
+          DLIST_RM_ELEMENT(mem);
+          a->unused = DLIST_PREPEND(a->unused, mem);
+          mem = t;
+        }
+      }
+      t = mem->next;
+      if(t)
+      { // merge with after
+        if(t->offset_orig == mem->offset + mem->size)
+        {
+          t->offset = t->offset_orig = mem->offset_orig;
+          t->size += mem->size + mem->offset - mem->offset_orig;
+          if(a->free == mem) a->free = mem->next;
+          DLIST_RM_ELEMENT(mem);
+          a->unused = DLIST_PREPEND(a->unused, mem);
+          mem = t;
+        }
+      }
+      return; // done
+    }
+  }
+  while(l && (l = l->next));
+  assert(0 && "vkalloc: inconsistent free list!");
+}
@@ -1,7 +1,90 @@
 #include "../alloc.h"
+#include "alloc-list.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <time.h>
+
+// synthetic allocation trace like the graph produces it: nodes in
+// topological order allocate one output each, which is read by a few of the
+// following nodes and freed after its last reader.
+#define TRACE_NODES 1000
+#define TRACE_READS 3
+
+typedef struct trace_t
+{
+  uint64_t size[TRACE_NODES];
+  uint64_t alignment[TRACE_NODES];
+  int      refs[TRACE_NODES];
+  int      input[TRACE_NODES][TRACE_READS]; // nodes whose output we read, -1 if none
+}
+trace_t;
+
+static void
+trace_init(trace_t *t, unsigned seed)
+{
+  srand(seed);
+  const uint64_t alignment[] = {256, 4096, 65536};
+  for(int i=0;i<TRACE_NODES;i++)
+  {
+    // full size, downscaled pyramid levels and small buffers:
+    const uint64_t full = 6000ul*4000ul*8ul;
+    t->size[i] = (full >> (2*(rand() % 6))) + 64*(rand() % 1000);
+    t->alignment[i] = alignment[rand() % 3];
+    t->refs[i] = 0;
+    for(int k=0;k<TRACE_READS;k++)
+    {
+      t->input[i][k] = -1;
+      if(i > 0 && (k == 0 || rand() % 2))
+        t->input[i][k] = MAX(0, i - 1 - rand() % 20);
+    }
+  }
+  for(int i=0;i<TRACE_NODES;i++)
+    for(int k=0;k<TRACE_READS;k++)
+      if(t->input[i][k] >= 0) t->refs[t->input[i][k]]++;
+}
+
+static double
+time_ms(struct timespec *beg)
+{
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - beg->tv_sec) * 1e3 + (end.tv_nsec - beg->tv_nsec) * 1e-6;
+}
+
+static uint64_t
+run_trace_tlsf(dt_vkalloc_t *a, const trace_t *t, int check)
+{
+  dt_vkmem_t *mem[TRACE_NODES];
+  dt_vkalloc_nuke(a);
+  for(int i=0;i<TRACE_NODES;i++)
+  {
+    mem[i] = dt_vkalloc(a, t->size[i], t->alignment[i]);
+    assert(mem[i]);
+    assert(!(mem[i]->offset & (t->alignment[i]-1)));
+    mem[i]->ref = t->refs[i];
+    for(int k=0;k<TRACE_READS;k++)
+      if(t->input[i][k] >= 0) dt_vkfree(a, mem[t->input[i][k]]);
+    if(check) assert(!dt_vkalloc_check(a));
+  }
+  return a->vmsize;
+}
+
+static uint64_t
+run_trace_list(dt_listalloc_t *a, const trace_t *t)
+{
+  dt_listmem_t *mem[TRACE_NODES];
+  dt_listalloc_nuke(a);
+  for(int i=0;i<TRACE_NODES;i++)
+  {
+    mem[i] = dt_listalloc(a, t->size[i], t->alignment[i]);
+    assert(mem[i]);
+    mem[i]->ref = t->refs[i];
+    for(int k=0;k<TRACE_READS;k++)
+      if(t->input[i][k] >= 0) dt_listfree(a, mem[t->input[i][k]]);
+  }
+  return a->vmsize;
+}
 
 int main(int argc, char *arg[])
 {
@@ -9,33 +92,94 @@ int main(int argc, char *arg[])
   dt_vkalloc_init(&a);
   // alloc a few test things with known outcome
 
-  dt_vkmem_t *test[70] = {0};
+  dt_vkmem_t *test[700] = {0};
 
   int err;
   err = dt_vkalloc_check(&a);
   assert(!err);
 
-  for(int i=0;i<70;i++)
+  // more than the old fixed pool of 100 slots:
+  for(int i=0;i<700;i++)
   {
     uint64_t size = 1337 + 10*i;
     test[i] = dt_vkalloc(&a, size, 1);
     err = dt_vkalloc_check(&a);
     assert(!err);
   }
-  // TODO: random order!
-  for(int i=0;i<70;i+=2)
+  for(int i=0;i<700;i+=2)
   {
     dt_vkfree(&a, test[i]);
     err = dt_vkalloc_check(&a);
     assert(!err);
   }
-  for(int i=70-1;i>=0;i-=2)
+  // random order:
+  srand(666);
+  for(int i=700-1;i>0;i--)
   {
+    int j = rand() % (i+1);
+    dt_vkmem_t *tmp = test[i]; test[i] = test[j]; test[j] = tmp;
+  }
+  for(int i=0;i<700;i++)
+  {
+    if(!test[i]->ref) continue; // freed above
     dt_vkfree(&a, test[i]);
     err = dt_vkalloc_check(&a);
     assert(!err);
   }
+  // everything coalesced back into one block:
+  assert(a.rss == 0);
+  assert(!a.used);
+  // aligned allocations:
+  for(int i=0;i<100;i++)
+  {
+    test[i] = dt_vkalloc(&a, 1000 + i, 1ul<<(i%17));
+    assert(!(test[i]->offset & ((1ul<<(i%17))-1)));
+    err = dt_vkalloc_check(&a);
+    assert(!err);
+  }
+  for(int i=0;i<100;i++) dt_vkfree(&a, test[i]);
+  err = dt_vkalloc_check(&a);
+  assert(!err);
+
+  // a heap of limited size, like the blocks of the shared device memory:
+  dt_vkalloc_t small;
+  dt_vkalloc_init(&small);
+  small.heap_size = 1ul<<20;
+  dt_vkalloc_nuke(&small);
+  dt_vkmem_t *half = dt_vkalloc(&small, 1ul<<19, 1ul<<16);
+  assert(half);
+  assert(!dt_vkalloc(&small, (1ul<<19) + 1, 1ul<<16)); // out of heap
+  dt_vkfree(&small, half);
+  assert(dt_vkalloc(&small, 1ul<<20, 1ul<<16)); // coalesced into one block again
+  err = dt_vkalloc_check(&small);
+  assert(!err);
+  dt_vkalloc_cleanup(&small);
+
+  // benchmark against the old list allocator
+  trace_t *t = malloc(sizeof(*t));
+  trace_init(t, 1337);
+  run_trace_tlsf(&a, t, 1); // once with checks
+
+  dt_listalloc_t l;
+  dt_listalloc_init(&l);
+  const int runs = 100;
+  uint64_t vm_tlsf = 0, vm_list = 0;
+  struct timespec beg;
+  clock_gettime(CLOCK_MONOTONIC, &beg);
+  for(int r=0;r<runs;r++) vm_tlsf = run_trace_tlsf(&a, t, 0);
+  const double ms_tlsf = time_ms(&beg);
+  clock_gettime(CLOCK_MONOTONIC, &beg);
+  for(int r=0;r<runs;r++) vm_list = run_trace_list(&l, t);
+  const double ms_list = time_ms(&beg);
+
+  fprintf(stderr, "%d node trace, %d runs:\n", TRACE_NODES, runs);
+  fprintf(stderr, "  tlsf      %8.3f ms/run vmsize %8.2f MB, %lu slots\n",
+      ms_tlsf/runs, vm_tlsf/(1024.0*1024.0), a.pool_size);
+  fprintf(stderr, "  free list %8.3f ms/run vmsize %8.2f MB\n",
+      ms_list/runs, vm_list/(1024.0*1024.0));
 
+  free(t);
+  dt_listalloc_cleanup(&l);
   dt_vkalloc_cleanup(&a);
   exit(0);
 }
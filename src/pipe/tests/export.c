@@ -0,0 +1,141 @@
+#include <sys/types.h>
+#include "../modules/export/half.h"
+#include "../modules/export/write.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+// the writers get rows packed on the device by the shared/pack16f kernel.
+// pack the same way here, check the files against one fwrite per pixel from
+// the rgba buffer (what export used to do), for widths with and without
+// padding at the end of the rows, and compare throughput. the vectorised
+// half to float conversion of the pfm writer is checked for every half.
+#define WD 4000
+#define HT 3000
+
+static double
+time_ms(struct timespec *beg)
+{
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - beg->tv_sec) * 1e3 + (end.tv_nsec - beg->tv_nsec) * 1e-6;
+}
+
+static void
+check_convert(void (*convert)(const uint16_t *, float *, size_t))
+{
+  const size_t n = (1<<16) + 3; // all halves, and a few left over for the tail
+  uint16_t *in = malloc(sizeof(uint16_t) * n);
+  float *out = malloc(sizeof(float) * n);
+  for(size_t k=0;k<n;k++) in[k] = k;
+  convert(in, out, n);
+  for(size_t k=0;k<n;k++)
+  {
+    const float ref = half_to_float(in[k]);
+    if(isnan(ref)) assert(isnan(out[k]));
+    else assert(!memcmp(&ref, out + k, sizeof(float)));
+  }
+  free(in);
+  free(out);
+}
+
+// what pack16f.comp does, rows padded to 16 bytes
+static uint8_t *
+pack(const uint16_t *p16, int width, int height)
+{
+  const size_t pitch = (6 * width + 15) / 16 * 16;
+  uint8_t *buf = calloc(pitch, height);
+  for(int j=0;j<height;j++) for(int i=0;i<width;i++)
+    memcpy(buf + pitch*j + 6*i, p16 + 4*((size_t)width*j+i), 6);
+  return buf;
+}
+
+// what export used to do
+static void
+write_pfm_per_pixel(const char *filename, const uint16_t *p16, int width, int height)
+{
+  FILE* f = fopen(filename, "wb");
+  fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
+  for(size_t k=0;k<(size_t)width*height;k++)
+  {
+    float p32[3] = {
+      half_to_float(p16[4*k+0]),
+      half_to_float(p16[4*k+1]),
+      half_to_float(p16[4*k+2])};
+    fwrite(p32, sizeof(float), 3ul, f);
+  }
+  fclose(f);
+}
+
+static uint8_t *
+read_file(const char *filename, size_t *size)
+{
+  FILE *f = fopen(filename, "rb");
+  assert(f);
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *buf = malloc(*size);
+  assert(fread(buf, 1, *size, f) == *size);
+  fclose(f);
+  return buf;
+}
+
+static void
+check(const uint16_t *img, int width, int height, int bench)
+{
+  uint8_t *rgb16 = pack(img, width, height);
+  const double mb = sizeof(uint16_t) * 4.0 * width * height / (1024.0 * 1024.0);
+
+  struct timespec beg;
+  clock_gettime(CLOCK_MONOTONIC, &beg);
+  write_pfm_per_pixel("/tmp/vkdt-export-ref.pfm", img, width, height);
+  const double ms_ref = time_ms(&beg);
+  clock_gettime(CLOCK_MONOTONIC, &beg);
+  assert(!write_pfm("/tmp/vkdt-export.pfm", rgb16, width, height, (6 * width + 15) / 16 * 16));
+  const double ms_pfm = time_ms(&beg);
+  clock_gettime(CLOCK_MONOTONIC, &beg);
+  assert(!write_tif("/tmp/vkdt-export.tif", rgb16, width, height, (6 * width + 15) / 16 * 16));
+  const double ms_tif = time_ms(&beg);
+
+  // same pixels after the header:
+  size_t ref_size, pfm_size, tif_size;
+  uint8_t *ref = read_file("/tmp/vkdt-export-ref.pfm", &ref_size);
+  uint8_t *pfm = read_file("/tmp/vkdt-export.pfm", &pfm_size);
+  uint8_t *tif = read_file("/tmp/vkdt-export.tif", &tif_size);
+  const size_t px = sizeof(float) * 3ul * width * height;
+  assert(ref_size > px && pfm_size > px);
+  assert(!memcmp(ref + ref_size - px, pfm + pfm_size - px, px));
+  assert(tif_size == 160 + 6ul * width * height);
+  assert(tif[0] == 'I' && tif[1] == 'I' && tif[2] == 42);
+  for(size_t k=0;k<(size_t)width*height;k++)
+    assert(!memcmp(tif + 160 + 6*k, img + 4*k, 6));
+
+  if(bench)
+    fprintf(stderr, "%.0f MB: per pixel pfm %.1f MB/s, packed pfm %.1f MB/s, packed half tif %.1f MB/s\n",
+        mb, mb / ms_ref * 1e3, mb / ms_pfm * 1e3, mb / ms_tif * 1e3);
+  unlink("/tmp/vkdt-export-ref.pfm");
+  unlink("/tmp/vkdt-export.pfm");
+  unlink("/tmp/vkdt-export.tif");
+  free(ref);
+  free(pfm);
+  free(tif);
+  free(rgb16);
+}
+
+int main(int argc, char *argv[])
+{
+  check_convert(half_to_float_n_SSE2);
+  if(__builtin_cpu_supports("f16c")) check_convert(half_to_float_n_F16C);
+
+  uint16_t *img = malloc(sizeof(uint16_t) * 4 * WD * HT);
+  for(size_t k=0;k<4ul*WD*HT;k++) img[k] = float_to_half((k % 4099) / 4099.0f);
+  check(img, 333, 17, 0); // padded rows
+  check(img, WD, HT, 1);
+  free(img);
+  exit(0);
+}
@@ -0,0 +1,53 @@
+#include "../perf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+int main(int argc, char *arg[])
+{
+  dt_perf_t p;
+  dt_perf_init(&p);
+
+  dt_perf_stats_t s;
+  dt_perf_stats(p.total, p.runs, &s);
+  assert(s.median == 0.0);
+
+  // more nodes than initially allocated, and a window that wrapped around.
+  // the same kernel runs 10 times per instance, like the levels of a pyramid:
+  for(int r=0;r<100;r++)
+  {
+    for(int n=0;n<100;n++)
+      dt_perf_add(&p, dt_token("llap"), dt_token("0")+n/10, dt_token("llap"), dt_token("main"),
+          n%10, 1.0 + (r % 20), 16*n, 4*n);
+    dt_perf_add_total(&p, 100.0 - r);
+  }
+  assert(p.num_entries == 100);
+  for(int n=0;n<100;n++)
+  {
+    const dt_perf_entry_t *e = p.entry + n;
+    assert(e->inst == dt_token("0")+n/10 && e->id == n%10);
+    assert(e->runs == 100);
+    assert(e->min == 1.0);
+    assert(e->bytes_read == 16*n);
+    dt_perf_stats(e->sample, e->runs, &s);
+    // latest 64 runs are r=36..99, timings 17..20 then 1..20 three times.
+    // sorted, that is 1..16 three times then 17..20 four times each:
+    assert(s.min == 1.0);
+    assert(s.last == 20.0);
+    assert(s.median == 11.0);
+    assert(s.p95 == 20.0);
+  }
+
+  // totals are 64..1 in the window:
+  dt_perf_stats(p.total, p.runs, &s);
+  assert(s.min == 1.0);
+  assert(s.median == 33.0);
+  assert(s.p95 == 61.0);
+  assert(s.last == 1.0);
+
+  dt_perf_reset(&p);
+  assert(p.num_entries == 0);
+  dt_perf_cleanup(&p);
+  fprintf(stderr, "perf stats ok\n");
+  exit(0);
+}
@@ -0,0 +1,78 @@
+#include "../plan.h"
+#include "../alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+// live ranges like a graph with a few long lived buffers (module outputs
+// kept as cache) and many short lived intermediates.
+static int
+random_plan(dt_plan_buf_t *buf, int cnt, int steps)
+{
+  const uint64_t alignment[] = {256, 4096, 65536};
+  for(int i=0;i<cnt;i++)
+  {
+    buf[i].size      = (24000000ul >> (2*(rand() % 5))) + 64*(rand() % 1000);
+    buf[i].alignment = alignment[rand() % 3];
+    buf[i].beg       = rand() % steps;
+    buf[i].end       = rand() % 8 ? buf[i].beg + rand() % 10 : steps;
+    buf[i].offset    = 0;
+  }
+  return cnt;
+}
+
+// place the same buffers greedily in order of their start, like the graph
+// used to do it.
+static uint64_t
+greedy(dt_plan_buf_t *buf, int cnt, int steps)
+{
+  dt_vkalloc_t a;
+  dt_vkalloc_init(&a);
+  dt_vkmem_t **mem = calloc(cnt, sizeof(dt_vkmem_t*));
+  for(int s=0;s<=steps;s++)
+  {
+    for(int i=0;i<cnt;i++)
+      if(buf[i].beg == s) mem[i] = dt_vkalloc(&a, buf[i].size, buf[i].alignment);
+    for(int i=0;i<cnt;i++)
+      if(buf[i].end == s) dt_vkfree(&a, mem[i]);
+  }
+  const uint64_t vmsize = a.vmsize;
+  free(mem);
+  dt_vkalloc_cleanup(&a);
+  return vmsize;
+}
+
+int main(int argc, char *arg[])
+{
+  // two buffers live at different times share the memory:
+  dt_plan_buf_t two[] = {
+    { .size = 1000, .alignment = 1, .beg = 0, .end = 1 },
+    { .size = 1000, .alignment = 1, .beg = 2, .end = 3 },
+    { .size = 500,  .alignment = 1, .beg = 1, .end = 2 },
+  };
+  assert(dt_plan_offsets(two, 3) == 1500);
+  assert(!dt_plan_check(two, 3));
+  assert(two[0].offset == two[1].offset);
+
+  // an overlap has to be detected:
+  two[2].offset = two[0].offset;
+  assert(dt_plan_check(two, 3));
+
+  srand(1337);
+  const int cnt = 500, steps = 250;
+  dt_plan_buf_t *buf = malloc(sizeof(dt_plan_buf_t)*cnt);
+  for(int r=0;r<10;r++)
+  {
+    random_plan(buf, cnt, steps);
+    const uint64_t vmsize = dt_plan_offsets(buf, cnt);
+    assert(!dt_plan_check(buf, cnt));
+    const uint64_t peak = dt_plan_peak(buf, cnt);
+    assert(vmsize >= peak);
+    for(int i=0;i<cnt;i++) assert(buf[i].offset + buf[i].size <= vmsize);
+    const uint64_t vm_greedy = greedy(buf, cnt, steps);
+    fprintf(stderr, "live peak %8.2f MB planned %8.2f MB greedy %8.2f MB\n",
+        peak/(1024.0*1024.0), vmsize/(1024.0*1024.0), vm_greedy/(1024.0*1024.0));
+  }
+  free(buf);
+  exit(0);
+}
@@ -0,0 +1,55 @@
+#include "../connector.h"
+#include "core/core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// sources are read in bands of rows of the roi. a band has to sample the
+// input exactly where the rows of the whole roi do, also for scaled rois.
+
+// the input image has the input row as pixel value
+static void
+read_source(const dt_roi_t *roi, uint32_t *out)
+{
+  for(uint32_t j=0;j<roi->ht;j++)
+    for(uint32_t i=0;i<roi->wd;i++)
+      out[roi->wd*j+i] = MIN(roi->full_ht-1, (uint32_t)(roi->y + j * roi->scale));
+}
+
+static void
+check(float scale, uint32_t y, uint32_t rows)
+{
+  dt_roi_t roi = {
+    .full_wd = 100, .full_ht = 4000,
+    .wd = 3, .ht = (4000 - y) / scale,
+    .y = y, .scale = scale,
+  };
+  uint32_t *full = malloc(sizeof(uint32_t)*roi.wd*roi.ht);
+  uint32_t *band = malloc(sizeof(uint32_t)*roi.wd*roi.ht);
+  read_source(&roi, full);
+  const uint32_t r = dt_roi_band_rows(&roi, rows);
+  assert(r > 0 && r <= rows);
+  for(uint32_t b=0;b<roi.ht;b+=r)
+  {
+    const dt_roi_t band_roi = dt_roi_band(&roi, b, MIN(r, roi.ht - b));
+    assert(band_roi.scale == roi.scale && band_roi.wd == roi.wd);
+    read_source(&band_roi, band + roi.wd * b);
+  }
+  assert(!memcmp(full, band, sizeof(uint32_t)*roi.wd*roi.ht));
+  free(full);
+  free(band);
+}
+
+int main(int argc, char *argv[])
+{
+  const float scale[] = {1.0f, 2.0f, 2.5f, 4.0f, 0.5f, 1.5f, 8.0f};
+  for(int s=0;s<sizeof(scale)/sizeof(scale[0]);s++)
+  {
+    check(scale[s], 0, 37);
+    check(scale[s], 6, 37);
+    check(scale[s], 120, 100);
+  }
+  fprintf(stderr, "banded rois ok\n");
+  exit(0);
+}
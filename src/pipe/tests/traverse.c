@@ -0,0 +1,109 @@
+#include "../token.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+// a long chain with skip connections, much deeper than the old fixed size
+// traversal stack. every element reads the previous one and the one at half
+// its index, the last one is the sink.
+#define NUM 20000
+
+typedef struct elem_t
+{
+  struct
+  {
+    dt_token_t type;
+    int connected_mi;
+  }
+  connector[3];
+  int num_connectors;
+}
+elem_t;
+
+static void
+build(elem_t *arr, int *edge_beg, int *edge)
+{
+  int k = 0;
+  for(int i=0;i<NUM;i++)
+  {
+    edge_beg[i] = k;
+    arr[i].num_connectors = 3;
+    arr[i].connector[0].type = i == NUM-1 ? dt_token("sink") : dt_token("read");
+    arr[i].connector[0].connected_mi = i ? i-1 : -1;
+    arr[i].connector[1].type = dt_token("read");
+    arr[i].connector[1].connected_mi = i ? i/2 : -1;
+    arr[i].connector[2].type = dt_token("write");
+    arr[i].connector[2].connected_mi = 1;
+    for(int c=0;c<2;c++)
+      if(arr[i].connector[c].connected_mi >= 0)
+        edge[k++] = arr[i].connector[c].connected_mi;
+  }
+  edge_beg[NUM] = k;
+}
+
+static double
+time_ms(struct timespec *beg)
+{
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - beg->tv_sec) * 1e3 + (end.tv_nsec - beg->tv_nsec) * 1e-6;
+}
+
+// every element has to come after all of its inputs
+static void
+check(const elem_t *arr, const int *order, int cnt)
+{
+  assert(cnt == NUM);
+  for(int i=0;i<NUM;i++)
+    for(int c=0;c<2;c++)
+      if(arr[i].connector[c].connected_mi >= 0)
+        assert(order[arr[i].connector[c].connected_mi] < order[i]);
+}
+
+int main(int argc, char *argv[])
+{
+  elem_t *arr = malloc(sizeof(elem_t)*NUM);
+  int *edge_beg = malloc(sizeof(int)*(NUM+1));
+  int *edge = malloc(sizeof(int)*2*NUM);
+  int *order = malloc(sizeof(int)*NUM);
+  const int arr_cnt = NUM;
+  uint8_t *scratch = 0;
+  size_t scratch_size = 0;
+  build(arr, edge_beg, edge);
+
+  struct timespec beg;
+  int cnt = 0;
+  memset(order, 0xff, sizeof(int)*NUM);
+  clock_gettime(CLOCK_MONOTONIC, &beg);
+#define TRAVERSE_POST\
+  order[curr] = cnt++;
+#define TRAVERSE_SCRATCH      scratch
+#define TRAVERSE_SCRATCH_SIZE scratch_size
+#include "../graph-traverse.inc"
+  const double ms_conn = time_ms(&beg);
+  check(arr, order, cnt);
+
+  cnt = 0;
+  memset(order, 0xff, sizeof(int)*NUM);
+  clock_gettime(CLOCK_MONOTONIC, &beg);
+#define TRAVERSE_POST\
+  order[curr] = cnt++;
+#define TRAVERSE_EDGE_BEG edge_beg
+#define TRAVERSE_EDGE     edge
+#define TRAVERSE_SCRATCH      scratch
+#define TRAVERSE_SCRATCH_SIZE scratch_size
+#include "../graph-traverse.inc"
+  const double ms_edge = time_ms(&beg);
+  check(arr, order, cnt);
+
+  fprintf(stderr, "%d elements: connectors %.3f ms, edge list %.3f ms\n",
+      NUM, ms_conn, ms_edge);
+  free(arr);
+  free(edge_beg);
+  free(edge);
+  free(order);
+  free(scratch);
+  exit(0);
+}
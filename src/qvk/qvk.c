@@ -540,6 +540,37 @@ qvk_init()
   dt_log(s_log_qvk, "picked device %d", picked_device);
 
   qvk.physical_device = devices[picked_device];
+  {
+    VkPhysicalDeviceProperties dev_properties;
+    vkGetPhysicalDeviceProperties(qvk.physical_device, &dev_properties);
+    qvk.uniform_alignment = dev_properties.limits.minUniformBufferOffsetAlignment;
+    qvk.uniform_max_range = dev_properties.limits.maxUniformBufferRange;
+    uint32_t num_ext;
+    vkEnumerateDeviceExtensionProperties(qvk.physical_device, NULL, &num_ext, NULL);
+    VkExtensionProperties *ext_properties = alloca(sizeof(VkExtensionProperties) * num_ext);
+    vkEnumerateDeviceExtensionProperties(qvk.physical_device, NULL, &num_ext, ext_properties);
+    qvk.memory_budget_supported = 0;
+    qvk.external_memory_host_supported = 0;
+    for(int j = 0; j < num_ext; j++)
+    {
+      if(!strcmp(ext_properties[j].extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+        qvk.memory_budget_supported = 1;
+      if(!strcmp(ext_properties[j].extensionName, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME))
+        qvk.external_memory_host_supported = 1;
+    }
+    if(qvk.external_memory_host_supported)
+    { // imported host pointers and sizes need to be aligned to this:
+      VkPhysicalDeviceExternalMemoryHostPropertiesEXT host_properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT,
+      };
+      VkPhysicalDeviceProperties2 dev_properties2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &host_properties,
+      };
+      vkGetPhysicalDeviceProperties2(qvk.physical_device, &dev_properties2);
+      qvk.host_pointer_alignment = host_properties.minImportedHostPointerAlignment;
+    }
+  }
 
 
   vkGetPhysicalDeviceMemoryProperties(qvk.physical_device, &qvk.mem_properties);
@@ -685,14 +716,18 @@ qvk_init()
     }
   };
 
-  const char *vk_requested_device_extensions[] = {
-    // VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, // :( intel doesn't have it
+  const char *vk_requested_device_extensions[8];
+  int len = 0;
+  // vk_requested_device_extensions[len++] = VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME; // :( intel doesn't have it
 #ifdef QVK_ENABLE_VALIDATION
-    VK_EXT_DEBUG_MARKER_EXTENSION_NAME,
+  vk_requested_device_extensions[len++] = VK_EXT_DEBUG_MARKER_EXTENSION_NAME;
 #endif
-    VK_KHR_SWAPCHAIN_EXTENSION_NAME, // goes last because we might not want it without gui
-  };
-  const int len = LENGTH(vk_requested_device_extensions) - (qvk.window ? 0 : 1);
+  if(qvk.memory_budget_supported) // used to decide when to tile the graph
+    vk_requested_device_extensions[len++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+  if(qvk.external_memory_host_supported) // used to upload sources without staging copy
+    vk_requested_device_extensions[len++] = VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME;
+  if(qvk.window) // we don't want a swapchain without gui
+    vk_requested_device_extensions[len++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
   VkDeviceCreateInfo dev_create_info = {
     .sType                   = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
     .pNext                   = &device_features,
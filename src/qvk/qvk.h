@@ -168,6 +168,11 @@ typedef struct qvk_t
   VkDescriptorSet             desc_set_vertex_buffer;
 
   float                       ticks_to_nanoseconds;
+  uint64_t                    uniform_alignment;    // min offset alignment of uniform buffers
+  uint64_t                    uniform_max_range;    // max size of one uniform buffer binding
+  int                         memory_budget_supported; // VK_EXT_memory_budget enabled on device
+  int                         external_memory_host_supported; // VK_EXT_external_memory_host enabled on device
+  uint64_t                    host_pointer_alignment;  // min alignment of imported host pointers
 }
 qvk_t;
 
@@ -176,7 +181,8 @@ extern qvk_t qvk;
 
 
 #define _VK_EXTENSION_LIST \
-  _VK_EXTENSION_DO(vkDebugMarkerSetObjectNameEXT)
+  _VK_EXTENSION_DO(vkDebugMarkerSetObjectNameEXT) \
+  _VK_EXTENSION_DO(vkGetMemoryHostPointerPropertiesEXT)
 // none of these are supported on intel:
 // #define _VK_EXTENSION_LIST \
 // 	_VK_EXTENSION_DO(vkCreateAccelerationStructureNV) \
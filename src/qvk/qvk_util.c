@@ -34,6 +34,26 @@ qvk_get_memory_type(uint32_t mem_req_type_bits, VkMemoryPropertyFlags mem_prop)
 	return 0;
 }
 
+VkDeviceSize
+qvk_get_memory_budget(uint32_t memory_type)
+{
+	const uint32_t heap = qvk.mem_properties.memoryTypes[memory_type].heapIndex;
+	if(!qvk.memory_budget_supported)
+		return qvk.mem_properties.memoryHeaps[heap].size;
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+	};
+	VkPhysicalDeviceMemoryProperties2 prop = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+		.pNext = &budget,
+	};
+	vkGetPhysicalDeviceMemoryProperties2(qvk.physical_device, &prop);
+	// the budget includes what this process already allocated, the usage
+	// does too. only hand out what is left to us:
+	if(budget.heapUsage[heap] >= budget.heapBudget[heap]) return 0;
+	return budget.heapBudget[heap] - budget.heapUsage[heap];
+}
+
 #if 0
 VkResult
 buffer_create(
@@ -41,6 +41,9 @@ void *buffer_map(BufferResource_t *buf);
 void buffer_unmap(BufferResource_t *buf);
 
 uint32_t qvk_get_memory_type(uint32_t mem_req_type_bits, VkMemoryPropertyFlags mem_prop);
+// returns how many bytes can still be allocated from the heap of the given
+// memory type. uses VK_EXT_memory_budget if available, else the heap size.
+VkDeviceSize qvk_get_memory_budget(uint32_t memory_type);
 
 #define BARRIER_COMPUTE_BUFFER(buf) \
   do { \